@@ -0,0 +1,105 @@
+/*!
+ * \file topology_test.cpp
+ *
+ * \brief 测试CPU拓撲的讀取
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <doctest/doctest.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "hardware/topology.hpp"
+
+namespace {
+  void write_file(const std::filesystem::path &path, const std::string &content) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path) << content << '\n';
+  }
+
+  //! \brief 在臨時目錄下創建一個新的目錄，并行運行的測試互不干擾
+  std::filesystem::path make_unique_directory(const std::string &prefix) {
+    std::random_device rd;
+    while (true) {
+      auto dir = std::filesystem::temp_directory_path() /
+                 (prefix + std::to_string(rd()));
+      if (std::filesystem::create_directory(dir)) {
+        return dir;
+      }
+    }
+  }
+} // namespace
+
+TEST_CASE("parse_cpu_list") {
+  using cyy::naive_lib::hardware::parse_cpu_list;
+  using cpu_list = std::vector<size_t>;
+  CHECK(parse_cpu_list("0-3,8,10-11") == cpu_list{0, 1, 2, 3, 8, 10, 11});
+  CHECK(parse_cpu_list("5\n") == cpu_list{5});
+  CHECK(parse_cpu_list("").empty());
+  CHECK(parse_cpu_list("3-1").empty());
+}
+
+TEST_CASE("cpu_topology") {
+  SUBCASE("fake dual socket") {
+    // 兩個節點，每個節點兩個物理核，每個核兩個超綫程
+    auto root = make_unique_directory("fake_sysfs_topology_");
+    write_file(root / "cpu" / "online", "0-7");
+    write_file(root / "node" / "node0" / "cpulist", "0-1,4-5");
+    write_file(root / "node" / "node1" / "cpulist", "2-3,6-7");
+    for (size_t cpu = 0; cpu < 8; cpu++) {
+      auto dir = root / "cpu" / ("cpu" + std::to_string(cpu));
+      auto core = cpu % 4;
+      write_file(dir / "topology" / "core_id", std::to_string(core % 2));
+      write_file(dir / "topology" / "physical_package_id",
+                 std::to_string(core / 2));
+      write_file(dir / "topology" / "thread_siblings_list",
+                 std::to_string(core) + "," + std::to_string(core + 4));
+      write_file(dir / "cache" / "index0" / "level", "1");
+      write_file(dir / "cache" / "index0" / "type", "Data");
+      write_file(dir / "cache" / "index0" / "shared_cpu_list",
+                 std::to_string(core) + "," + std::to_string(core + 4));
+      write_file(dir / "cache" / "index3" / "level", "3");
+      write_file(dir / "cache" / "index3" / "type", "Unified");
+      write_file(dir / "cache" / "index3" / "shared_cpu_list",
+                 core < 2 ? "0-1,4-5" : "2-3,6-7");
+    }
+
+    auto topology = cyy::naive_lib::hardware::cpu_topology::read(root);
+    CHECK_EQ(topology.cpus().size(), 8);
+    using cpu_list = std::vector<size_t>;
+    CHECK(topology.nodes() == cpu_list{0, 1});
+    CHECK(topology.cpus_of_node(1) == cpu_list{2, 3, 6, 7});
+    CHECK(topology.one_cpu_per_core() == cpu_list{0, 1, 2, 3});
+    CHECK_EQ(topology.node_of_cpu(6), 1);
+    CHECK(topology.cpus()[5].thread_siblings == cpu_list{1, 5});
+    CHECK(topology.cpus()[5].cache_siblings == cpu_list{0, 1, 4, 5});
+    std::filesystem::remove_all(root);
+  }
+
+  SUBCASE("local machine") {
+    auto const &topology = cyy::naive_lib::hardware::cpu_topology::get();
+    CHECK(!topology.cpus().empty());
+    CHECK(!topology.one_cpu_per_core().empty());
+#if defined(__linux__)
+    // 測試綫程之後還要運行其它測試，綁定後恢復原來的親和性
+    cpu_set_t old_set;
+    CPU_ZERO(&old_set);
+    REQUIRE_EQ(pthread_getaffinity_np(pthread_self(), sizeof(old_set),
+                                      &old_set),
+               0);
+    auto cpu = topology.cpus().front().cpu_no;
+    CHECK(cyy::naive_lib::hardware::bind_current_thread(
+        std::vector<size_t>{cpu}));
+    CHECK_EQ(pthread_setaffinity_np(pthread_self(), sizeof(old_set),
+                                    &old_set),
+             0);
+#endif
+  }
+}
@@ -0,0 +1,249 @@
+/*!
+ * \file topology.cpp
+ *
+ * \brief CPU拓撲：NUMA節點、物理核、超綫程和緩存域
+ */
+
+#include "topology.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cyy::naive_lib::hardware {
+
+  namespace {
+    std::optional<std::string>
+    read_first_line(const std::filesystem::path &path) {
+      std::ifstream is(path);
+      std::string line;
+      if (!is || !std::getline(is, line)) {
+        return {};
+      }
+      return line;
+    }
+
+    std::optional<size_t> read_number(const std::filesystem::path &path) {
+      auto line = read_first_line(path);
+      if (!line) {
+        return {};
+      }
+      size_t value = 0;
+      auto [ptr, ec] =
+          std::from_chars(line->data(), line->data() + line->size(), value);
+      if (ec != std::errc()) {
+        return {};
+      }
+      return value;
+    }
+
+    std::vector<size_t> read_cpu_list(const std::filesystem::path &path) {
+      auto line = read_first_line(path);
+      if (!line) {
+        return {};
+      }
+      return parse_cpu_list(*line);
+    }
+
+    //! \brief 最後一級數據緩存（或統一緩存）的共享cpu列表
+    std::vector<size_t>
+    read_cache_siblings(const std::filesystem::path &cpu_dir) {
+      std::error_code ec;
+      size_t best_level = 0;
+      std::vector<size_t> siblings;
+      for (auto const &entry :
+           std::filesystem::directory_iterator(cpu_dir / "cache", ec)) {
+        auto name = entry.path().filename().string();
+        if (!name.starts_with("index")) {
+          continue;
+        }
+        auto type = read_first_line(entry.path() / "type");
+        if (type && *type == "Instruction") {
+          continue;
+        }
+        auto level = read_number(entry.path() / "level");
+        if (!level || *level < best_level) {
+          continue;
+        }
+        auto list = read_cpu_list(entry.path() / "shared_cpu_list");
+        if (list.empty()) {
+          continue;
+        }
+        best_level = *level;
+        siblings = std::move(list);
+      }
+      return siblings;
+    }
+  } // namespace
+
+  std::vector<size_t> parse_cpu_list(std::string_view list) {
+    std::vector<size_t> cpus;
+    while (!list.empty()) {
+      auto comma = list.find(',');
+      auto range = list.substr(0, comma);
+      list = comma == std::string_view::npos ? std::string_view()
+                                             : list.substr(comma + 1);
+      while (!range.empty() && (range.back() == '\n' || range.back() == ' ')) {
+        range.remove_suffix(1);
+      }
+      if (range.empty()) {
+        continue;
+      }
+      auto dash = range.find('-');
+      size_t first = 0;
+      auto first_str = range.substr(0, dash);
+      if (std::from_chars(first_str.data(), first_str.data() + first_str.size(),
+                          first)
+              .ec != std::errc()) {
+        return {};
+      }
+      auto last = first;
+      if (dash != std::string_view::npos) {
+        auto last_str = range.substr(dash + 1);
+        if (std::from_chars(last_str.data(), last_str.data() + last_str.size(),
+                            last)
+                    .ec != std::errc() ||
+            last < first) {
+          return {};
+        }
+      }
+      for (auto cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    }
+    std::ranges::sort(cpus);
+    auto [first, last] = std::ranges::unique(cpus);
+    cpus.erase(first, last);
+    return cpus;
+  }
+
+  cpu_topology cpu_topology::read(const std::filesystem::path &sysfs_root) {
+    cpu_topology topology;
+    auto cpu_root = sysfs_root / "cpu";
+    auto online = read_cpu_list(cpu_root / "online");
+    if (online.empty()) {
+      for (size_t i = 0; i < std::max(std::thread::hardware_concurrency(), 1U);
+           i++) {
+        online.push_back(i);
+      }
+    }
+
+    std::map<size_t, size_t> cpu_to_node;
+    std::error_code ec;
+    for (auto const &entry :
+         std::filesystem::directory_iterator(sysfs_root / "node", ec)) {
+      auto name = entry.path().filename().string();
+      size_t node_id = 0;
+      if (!name.starts_with("node") ||
+          std::from_chars(name.data() + 4, name.data() + name.size(), node_id)
+                  .ec != std::errc()) {
+        continue;
+      }
+      for (auto cpu : read_cpu_list(entry.path() / "cpulist")) {
+        cpu_to_node[cpu] = node_id;
+      }
+    }
+
+    for (auto cpu_no : online) {
+      auto cpu_dir = cpu_root / ("cpu" + std::to_string(cpu_no));
+      cpu_info info;
+      info.cpu_no = cpu_no;
+      info.core_id = read_number(cpu_dir / "topology" / "core_id").value_or(cpu_no);
+      info.package_id =
+          read_number(cpu_dir / "topology" / "physical_package_id").value_or(0);
+      if (auto it = cpu_to_node.find(cpu_no); it != cpu_to_node.end()) {
+        info.node_id = it->second;
+      }
+      info.thread_siblings =
+          read_cpu_list(cpu_dir / "topology" / "thread_siblings_list");
+      if (info.thread_siblings.empty()) {
+        info.thread_siblings = {cpu_no};
+      }
+      info.cache_siblings = read_cache_siblings(cpu_dir);
+      if (info.cache_siblings.empty()) {
+        info.cache_siblings = info.thread_siblings;
+      }
+      topology.cpu_list.emplace_back(std::move(info));
+    }
+    return topology;
+  }
+
+  const cpu_topology &cpu_topology::get() {
+    static const cpu_topology topology = read("/sys/devices/system");
+    return topology;
+  }
+
+  std::vector<size_t> cpu_topology::nodes() const {
+    std::set<size_t> node_set;
+    for (auto const &info : cpu_list) {
+      node_set.insert(info.node_id);
+    }
+    return {node_set.begin(), node_set.end()};
+  }
+
+  std::vector<size_t> cpu_topology::cpus_of_node(size_t node_id) const {
+    std::vector<size_t> cpus;
+    for (auto const &info : cpu_list) {
+      if (info.node_id == node_id) {
+        cpus.push_back(info.cpu_no);
+      }
+    }
+    return cpus;
+  }
+
+  std::vector<size_t> cpu_topology::one_cpu_per_core() const {
+    std::vector<size_t> cpus;
+    for (auto node_id : nodes()) {
+      std::set<std::pair<size_t, size_t>> seen_cores;
+      for (auto const &info : cpu_list) {
+        if (info.node_id != node_id) {
+          continue;
+        }
+        if (seen_cores.emplace(info.package_id, info.core_id).second) {
+          cpus.push_back(info.cpu_no);
+        }
+      }
+    }
+    return cpus;
+  }
+
+  size_t cpu_topology::node_of_cpu(size_t cpu_no) const {
+    auto it = std::ranges::find(cpu_list, cpu_no, &cpu_info::cpu_no);
+    if (it == cpu_list.end()) {
+      return 0;
+    }
+    return it->node_id;
+  }
+
+  bool bind_current_thread(std::span<const size_t> cpus) {
+#if defined(__linux__)
+    if (cpus.empty()) {
+      return false;
+    }
+    cpu_set_t cpuset{};
+    CPU_ZERO(&cpuset);
+    for (auto cpu : cpus) {
+      if (cpu >= CPU_SETSIZE) {
+        return false;
+      }
+      CPU_SET(cpu, &cpuset);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                  &cpuset) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+  }
+} // namespace cyy::naive_lib::hardware
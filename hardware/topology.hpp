@@ -0,0 +1,64 @@
+/*!
+ * \file topology.hpp
+ *
+ * \brief CPU拓撲：NUMA節點、物理核、超綫程和緩存域
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace cyy::naive_lib::hardware {
+
+  //! \brief 單個邏輯cpu的拓撲信息
+  struct cpu_info {
+    size_t cpu_no{0};
+    size_t core_id{0};
+    size_t package_id{0};
+    size_t node_id{0};
+    //! \brief 同一物理核上的邏輯cpu，包括自己
+    std::vector<size_t> thread_siblings;
+    //! \brief 共享最後一級緩存的邏輯cpu，包括自己
+    std::vector<size_t> cache_siblings;
+  };
+
+  //! \brief 從sysfs讀取的CPU拓撲
+  class cpu_topology {
+  public:
+    //! \brief 讀取拓撲，讀不到的信息退化為每個cpu一個核、所有cpu在節點0
+    //! \param sysfs_root 一般為/sys/devices/system，測試時可以指向僞造的目錄
+    static cpu_topology read(const std::filesystem::path &sysfs_root);
+
+    //! \brief 本機的拓撲，第一次調用時讀取
+    static const cpu_topology &get();
+
+    //! \brief 在綫的邏輯cpu，按編號排序
+    const std::vector<cpu_info> &cpus() const noexcept { return cpu_list; }
+
+    //! \brief 有cpu的NUMA節點編號，按編號排序
+    std::vector<size_t> nodes() const;
+
+    std::vector<size_t> cpus_of_node(size_t node_id) const;
+
+    //! \brief 每個物理核取編號最小的一個邏輯cpu，按節點排列，同一節點的核相鄰
+    std::vector<size_t> one_cpu_per_core() const;
+
+    //! \brief cpu所在的NUMA節點，未知的cpu返回0
+    size_t node_of_cpu(size_t cpu_no) const;
+
+  private:
+    std::vector<cpu_info> cpu_list;
+  };
+
+  //! \brief 解析sysfs的cpu列表格式，例如"0-3,8,10-11"
+  std::vector<size_t> parse_cpu_list(std::string_view list);
+
+  //! \brief 把當前綫程綁定到指定的cpu集合
+  //! \return 失敗或平台不支持時返回false
+  bool bind_current_thread(std::span<const size_t> cpus);
+
+} // namespace cyy::naive_lib::hardware
@@ -8,6 +8,10 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
 #include "cv/mat.hpp"
 namespace py = pybind11;
 
@@ -61,16 +65,41 @@ inline void define_cv_extension(py::module_ &m) {
         return cv::Mat(shape, CV_8UC3, info.ptr, steps.data());
       }))
       .def_buffer([](cv::Mat &mat) -> py::buffer_info {
+        // native模式的平面可能是16位等深度，按實際深度導出
+        std::string format;
+        switch (mat.depth()) {
+          case CV_8U:
+            format = py::format_descriptor<uint8_t>::format();
+            break;
+          case CV_8S:
+            format = py::format_descriptor<int8_t>::format();
+            break;
+          case CV_16U:
+            format = py::format_descriptor<uint16_t>::format();
+            break;
+          case CV_16S:
+            format = py::format_descriptor<int16_t>::format();
+            break;
+          case CV_32S:
+            format = py::format_descriptor<int32_t>::format();
+            break;
+          case CV_32F:
+            format = py::format_descriptor<float>::format();
+            break;
+          case CV_64F:
+            format = py::format_descriptor<double>::format();
+            break;
+          default:
+            throw std::runtime_error("unsupported matrix depth");
+        }
         return py::buffer_info(
-            mat.data,              /* Pointer to buffer */
-            sizeof(unsigned char), /* Size of one scalar */
-            py::format_descriptor<unsigned char>::format(), /* Python
-                                                         struct-style format
-                                                         descriptor */
-            3,                                    /* Number of dimensions */
+            mat.data,         /* Pointer to buffer */
+            mat.elemSize1(),  /* Size of one scalar */
+            format,           /* Python struct-style format descriptor */
+            3,                /* Number of dimensions */
             {mat.rows, mat.cols, mat.channels()}, /* Buffer dimensions */
             {mat.step[0], /* Strides (in bytes) for each index */
-             mat.step[1], sizeof(unsigned char)});
+             mat.step[1], mat.elemSize1()});
       });
   using mat = cyy::naive_lib::opencv::mat;
   py::class_<mat>(sub_m, "Mat")
@@ -19,13 +19,30 @@ inline void define_video_extension(py::module_ &m) {
   py::class_<frame>(sub_m, "Frame")
       .def_readwrite("seq", &frame::seq)
       .def_readwrite("content", &frame::content)
-      .def_readwrite("is_key", &frame::is_key);
+      .def_readwrite("is_key", &frame::is_key)
+      .def_readonly("planes", &frame::planes)
+      .def_readonly("pixel_format", &frame::pixel_format);
 
   using ffmpeg_video_reader = cyy::naive_lib::video::ffmpeg_reader;
 
-  py::class_<ffmpeg_video_reader>(sub_m, "FFmpegVideoReader",
-                                  py::buffer_protocol())
-      .def(py::init<>())
+  py::class_<ffmpeg_video_reader> reader_class(sub_m, "FFmpegVideoReader",
+                                              py::buffer_protocol());
+  py::enum_<ffmpeg_video_reader::output_mode>(reader_class, "OutputMode")
+      .value("BGR", ffmpeg_video_reader::output_mode::bgr)
+      .value("Native", ffmpeg_video_reader::output_mode::native)
+      .value("Luma", ffmpeg_video_reader::output_mode::luma);
+  py::enum_<ffmpeg_video_reader::decode_thread_type>(reader_class,
+                                                    "DecodeThreadType")
+      .value("Automatic", ffmpeg_video_reader::decode_thread_type::automatic)
+      .value("Frame", ffmpeg_video_reader::decode_thread_type::frame)
+      .value("Slice", ffmpeg_video_reader::decode_thread_type::slice);
+  py::enum_<ffmpeg_video_reader::interpolation>(reader_class, "Interpolation")
+      .value("Nearest", ffmpeg_video_reader::interpolation::nearest)
+      .value("Bilinear", ffmpeg_video_reader::interpolation::bilinear)
+      .value("Bicubic", ffmpeg_video_reader::interpolation::bicubic)
+      .value("Area", ffmpeg_video_reader::interpolation::area)
+      .value("Lanczos", ffmpeg_video_reader::interpolation::lanczos);
+  reader_class.def(py::init<>())
       .def("open", &ffmpeg_video_reader::open)
       .def("close", &ffmpeg_video_reader::close)
       .def("set_play_frame_rate", &ffmpeg_video_reader::set_play_frame_rate)
@@ -33,6 +50,35 @@ inline void define_video_extension(py::module_ &m) {
       .def("get_video_width", &ffmpeg_video_reader::get_video_width)
       .def("get_frame_rate", &ffmpeg_video_reader::get_frame_rate)
       .def("next_frame", &ffmpeg_video_reader::next_frame)
+      .def("set_output_mode", &ffmpeg_video_reader::set_output_mode)
+      .def("set_frame_pool_depth", &ffmpeg_video_reader::set_frame_pool_depth)
+      .def("set_convert_threads", &ffmpeg_video_reader::set_convert_threads)
+      .def("set_output_size",
+           [](ffmpeg_video_reader &reader,
+              std::optional<std::pair<int, int>> size) {
+             if (!size) {
+               reader.set_output_size({});
+               return;
+             }
+             reader.set_output_size(cv::Size(size->first, size->second));
+           })
+      .def("set_crop_rect",
+           [](ffmpeg_video_reader &reader,
+              std::optional<std::array<int, 4>> rect) {
+             if (!rect) {
+               reader.set_crop_rect({});
+               return;
+             }
+             reader.set_crop_rect(
+                 cv::Rect((*rect)[0], (*rect)[1], (*rect)[2], (*rect)[3]));
+           })
+      .def("set_interpolation", &ffmpeg_video_reader::set_interpolation)
+      .def("set_decode_threads", &ffmpeg_video_reader::set_decode_threads,
+           py::arg("thread_count"),
+           py::arg("thread_type") =
+               ffmpeg_video_reader::decode_thread_type::automatic)
+      .def_static("set_decode_thread_budget",
+                  &ffmpeg_video_reader::set_decode_thread_budget)
       .def("drop_non_key_frames", &ffmpeg_video_reader::drop_non_key_frames)
       .def("add_named_filter", &ffmpeg_video_reader::add_named_filter)
       .def("remove_named_filter", &ffmpeg_video_reader::remove_named_filter)
@@ -46,5 +92,6 @@ inline void define_video_extension(py::module_ &m) {
       .def("open", &ffmpeg_video_writer::open)
       .def("close", &ffmpeg_video_writer::close)
       .def("get_url", &ffmpeg_video_writer::get_url)
+      .def("set_convert_threads", &ffmpeg_video_writer::set_convert_threads)
       .def("write_frame", &ffmpeg_video_writer::write_frame);
 }
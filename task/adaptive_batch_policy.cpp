@@ -0,0 +1,132 @@
+/*!
+ * \file adaptive_batch_policy.cpp
+ *
+ * \brief 動態批處理策略
+ */
+
+#include "adaptive_batch_policy.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace cyy::naive_lib::task {
+
+  namespace {
+    constexpr double decay = 0.9;
+    constexpr double rate_alpha = 0.2;
+  } // namespace
+
+  adaptive_batch_policy::adaptive_batch_policy(const config &config_)
+      : conf(config_) {
+    if (conf.max_batch_size == 0) {
+      throw std::invalid_argument("max_batch_size must be positive");
+    }
+    if (conf.latency_target.count() <= 0) {
+      throw std::invalid_argument("latency_target must be positive");
+    }
+  }
+
+  void adaptive_batch_policy::observe(size_t batch_size,
+                                      std::chrono::nanoseconds fill_time,
+                                      std::chrono::nanoseconds process_time) {
+    if (batch_size == 0) {
+      return;
+    }
+    auto process_s = std::chrono::duration<double>(process_time).count();
+
+    auto x = static_cast<double>(batch_size);
+    sum_w = sum_w * decay + 1;
+    sum_x = sum_x * decay + x;
+    sum_y = sum_y * decay + process_s;
+    sum_xx = sum_xx * decay + x * x;
+    sum_xy = sum_xy * decay + x * process_s;
+
+    latencies[latency_cnt % latency_window] =
+        std::chrono::duration_cast<std::chrono::microseconds>(fill_time +
+                                                              process_time);
+    latency_cnt++;
+
+    auto target = std::chrono::microseconds(conf.latency_target);
+    auto p99 = p99_latency();
+    if (p99 > target) {
+      budget_scale = std::max(budget_scale * 0.8, 0.1);
+    } else if (p99 * 5 < target * 4) {
+      budget_scale = std::min(budget_scale * 1.05, 1.0);
+    }
+    update();
+  }
+
+  void adaptive_batch_policy::observe_arrival(
+      std::chrono::steady_clock::time_point enqueue_time) {
+    if (enqueue_time == std::chrono::steady_clock::time_point{}) {
+      // 任務沒有經過调度器的提交接口
+      return;
+    }
+    if (last_arrival != std::chrono::steady_clock::time_point{}) {
+      // 按優先級出隊時到達時間不單調，只統計比之前晚到的任務
+      if (enqueue_time < last_arrival) {
+        return;
+      }
+      auto interval =
+          std::chrono::duration<double>(enqueue_time - last_arrival).count();
+      mean_interval = mean_interval < 0
+                          ? interval
+                          : mean_interval * (1 - rate_alpha) +
+                                interval * rate_alpha;
+      // 同時提交的任務間隔為0，用一個很小的間隔代替
+      arrival_rate = 1 / std::max(mean_interval, 1e-9);
+    }
+    last_arrival = enqueue_time;
+  }
+
+  std::chrono::microseconds adaptive_batch_policy::p99_latency() const {
+    auto cnt = std::min(latency_cnt, latency_window);
+    if (cnt == 0) {
+      return {};
+    }
+    // 每批都會調用，在預先分配的緩衝區裡選取，不分配內存也不全排序
+    auto samples_end = std::copy_n(latencies.begin(), cnt, scratch.begin());
+    auto idx = std::min(cnt - 1, cnt * 99 / 100);
+    std::nth_element(scratch.begin(),
+                     scratch.begin() + static_cast<ptrdiff_t>(idx),
+                     samples_end);
+    return scratch[idx];
+  }
+
+  void adaptive_batch_policy::update() {
+    // 擬合處理耗時 a + b * batch_size
+    double a = 0;
+    double b = 0;
+    auto det = sum_w * sum_xx - sum_x * sum_x;
+    if (std::abs(det) > 1e-9 * sum_w * sum_xx) {
+      b = (sum_w * sum_xy - sum_x * sum_y) / det;
+      a = (sum_y - b * sum_x) / sum_w;
+    }
+    if (b <= 0 || a < 0) {
+      // 批大小沒有變化過，只能把耗時平均到每個任務上
+      a = 0;
+      b = sum_y / std::max(sum_x, 1.0);
+    }
+
+    auto budget =
+        std::chrono::duration<double>(conf.latency_target).count() *
+        budget_scale;
+    if (arrival_rate <= 0) {
+      next_batch_size = 1;
+      next_fill_timeout = {};
+      return;
+    }
+    // 湊滿s個任務要等(s-1)/rate，處理要a+b*s，兩者之和不超過預算
+    auto interval = 1 / arrival_rate;
+    auto max_size = (budget - a + interval) / (interval + b);
+    next_batch_size = static_cast<size_t>(std::clamp(
+        std::floor(max_size), 1.0, static_cast<double>(conf.max_batch_size)));
+
+    auto wait_s = std::min(static_cast<double>(next_batch_size - 1) * interval,
+                           budget - a - b * static_cast<double>(next_batch_size));
+    next_fill_timeout =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::duration<double>(std::max(wait_s, 0.0)));
+  }
+} // namespace cyy::naive_lib::task
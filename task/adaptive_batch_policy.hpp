@@ -0,0 +1,77 @@
+/*!
+ * \file adaptive_batch_policy.hpp
+ *
+ * \brief 動態批處理策略
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 根據任務到達速率和process_tasks的耗時決定批大小與湊批的等待時間
+  //! \note 只在processor綫程中使用，不是綫程安全的
+  class adaptive_batch_policy {
+  public:
+    struct config {
+      //! \brief 批大小上限
+      size_t max_batch_size{64};
+      //! \brief 任務從湊批到處理完成的p99延遲目標
+      std::chrono::milliseconds latency_target{100};
+    };
+
+    explicit adaptive_batch_policy(const config &config_);
+
+    //! \brief 下一批的大小
+    size_t batch_size() const noexcept { return next_batch_size; }
+
+    //! \brief 拿到第一個任務後，最多再等待多久來湊滿一批
+    std::chrono::microseconds fill_timeout() const noexcept {
+      return next_fill_timeout;
+    }
+
+    //! \brief 記錄一個任務放入调度器的時間，用相鄰任務的到達間隔估計到達速率
+    //! \note 與批大小無關，批大小為1時也能發現任務到達得比處理得快
+    void observe_arrival(std::chrono::steady_clock::time_point enqueue_time);
+
+    //! \brief 記錄一批任務的處理情況並更新策略
+    //! \param batch_size 實際的批大小
+    //! \param fill_time 從拿到第一個任務到湊批結束的時間
+    //! \param process_time process_tasks的耗時
+    void observe(size_t batch_size, std::chrono::nanoseconds fill_time,
+                 std::chrono::nanoseconds process_time);
+
+    //! \brief 最近若干批的p99延遲
+    std::chrono::microseconds p99_latency() const;
+
+  private:
+    void update();
+
+    config conf;
+    size_t next_batch_size{1};
+    std::chrono::microseconds next_fill_timeout{0};
+
+    //! \brief 任務到達速率，每秒任務數
+    double arrival_rate{0};
+    //! \brief 到達間隔的指數移動平均，單位秒，為負時還沒有樣本
+    double mean_interval{-1};
+    std::chrono::steady_clock::time_point last_arrival;
+    //! \brief 用指數衰減的最小二乘擬合 process_time = a + b * batch_size
+    double sum_w{0};
+    double sum_x{0};
+    double sum_y{0};
+    double sum_xx{0};
+    double sum_xy{0};
+    //! \brief 實測p99超過目標時收緊延遲預算
+    double budget_scale{1};
+
+    static constexpr size_t latency_window = 256;
+    std::array<std::chrono::microseconds, latency_window> latencies{};
+    size_t latency_cnt{0};
+    //! \brief p99_latency選取分位數用的緩衝區
+    mutable std::array<std::chrono::microseconds, latency_window> scratch{};
+  };
+} // namespace cyy::naive_lib::task
@@ -9,23 +9,26 @@
 #include "base_processor.hpp"
 
 #include "base_task.hpp"
-#include "hardware/hardware.hpp"
+#include "hardware/topology.hpp"
 #include "log/log.hpp"
 
 namespace cyy::naive_lib::task {
 
   //! \brief
   //! 绑定在特定的cpu上，如果这个行为不适合特定的算法，子类可以不调用该函数
+  //! \note 綁定發生在處理任務之前，綫程之後首次觸碰的內存按first-touch落在本地節點
   void base_processor::init_thread_context() {
-    /*
-    cyy::naive_lib::hardware::alloc_cpu(
-        this_thd,
-    cyy::naive_lib::hardware::round_robin_allocator::next_cpu_no());
-    */
+    if (cpu_affinity.empty()) {
+      return;
+    }
+    if (!cyy::naive_lib::hardware::bind_current_thread(cpu_affinity)) {
+      LOG_WARN("failed to bind processor thread to {} cpus",
+               cpu_affinity.size());
+    }
   }
 
-  void base_processor::run() {
-    if (!get_task_func) {
+  void base_processor::run(const std::stop_token & /*st*/) {
+    if (!get_task_func && !get_tasks_func) {
       throw std::runtime_error("get_task_func is empty");
     }
 
@@ -33,32 +36,85 @@ namespace cyy::naive_lib::task {
       std::lock_guard lock(thd_mutex);
       init_thread_context();
     }
+    warm_up();
+    ready.store(1, std::memory_order_release);
+    cyy::naive_lib::atomic_notify_all(ready);
 
+    // 批次容器在循環間重用，避免每輪重新分配
+    std::vector<std::shared_ptr<base_task>> tasks;
+    // 子類可能修改tasks，另存一份用於處理後通知完成
+    std::vector<std::shared_ptr<base_task>> processing_tasks;
     while (!needs_stop()) {
-      std::vector<std::shared_ptr<base_task>> tasks;
+      tasks.clear();
 
-      auto end_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(
-          std::chrono::steady_clock::now() + task_batch_timeout);
+      auto batch_size = task_batch_size;
+      std::chrono::steady_clock::time_point fill_begin;
+      auto deadline = std::chrono::steady_clock::now() + task_batch_timeout;
 
-      while (tasks.size() < task_batch_size) {
-        auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(
-            std::chrono::steady_clock::now());
-        if (now_ms >= end_ms) {
+      while (tasks.size() < batch_size) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
           break;
         }
 
-        auto task_opt = get_task_func(end_ms - now_ms);
-        if (task_opt) {
-          tasks.push_back(*task_opt);
+        auto old_size = tasks.size();
+        if (get_tasks_func) {
+          get_tasks_func(tasks, batch_size - tasks.size(), deadline);
+        } else {
+          auto task_opt = get_task_func(
+              std::chrono::ceil<std::chrono::milliseconds>(deadline - now));
+          if (task_opt) {
+            tasks.push_back(*task_opt);
+          }
+        }
+        // 拿到第一個任務後才開始計算湊批的等待時間
+        if (batch_policy && old_size == 0 && !tasks.empty()) {
+          batch_size = batch_policy->batch_size();
+          fill_begin = std::chrono::steady_clock::now();
+          deadline = fill_begin + batch_policy->fill_timeout();
         }
       }
 
-      auto num =
-          std::erase_if(tasks, [](auto const &p) { return !p->can_process(); });
+      auto now = std::chrono::steady_clock::now();
+      auto num = std::erase_if(tasks, [&now](auto const &p) {
+        if (p->is_expired(now)) {
+          p->mark_invalid();
+        }
+        return !p->can_process();
+      });
       if (num != 0) {
         LOG_WARN("skip {} expired tasks", num);
       }
+      if (tasks.empty()) {
+        process_tasks(tasks);
+        continue;
+      }
+      if (batch_policy) {
+        for (auto const &task : tasks) {
+          batch_policy->observe_arrival(task->get_enqueue_time());
+        }
+      }
+      auto process_begin = std::chrono::steady_clock::now();
+      auto processed_size = tasks.size();
+      processing_tasks.assign(tasks.begin(), tasks.end());
+      processing.store(true, std::memory_order_relaxed);
       process_tasks(tasks);
+      auto process_end = std::chrono::steady_clock::now();
+      auto process_time = process_end - process_begin;
+      last_active_time.store(process_end, std::memory_order_relaxed);
+      processing.store(false, std::memory_order_relaxed);
+      for (auto const &task : processing_tasks) {
+        task->notify_done();
+      }
+      processing_tasks.clear();
+      metrics.batches.add();
+      metrics.processed_tasks.add(processed_size);
+      metrics.batch_size.record(static_cast<uint64_t>(processed_size));
+      metrics.process_latency.record(process_time);
+      if (batch_policy) {
+        batch_policy->observe(processed_size, process_begin - fill_begin,
+                              process_time);
+      }
     }
 
     {
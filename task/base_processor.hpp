@@ -8,14 +8,19 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <functional>
 #include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "adaptive_batch_policy.hpp"
 #include "base_task.hpp"
+#include "metrics.hpp"
+#include "util/atomic_wait.hpp"
 #include "util/runnable.hpp"
 
 namespace cyy::naive_lib::task {
@@ -32,6 +37,18 @@ namespace cyy::naive_lib::task {
 
     virtual bool can_use_gpu() const { return false; }
 
+    //! \brief 是否只處理部分任務
+    //! \note 是的話调度器拒絕沒有processor接受的任務，並在滾動替換期間按accepts為它選取任務
+    virtual bool is_selective() const { return false; }
+    //! \brief 是否處理該任務
+    virtual bool accepts(const base_task & /*task*/) const { return true; }
+
+    //! \brief 等待處理器完成預熱，可以開始處理任務
+    //! \return 超时返回false
+    bool wait_ready(const std::chrono::milliseconds &timeout) const {
+      return cyy::naive_lib::atomic_wait_for(ready, 0, timeout);
+    }
+
     void set_gpu_no(int gpu_no_) {
       if (gpu_no != -1) {
         throw std::runtime_error(std::string("processor has gpu no ") +
@@ -51,12 +68,47 @@ namespace cyy::naive_lib::task {
       task_batch_timeout = task_batch_timeout_;
     }
 
+    //! \brief 根據任務到達速率和處理耗時動態決定批大小與等待時間
+    //! \note 啓用後task_batch_size不再生效，task_batch_timeout只用於等待第一個任務
+    void set_adaptive_batching(const adaptive_batch_policy::config &config) {
+      batch_policy.emplace(config);
+    }
+
+    const processor_metrics &get_metrics() const noexcept { return metrics; }
+
+    //! \brief 最近一次處理完非空批次的時間，未處理過任務時為構造時間
+    std::chrono::steady_clock::time_point get_last_active_time() const noexcept {
+      return last_active_time.load(std::memory_order_relaxed);
+    }
+
+    //! \brief 是否正在處理一個批次
+    bool is_processing() const noexcept {
+      return processing.load(std::memory_order_relaxed);
+    }
+
+    //! \brief 綁定處理器綫程的cpu，需在start之前設置，空表示不綁定
+    void set_cpu_affinity(std::vector<size_t> cpus) {
+      cpu_affinity = std::move(cpus);
+    }
+    const std::vector<size_t> &get_cpu_affinity() const noexcept {
+      return cpu_affinity;
+    }
+
     void set_get_task_func(
         const std::function<std::optional<std::shared_ptr<base_task>>(
             const std::chrono::milliseconds &)> &get_task_func_) {
       get_task_func = get_task_func_;
     }
 
+    //! \brief 批量取任務：一次最多取n個追加到tasks末尾，沒有任務時最多等到deadline
+    //! \note 設置後優先於get_task_func使用
+    using get_tasks_func_type = std::function<size_t(
+        std::vector<std::shared_ptr<base_task>> &, size_t,
+        const std::chrono::steady_clock::time_point &)>;
+    void set_get_tasks_func(const get_tasks_func_type &get_tasks_func_) {
+      get_tasks_func = get_tasks_func_;
+    }
+
   protected:
     //! \brief
     //! 初始化任务处理逻辑所需的线程环境，有些第三方库需要在这边执行对应的初始化
@@ -64,12 +116,15 @@ namespace cyy::naive_lib::task {
     //! \brief
     //! 清理任务处理逻辑所需的线程环境，有些第三方库需要在这边执行对应的清理
     virtual void deinit_thread_context() {}
+    //! \brief 在處理器綫程上、開始取任務之前調用，例如加載模型並跑一次推理
+    virtual void warm_up() {}
 
   private:
     //! \brief 处理器线程主循环
-    void run() override;
+    void run(const std::stop_token &st) override;
 
     //! \brief 让子类实现具体的任务处理逻辑
+    //! \note 返回後會通知任務完成並喚醒co_await的協程，結果應在返回前設置
     virtual void
     process_tasks(std::vector<std::shared_ptr<base_task>> &tasks) = 0;
 
@@ -77,8 +132,16 @@ namespace cyy::naive_lib::task {
     std::function<std::optional<std::shared_ptr<base_task>>(
         const std::chrono::milliseconds &)>
         get_task_func;
+    get_tasks_func_type get_tasks_func;
     size_t task_batch_size{1};
     std::chrono::milliseconds task_batch_timeout{1000};
+    std::optional<adaptive_batch_policy> batch_policy;
+    processor_metrics metrics;
+    std::vector<size_t> cpu_affinity;
+    std::atomic<std::chrono::steady_clock::time_point> last_active_time{
+        std::chrono::steady_clock::now()};
+    std::atomic<bool> processing{false};
+    std::atomic<uint32_t> ready{0};
 
   protected:
     int gpu_no{-1};
@@ -9,8 +9,11 @@
 
 #include <chrono>
 #include <memory>
+#include <optional>
+#include <span>
 
 #include "base_task.hpp"
+#include "task_handle.hpp"
 
 namespace cyy::naive_lib::task {
 
@@ -30,8 +33,70 @@ namespace cyy::naive_lib::task {
     //! \brief 調度任务
     //! \param task 任務
     //! \param timeout 任務處理超时时间
+    //! \note 任務沒有截止時間時，以timeout作為截止時間，超時後不再處理；
+    //! 等待超時的任務會被取消，正在處理它的處理器可以提前放棄
     virtual bool schedule(const std::shared_ptr<base_task> &task,
-                          const std::chrono::milliseconds &timeout) = 0;
+                          const std::chrono::milliseconds &timeout) {
+      auto now = std::chrono::steady_clock::now();
+      if (!task->get_deadline()) {
+        task->set_deadline(now + timeout);
+      }
+      task->set_enqueue_time(now);
+      enqueue(task);
+      if (task->wait_done(timeout)) {
+        return true;
+      }
+      task->cancel();
+      return false;
+    }
+
+    //! \brief 提交任务後立即返回，不等待處理
+    //! \return 任務句柄
+    template <typename TaskType>
+    task_handle<TaskType> submit(const std::shared_ptr<TaskType> &task) {
+      task->set_enqueue_time(std::chrono::steady_clock::now());
+      enqueue(task);
+      return task_handle<TaskType>(task);
+    }
+
+    //! \brief 嘗試提交任务，调度器無法立即接收時返回空
+    template <typename TaskType>
+    std::optional<task_handle<TaskType>>
+    try_submit(const std::shared_ptr<TaskType> &task) {
+      task->set_enqueue_time(std::chrono::steady_clock::now());
+      if (!try_enqueue(task)) {
+        return {};
+      }
+      return task_handle<TaskType>(task);
+    }
+
+    //! \brief 批量提交任务
+    void submit_batch(std::span<const std::shared_ptr<base_task>> tasks) {
+      auto now = std::chrono::steady_clock::now();
+      for (auto const &task : tasks) {
+        task->set_enqueue_time(now);
+      }
+      enqueue_batch(tasks);
+    }
+
+  protected:
+    //! \brief 把任務放入调度器，不等待處理
+    virtual void enqueue(const std::shared_ptr<base_task> &task) = 0;
+
+    //! \brief 不阻塞地放入任務
+    //! \return 调度器無法接收時返回false
+    virtual bool try_enqueue(const std::shared_ptr<base_task> &task) {
+      enqueue(task);
+      return true;
+    }
+
+    //! \brief 批量放入任務，子類可以只加一次鎖
+    virtual void
+    enqueue_batch(std::span<const std::shared_ptr<base_task>> tasks) {
+      for (auto const &task : tasks) {
+        enqueue(task);
+      }
+    }
 
   }; // class base_scheduler
 } // namespace cyy::naive_lib::task
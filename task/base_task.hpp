@@ -14,12 +14,19 @@
 #include <future>
 #include <mutex>
 #include <optional>
+#include <stop_token>
 
 namespace cyy::naive_lib::task {
 
   //! \brief 綫程任务
   class base_task {
   public:
+    //! \brief 完成回調的鏈表節點，由註冊者持有，回調執行前必須保持有效
+    struct done_callback {
+      done_callback *next{nullptr};
+      void (*func)(done_callback &) noexcept {nullptr};
+    };
+
     base_task() = default;
 
     virtual ~base_task() = default;
@@ -27,17 +34,11 @@ namespace cyy::naive_lib::task {
     //! \brief 处理任务
     //! \param timeout 该线程等待超时时间
     bool wait_done(const std::chrono::milliseconds &timeout) {
-      // 快速路徑：已經結束的任务無需加鎖
+      // 快速路徑：已經結束的任务無需等待
       if (auto s = status.load(std::memory_order_acquire);
           s != task_status::unprocessed) {
         return s == task_status::processed;
       }
-      // std::future 不支持并发访问，用互斥量串行化等待者
-      std::lock_guard lk(sync_mu);
-      if (auto s = status.load(std::memory_order_relaxed);
-          s != task_status::unprocessed) {
-        return s == task_status::processed;
-      }
       if (!_wait_done(timeout)) {
         return false;
       }
@@ -51,9 +52,32 @@ namespace cyy::naive_lib::task {
     //! \brief 標記任务作廢，無鎖；已處理的任务不會被改寫
     void mark_invalid() noexcept {
       auto expected = task_status::unprocessed;
-      status.compare_exchange_strong(expected, task_status::invalid,
-                                     std::memory_order_acq_rel);
+      if (status.compare_exchange_strong(expected, task_status::invalid,
+                                         std::memory_order_acq_rel)) {
+        notify_done();
+      }
+    }
+    //! \brief 取消任務：通知正在處理的處理器停止，並標記作廢
+    //! \note 處理器通過get_stop_token或is_cancelled輪詢，是否提前結束由處理器決定
+    void cancel() {
+      cancelled.store(true, std::memory_order_release);
+      std::call_once(stop_source_once, [this] { stop_source = {}; });
+      stop_source.request_stop();
+      mark_invalid();
     }
+    [[nodiscard]] bool is_cancelled() const noexcept {
+      return cancelled.load(std::memory_order_acquire);
+    }
+    //! \brief 處理器輪詢的停止令牌
+    //! \note 第一次調用時才創建共享狀態，不取令牌的任務沒有額外分配
+    [[nodiscard]] std::stop_token get_stop_token() {
+      std::call_once(stop_source_once, [this] { stop_source = {}; });
+      if (is_cancelled()) {
+        stop_source.request_stop();
+      }
+      return stop_source.get_token();
+    }
+
     [[nodiscard]] bool is_invalid() const noexcept {
       return status.load(std::memory_order_acquire) == task_status::invalid;
     }
@@ -62,15 +86,86 @@ namespace cyy::naive_lib::task {
              task_status::unprocessed;
     }
 
+    //! \brief 設置優先級，數值越大越優先
+    //! \note 應在提交任務前設置
+    void set_priority(int priority_) noexcept { priority = priority_; }
+    [[nodiscard]] int get_priority() const noexcept { return priority; }
+
+    //! \brief 設置絕對截止時間，過期的任務不再處理
+    //! \note 應在提交任務前設置
+    void set_deadline(
+        const std::chrono::steady_clock::time_point &deadline_) noexcept {
+      deadline = deadline_;
+    }
+    [[nodiscard]] const std::optional<std::chrono::steady_clock::time_point> &
+    get_deadline() const noexcept {
+      return deadline;
+    }
+    //! \brief 任務放入调度器的時間，由调度器在提交時設置
+    void set_enqueue_time(
+        const std::chrono::steady_clock::time_point &time) noexcept {
+      enqueue_time = time;
+    }
+    [[nodiscard]] const std::chrono::steady_clock::time_point &
+    get_enqueue_time() const noexcept {
+      return enqueue_time;
+    }
+    [[nodiscard]] bool is_expired(
+        const std::chrono::steady_clock::time_point &now) const noexcept {
+      return deadline.has_value() && *deadline <= now;
+    }
+
+    //! \brief 註冊完成回調，無鎖
+    //! \return 已經通知過完成時返回false，此時回調不會被調用
+    bool add_done_callback(done_callback &callback) noexcept {
+      auto *head = callbacks.load(std::memory_order_acquire);
+      do {
+        if (head == fired_sentinel()) {
+          return false;
+        }
+        callback.next = head;
+      } while (!callbacks.compare_exchange_weak(head, &callback,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire));
+      return true;
+    }
+
+    //! \brief 執行所有完成回調，之後註冊的回調不再接受；重複調用沒有效果
+    //! \note 處理器處理完一批任務後以及任務作廢時調用
+    void notify_done() noexcept {
+      auto *head =
+          callbacks.exchange(fired_sentinel(), std::memory_order_acq_rel);
+      if (head == fired_sentinel()) {
+        return;
+      }
+      while (head != nullptr) {
+        // 回調可能銷毀節點，先取出下一個
+        auto *next = head->next;
+        head->func(*head);
+        head = next;
+      }
+    }
+
   protected:
+    //! \brief 等待任務完成，可能被多個綫程并发調用
     virtual bool _wait_done(const std::chrono::milliseconds &timeout) = 0;
 
   private:
+    static done_callback *fired_sentinel() noexcept {
+      static done_callback sentinel;
+      return &sentinel;
+    }
+
     //! \brief 任务状态
     enum class task_status : uint8_t { unprocessed, invalid, processed };
     std::atomic<task_status> status{task_status::unprocessed};
-    //! \brief 僅用於串行化 _wait_done 對 std::future 的訪問
-    std::mutex sync_mu;
+    int priority{0};
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    std::chrono::steady_clock::time_point enqueue_time;
+    std::atomic<done_callback *> callbacks{nullptr};
+    std::atomic<bool> cancelled{false};
+    std::once_flag stop_source_once;
+    std::stop_source stop_source{std::nostopstate};
   };
 
   template <typename ResultType = void> class task : public base_task {
@@ -80,6 +175,12 @@ namespace cyy::naive_lib::task {
 
   protected:
     bool _wait_done(const std::chrono::milliseconds &timeout) override {
+      std::lock_guard lk(sync_mu);
+      return wait_future(timeout);
+    }
+
+    //! \note 調用者需持有sync_mu
+    bool wait_future(const std::chrono::milliseconds &timeout) {
       if (!future_opt) {
         future_opt = result_promise.get_future();
       }
@@ -94,6 +195,8 @@ namespace cyy::naive_lib::task {
 
   protected:
     std::optional<std::future<ResultType>> future_opt;
+    //! \brief std::future 不支持并发访问，用互斥量串行化等待者
+    std::mutex sync_mu;
   };
 
   template <typename ResultType>
@@ -111,10 +214,11 @@ namespace cyy::naive_lib::task {
 
   protected:
     bool _wait_done(const std::chrono::milliseconds &timeout) override {
+      std::lock_guard lk(this->sync_mu);
       if (result_opt.has_value()) {
         return true;
       }
-      if (task<ResultType>::_wait_done(timeout)) {
+      if (this->wait_future(timeout)) {
         result_opt = this->future_opt->get();
         this->future_opt.reset();
         return true;
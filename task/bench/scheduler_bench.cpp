@@ -0,0 +1,406 @@
+/*!
+ * \file scheduler_bench.cpp
+ *
+ * \brief 測量调度器的吞吐量和端到端延遲
+ * \note 每組參數輸出一行，默認是JSON Lines，也可以輸出CSV，方便在版本之間比較；
+ * 有任務沒有在超時內完成時返回非0
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../base_processor.hpp"
+#include "../base_task.hpp"
+#include "../queue_scheduler.hpp"
+#include "../work_stealing_scheduler.hpp"
+
+namespace {
+  using namespace cyy::naive_lib::task;
+
+  using payload_type = std::vector<std::byte>;
+
+  class bench_task
+      : public task_with_argument_and_result<payload_type, uint64_t> {
+  public:
+    using task_with_argument_and_result::task_with_argument_and_result;
+    std::chrono::steady_clock::time_point submit_time{
+        std::chrono::steady_clock::now()};
+  };
+
+  //! \brief 一組參數運行期間處理器共享的狀態
+  //! \note 延遲保存原始樣本而不是用histogram，後者的分位數有12.5%的量化誤差，
+  //! 不足以比較版本之間的小差異
+  struct bench_state {
+    //! \brief 預熱期間不記錄延遲
+    std::atomic<bool> recording{false};
+    std::mutex latency_mutex;
+    //! \brief 各處理器退出時合併進來的延遲樣本，單位納秒
+    std::vector<uint64_t> latency_ns;
+
+    void merge_latency(const std::vector<uint64_t> &samples) {
+      std::lock_guard lk(latency_mutex);
+      latency_ns.insert(latency_ns.end(), samples.begin(), samples.end());
+    }
+  };
+
+  //! \brief 讀一遍負載，模擬處理器接觸任務數據
+  class bench_processor : public base_processor {
+  public:
+    explicit bench_processor(bench_state &state_) : state{state_} {}
+    ~bench_processor() override {
+      stop();
+      state.merge_latency(latency_ns);
+    }
+
+    void
+    process_tasks(std::vector<std::shared_ptr<base_task>> &tasks) override {
+      auto recording = state.recording.load(std::memory_order_relaxed);
+      for (auto &task : tasks) {
+        auto ptr = std::static_pointer_cast<bench_task>(task);
+        auto const &payload = ptr->get_argument();
+        uint64_t sum = std::accumulate(
+            payload.begin(), payload.end(), uint64_t(0),
+            [](uint64_t s, std::byte b) {
+              return s + std::to_integer<uint64_t>(b);
+            });
+        if (recording) {
+          // 先記在處理器本地，避免處理器之間爭用
+          latency_ns.push_back(static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - ptr->submit_time)
+                  .count()));
+        }
+        ptr->result_promise.set_value(sum);
+      }
+    }
+
+  private:
+    bench_state &state;
+    std::vector<uint64_t> latency_ns;
+  };
+
+  struct bench_config {
+    std::string scheduler;
+    size_t producers{1};
+    size_t processors{1};
+    size_t batch_size{1};
+    size_t payload_bytes{0};
+  };
+
+  struct bench_options {
+    std::vector<std::string> schedulers{"queue"};
+    std::vector<size_t> producers{1, 4};
+    std::vector<size_t> processors{1, 4};
+    std::vector<size_t> batch_sizes{1, 16};
+    std::vector<size_t> payload_bytes{0, 4096};
+    size_t tasks{100000};
+    size_t warmup_tasks{1000};
+    //! \brief 每個生產者最多同時等待的任務數
+    size_t window{256};
+    std::chrono::milliseconds batch_timeout{1};
+    std::string format{"json"};
+  };
+
+  struct bench_result {
+    size_t tasks{0};
+    //! \brief 包括預熱在內沒有在超時內完成的任務數
+    size_t failed_tasks{0};
+    double seconds{0};
+    //! \brief 排好序的延遲樣本，單位納秒
+    std::vector<uint64_t> latency_ns;
+
+    //! \brief 延遲的q分位數（最近秩），單位微秒
+    double latency_percentile_us(double q) const {
+      if (latency_ns.empty()) {
+        return 0;
+      }
+      auto rank = static_cast<size_t>(
+          std::ceil(q * static_cast<double>(latency_ns.size())));
+      auto idx = std::clamp<size_t>(rank, 1, latency_ns.size()) - 1;
+      return static_cast<double>(latency_ns[idx]) / 1000;
+    }
+
+    double latency_mean_us() const {
+      if (latency_ns.empty()) {
+        return 0;
+      }
+      return static_cast<double>(std::accumulate(
+                 latency_ns.begin(), latency_ns.end(), uint64_t(0))) /
+             static_cast<double>(latency_ns.size()) / 1000;
+    }
+  };
+
+  std::unique_ptr<base_scheduler>
+  make_scheduler(const bench_config &config, bench_state &state,
+                 const bench_options &options) {
+    std::vector<std::function<std::unique_ptr<base_processor>()>> makers(
+        config.processors, [&state, &config, &options]() {
+          auto processor = std::make_unique<bench_processor>(state);
+          processor->set_task_batch_size(config.batch_size);
+          processor->set_task_batch_timeout(options.batch_timeout);
+          return processor;
+        });
+    if (config.scheduler == "work_stealing") {
+      return std::make_unique<work_stealing_scheduler>(makers);
+    }
+    return std::make_unique<queue_scheduler>(makers);
+  }
+
+  //! \brief 生產者閉環提交任務，在途任務達到窗口大小後等待最早的一個
+  //! \return 沒有在超時內完成的任務數
+  size_t produce(base_scheduler &scheduler, size_t task_num,
+                 const bench_config &config, const bench_options &options) {
+    constexpr auto timeout = std::chrono::seconds(10);
+    size_t failed = 0;
+    std::deque<task_handle<bench_task>> in_flight;
+    for (size_t i = 0; i < task_num; i++) {
+      if (in_flight.size() >= options.window) {
+        if (!in_flight.front().wait_done(timeout)) {
+          failed++;
+        }
+        in_flight.pop_front();
+      }
+      auto task = std::make_shared<bench_task>(payload_type(
+          config.payload_bytes, static_cast<std::byte>(i & 0xff)));
+      in_flight.emplace_back(scheduler.submit(task));
+    }
+    for (auto &handle : in_flight) {
+      if (!handle.wait_done(timeout)) {
+        failed++;
+      }
+    }
+    return failed;
+  }
+
+  //! \return 沒有在超時內完成的任務數
+  size_t run_producers(base_scheduler &scheduler, size_t task_num,
+                       const bench_config &config,
+                       const bench_options &options) {
+    std::atomic<size_t> failed{0};
+    {
+      std::vector<std::jthread> producers;
+      for (size_t i = 0; i < config.producers; i++) {
+        auto num = task_num / config.producers +
+                   (i < task_num % config.producers ? 1 : 0);
+        producers.emplace_back([&scheduler, num, &config, &options, &failed] {
+          failed += produce(scheduler, num, config, options);
+        });
+      }
+    }
+    return failed;
+  }
+
+  bench_result run_bench(const bench_config &config,
+                         const bench_options &options) {
+    bench_state state;
+    auto scheduler = make_scheduler(config, state, options);
+    bench_result result;
+    result.failed_tasks =
+        run_producers(*scheduler, options.warmup_tasks, config, options);
+
+    state.recording = true;
+    auto begin = std::chrono::steady_clock::now();
+    result.failed_tasks +=
+        run_producers(*scheduler, options.tasks, config, options);
+    auto end = std::chrono::steady_clock::now();
+    state.recording = false;
+
+    result.tasks = options.tasks;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    // processor析構時才交出樣本
+    scheduler.reset();
+    result.latency_ns = std::move(state.latency_ns);
+    std::ranges::sort(result.latency_ns);
+    return result;
+  }
+
+  constexpr std::array<std::pair<std::string_view, double>, 4> percentiles{
+      {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}}};
+
+  void print_csv_header() {
+    std::cout << "scheduler,producers,processors,batch_size,payload_bytes,"
+                 "tasks,failed_tasks,seconds,tasks_per_second";
+    for (auto const &[name, _] : percentiles) {
+      std::cout << ",latency_" << name << "_us";
+    }
+    std::cout << ",latency_mean_us\n";
+  }
+
+  void print_result(const bench_config &config, const bench_result &result,
+                    std::string_view format) {
+    auto throughput =
+        result.seconds > 0 ? static_cast<double>(result.tasks) / result.seconds
+                           : 0;
+    auto mean = result.latency_mean_us();
+    if (format == "csv") {
+      std::cout << config.scheduler << ',' << config.producers << ','
+                << config.processors << ',' << config.batch_size << ','
+                << config.payload_bytes << ',' << result.tasks << ','
+                << result.failed_tasks << ',' << result.seconds << ','
+                << throughput;
+      for (auto const &[_, q] : percentiles) {
+        std::cout << ',' << result.latency_percentile_us(q);
+      }
+      std::cout << ',' << mean << '\n';
+    } else {
+      std::cout << R"({"scheduler":")" << config.scheduler
+                << R"(","producers":)" << config.producers
+                << R"(,"processors":)" << config.processors
+                << R"(,"batch_size":)" << config.batch_size
+                << R"(,"payload_bytes":)" << config.payload_bytes
+                << R"(,"tasks":)" << result.tasks << R"(,"failed_tasks":)"
+                << result.failed_tasks << R"(,"seconds":)" << result.seconds
+                << R"(,"tasks_per_second":)" << throughput;
+      for (auto const &[name, q] : percentiles) {
+        std::cout << R"(,"latency_)" << name
+                  << R"(_us":)" << result.latency_percentile_us(q);
+      }
+      std::cout << R"(,"latency_mean_us":)" << mean << "}\n";
+    }
+    std::cout.flush();
+  }
+
+  bool parse_number(std::string_view str, size_t &value) {
+    auto [ptr, ec] =
+        std::from_chars(str.data(), str.data() + str.size(), value);
+    return ec == std::errc() && ptr == str.data() + str.size();
+  }
+
+  //! \brief 解析逗號分隔的數字列表
+  bool parse_list(std::string_view str, std::vector<size_t> &values) {
+    values.clear();
+    while (true) {
+      auto pos = str.find(',');
+      size_t value = 0;
+      if (!parse_number(str.substr(0, pos), value)) {
+        return false;
+      }
+      values.push_back(value);
+      if (pos == std::string_view::npos) {
+        return true;
+      }
+      str.remove_prefix(pos + 1);
+    }
+  }
+
+  void print_usage(const char *prog) {
+    std::cerr
+        << "Usage: " << prog << " [options]\n"
+        << "  --scheduler LIST      queue,work_stealing (default queue)\n"
+        << "  --producers LIST      producer threads (default 1,4)\n"
+        << "  --processors LIST     processors (default 1,4)\n"
+        << "  --batch-sizes LIST    processor batch sizes (default 1,16)\n"
+        << "  --payload-bytes LIST  task payload sizes (default 0,4096)\n"
+        << "  --tasks N             measured tasks per run (default 100000)\n"
+        << "  --warmup N            unmeasured tasks per run (default 1000)\n"
+        << "  --window N            in-flight tasks per producer "
+           "(default 256)\n"
+        << "  --batch-timeout-ms N  processor batch timeout (default 1)\n"
+        << "  --format json|csv     output format (default json)\n";
+  }
+
+  bool parse_options(int argc, char **argv, bench_options &options) {
+    for (int i = 1; i < argc; i++) {
+      std::string_view key = argv[i];
+      if (i + 1 >= argc) {
+        return false;
+      }
+      std::string_view value = argv[++i];
+      size_t number = 0;
+      bool ok = true;
+      if (key == "--scheduler") {
+        options.schedulers.clear();
+        while (!value.empty()) {
+          auto pos = value.find(',');
+          auto name = value.substr(0, pos);
+          if (name != "queue" && name != "work_stealing") {
+            return false;
+          }
+          options.schedulers.emplace_back(name);
+          value = pos == std::string_view::npos ? std::string_view{}
+                                                : value.substr(pos + 1);
+        }
+        ok = !options.schedulers.empty();
+      } else if (key == "--producers") {
+        ok = parse_list(value, options.producers);
+      } else if (key == "--processors") {
+        ok = parse_list(value, options.processors);
+      } else if (key == "--batch-sizes") {
+        ok = parse_list(value, options.batch_sizes);
+      } else if (key == "--payload-bytes") {
+        ok = parse_list(value, options.payload_bytes);
+      } else if (key == "--tasks") {
+        ok = parse_number(value, options.tasks);
+      } else if (key == "--warmup") {
+        ok = parse_number(value, options.warmup_tasks);
+      } else if (key == "--window") {
+        ok = parse_number(value, options.window) && options.window > 0;
+      } else if (key == "--batch-timeout-ms") {
+        ok = parse_number(value, number);
+        options.batch_timeout = std::chrono::milliseconds(number);
+      } else if (key == "--format") {
+        options.format = value;
+        ok = value == "json" || value == "csv";
+      } else {
+        ok = false;
+      }
+      if (!ok) {
+        return false;
+      }
+    }
+    auto positive = [](auto const &list) {
+      return std::ranges::none_of(list, [](size_t n) { return n == 0; });
+    };
+    return positive(options.producers) && positive(options.processors) &&
+           positive(options.batch_sizes);
+  }
+} // namespace
+
+int main(int argc, char **argv) {
+  bench_options options;
+  if (!parse_options(argc, argv, options)) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  if (options.format == "csv") {
+    print_csv_header();
+  }
+  size_t failed_tasks = 0;
+  for (auto const &scheduler : options.schedulers) {
+    for (auto producers : options.producers) {
+      for (auto processors : options.processors) {
+        for (auto batch_size : options.batch_sizes) {
+          for (auto payload_bytes : options.payload_bytes) {
+            bench_config config{scheduler, producers, processors, batch_size,
+                                payload_bytes};
+            auto result = run_bench(config, options);
+            failed_tasks += result.failed_tasks;
+            print_result(config, result, options.format);
+          }
+        }
+      }
+    }
+  }
+  if (failed_tasks != 0) {
+    std::cerr << failed_tasks << " tasks were not done in time\n";
+    return 1;
+  }
+  return 0;
+}
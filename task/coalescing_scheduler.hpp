@@ -0,0 +1,299 @@
+/*!
+ * \file coalescing_scheduler.hpp
+ *
+ * \brief 合并重複請求的调度器
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base_scheduler.hpp"
+#include "metrics.hpp"
+#include "result_cache.hpp"
+#include "util/runnable.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 參數相同的任務只計算一次，結果分發給所有等待者
+  //! \tparam TaskType task_with_argument_and_result或其子類
+  //! \tparam KeyType 判斷任務是否相同的鍵，默認是任務參數
+  //! \note 其它類型的任務直接轉交下游调度器；
+  //! 參數本身很大時（例如圖像），可以用key_func只取它的哈希和模型版本作為鍵。
+  //! 在途任務失敗時由自己的綫程重新提交下一個等待者，完成回調可能在下游隊列的鎖內執行
+  template <typename TaskType,
+            typename KeyType = std::remove_cvref_t<
+                decltype(std::declval<const TaskType &>().get_argument())>,
+            typename Hash = std::hash<KeyType>,
+            typename KeyEqual = std::equal_to<KeyType>>
+  class coalescing_scheduler final : public base_scheduler,
+                                     private cyy::naive_lib::runnable {
+  public:
+    using task_type = TaskType;
+    using key_type = KeyType;
+    using result_type = typename std::remove_cvref_t<
+        decltype(std::declval<TaskType &>().get_result())>::value_type;
+    using key_func_type = std::function<KeyType(const TaskType &)>;
+    using cache_type = result_cache<KeyType, result_type, Hash, KeyEqual>;
+
+    struct config {
+      //! \brief 結果緩存，為空時不緩存；可以在多個调度器之間共享
+      std::shared_ptr<cache_type> cache;
+      //! \brief 放入緩存的結果的TTL，為空時使用緩存的默認值
+      std::optional<std::chrono::milliseconds> cache_ttl;
+    };
+
+    explicit coalescing_scheduler(
+        std::shared_ptr<base_scheduler> target_, config conf = {},
+        key_func_type key_func = [](const TaskType &task) {
+          return KeyType(task.get_argument());
+        })
+        : target{std::move(target_)},
+          st{std::make_shared<state>(conf, std::move(key_func))} {
+      if (!target) {
+        throw std::invalid_argument("target scheduler is empty");
+      }
+      start("coalescing_scheduler");
+    }
+
+    ~coalescing_scheduler() override {
+      stop();
+      std::deque<promotion> pending;
+      {
+        std::lock_guard lk(st->mu);
+        st->stopped = true;
+        pending = std::move(st->promotions);
+      }
+      // 沒有重新提交的等待者作廢，它們的flight隨之清理
+      for (auto &[f, leader] : pending) {
+        if (leader->add_done_callback(*f)) {
+          leader->mark_invalid();
+        } else {
+          finish(*f);
+        }
+      }
+    }
+
+    const coalescing_metrics &get_metrics() const noexcept {
+      return st->metrics;
+    }
+
+    //! \brief 正在計算的不同鍵的個數
+    size_t in_flight_num() const {
+      std::lock_guard lk(st->mu);
+      return st->flights.size();
+    }
+
+  protected:
+    void enqueue(const std::shared_ptr<base_task> &task) override {
+      auto typed = std::dynamic_pointer_cast<TaskType>(task);
+      if (!typed) {
+        target->submit(task);
+        return;
+      }
+      auto key = st->key_func(*typed);
+      // 緩存自己分片加鎖，不佔用在途任務表的鎖
+      if (auto cached = lookup_cache(key)) {
+        complete_from_cache(*typed, std::move(*cached));
+        return;
+      }
+      std::unique_lock lk(st->mu);
+      auto it = st->flights.find(key);
+      if (it != st->flights.end()) {
+        it->second->followers.emplace_back(std::move(typed));
+        st->metrics.coalesced_tasks.add();
+        return;
+      }
+      auto f = std::make_shared<flight>(st, key, typed);
+      st->flights.emplace(std::move(key), f);
+      lk.unlock();
+      st->metrics.forwarded_tasks.add();
+      start_flight(*f, typed, *target);
+    }
+
+  private:
+    struct state;
+
+    std::optional<result_type> lookup_cache(const KeyType &key) {
+      if (!st->conf.cache) {
+        return {};
+      }
+      return st->conf.cache->get(key);
+    }
+
+    //! \brief 命中緩存時同步完成任務，不經過隊列和處理器
+    void complete_from_cache(TaskType &task, result_type result) {
+      st->metrics.cache_hits.add();
+      task.result_promise.set_value(std::move(result));
+      task.notify_done();
+    }
+
+    //! \brief 同一個鍵的在途計算：一個真正提交的任務和等待它的任務
+    struct flight : base_task::done_callback {
+      flight(std::shared_ptr<state> owner_, KeyType key_,
+             std::shared_ptr<TaskType> leader_)
+          : owner{std::move(owner_)}, key{std::move(key_)},
+            leader{std::move(leader_)} {
+        func = &on_done;
+      }
+
+      std::shared_ptr<state> owner;
+      KeyType key;
+      std::shared_ptr<TaskType> leader;
+      std::vector<std::shared_ptr<TaskType>> followers;
+    };
+
+    //! \brief 等待重新提交的等待者和它接手的flight
+    using promotion =
+        std::pair<std::shared_ptr<flight>, std::shared_ptr<TaskType>>;
+
+    //! \brief 與调度器分開，在途任務完成時调度器可能已經析構
+    //! \note 不持有下游调度器，否則最後一個引用可能在處理器綫程上釋放，
+    //! 下游调度器在自己的綫程上析構
+    struct state {
+      state(const config &conf_, key_func_type key_func_)
+          : conf{conf_}, key_func{std::move(key_func_)} {}
+
+      config conf;
+      key_func_type key_func;
+      coalescing_metrics metrics;
+
+      mutable std::mutex mu;
+      std::unordered_map<KeyType, std::shared_ptr<flight>, Hash, KeyEqual>
+          flights;
+      std::deque<promotion> promotions;
+      std::condition_variable_any promotion_cv;
+      //! \brief 调度器已經析構，不再重新提交
+      bool stopped{false};
+    };
+
+    void run(const std::stop_token &st_) override {
+      while (true) {
+        promotion p;
+        {
+          std::unique_lock lk(st->mu);
+          if (!st->promotion_cv.wait(lk, st_, [this] {
+                return !st->promotions.empty();
+              })) {
+            return;
+          }
+          p = std::move(st->promotions.front());
+          st->promotions.pop_front();
+        }
+        start_flight(*p.first, p.second, *target);
+      }
+    }
+
+    //! \brief 先註冊完成回調再提交，保證不會錯過完成通知
+    static void start_flight(flight &f,
+                             const std::shared_ptr<TaskType> &leader,
+                             base_scheduler &target) {
+      if (!leader->add_done_callback(f)) {
+        // 任務已經作廢
+        finish(f);
+        return;
+      }
+      // 註冊之後f可能已被回調銷毀，不再訪問它
+      target.submit(leader);
+    }
+
+    static void on_done(base_task::done_callback &callback) noexcept {
+      finish(static_cast<flight &>(callback));
+    }
+
+    static void finish(flight &f) noexcept {
+      auto owner = f.owner;
+      std::shared_ptr<flight> self;
+      std::vector<std::shared_ptr<TaskType>> followers;
+      std::optional<result_type> result;
+      std::vector<std::shared_ptr<TaskType>> invalidated;
+      bool promoted = false;
+      try {
+        // 處理器設置結果後才通知完成，這裡不會阻塞
+        auto const &leader_result =
+            f.leader->get_result(std::chrono::milliseconds(0));
+        if (leader_result.has_value()) {
+          result = *leader_result;
+        }
+        std::lock_guard lk(owner->mu);
+        auto it = owner->flights.find(f.key);
+        self = it->second;
+        if (result) {
+          followers = std::move(f.followers);
+          // 先放入緩存再移出在途表，之後到達的相同任務不會重新計算
+          if (owner->conf.cache) {
+            owner->conf.cache->put(f.key, *result, owner->conf.cache_ttl);
+          }
+          owner->flights.erase(it);
+        } else {
+          // 在途任務失敗（例如過期或被它的提交者取消），讓下一個還有效的等待者重新計算
+          // 這裡可能在下游隊列的鎖內，交給调度器的綫程重新提交
+          std::erase_if(f.followers,
+                        [](auto const &task) { return !task->can_process(); });
+          if (owner->stopped) {
+            // 调度器已經析構，沒有地方重新計算
+            invalidated = std::move(f.followers);
+            f.followers.clear();
+          }
+          if (f.followers.empty()) {
+            owner->flights.erase(it);
+          } else {
+            auto new_leader = f.followers.front();
+            f.followers.erase(f.followers.begin());
+            f.leader = new_leader;
+            owner->promotions.emplace_back(self, std::move(new_leader));
+            promoted = true;
+          }
+        }
+      } catch (...) {
+        // 結果是異常或無法複製時，等待者只能作廢
+        {
+          std::lock_guard lk(owner->mu);
+          auto it = owner->flights.find(f.key);
+          if (it != owner->flights.end() && it->second.get() == &f) {
+            self = it->second;
+            owner->flights.erase(it);
+          }
+          followers.insert(followers.end(), f.followers.begin(),
+                           f.followers.end());
+          f.followers.clear();
+        }
+        followers.insert(followers.end(), invalidated.begin(),
+                         invalidated.end());
+        for (auto &task : followers) {
+          task->mark_invalid();
+        }
+        return;
+      }
+      for (auto &task : invalidated) {
+        task->mark_invalid();
+      }
+      for (auto &task : followers) {
+        try {
+          task->result_promise.set_value(*result);
+        } catch (...) {
+          task->mark_invalid();
+          continue;
+        }
+        task->notify_done();
+      }
+      if (promoted) {
+        owner->metrics.promoted_tasks.add();
+        owner->promotion_cv.notify_one();
+      }
+    }
+
+    std::shared_ptr<base_scheduler> target;
+    std::shared_ptr<state> st;
+  };
+} // namespace cyy::naive_lib::task
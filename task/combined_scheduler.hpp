@@ -5,12 +5,20 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <vector>
 
 #include "base_processor.hpp"
 #include "base_scheduler.hpp"
+#include "util/runnable.hpp"
 
 namespace cyy::naive_lib::task {
 
@@ -54,8 +62,204 @@ namespace cyy::naive_lib::task {
       return cur_task;
     }
 
+    //! \brief 開啓流水綫模式，每一級的輸出直接進入下一級的隊列
+    //! \param stage_buffer_size 每一級最多同時容納的任務數，滿了以後阻塞上一級
+    void enable_pipeline(size_t stage_buffer_size) {
+      if (pipeline) {
+        throw std::runtime_error("pipeline is already enabled");
+      }
+      pipeline = std::make_unique<pipeline_type>(
+          schedulers, task_converter, std::max<size_t>(stage_buffer_size, 1));
+    }
+
+    //! \brief 以流水綫模式提交任务，第一級已滿時阻塞
+    //! \param task 任務
+    //! \param timeout 任務經過所有調度器的超时时间
+    //! \return 最後一級轉換得到的任務，失敗時為空
+    std::future<std::shared_ptr<base_task>>
+    submit(const std::shared_ptr<base_task> &task,
+           const std::chrono::milliseconds &timeout) {
+      if (!pipeline) {
+        throw std::runtime_error("pipeline is not enabled");
+      }
+      return pipeline->submit(task, std::chrono::steady_clock::now() + timeout);
+    }
+
+  private:
+    //! \brief 流水綫的一級：把任務交給調度器，按提交順序等待完成後轉交下一級
+    class pipeline_stage final : private cyy::naive_lib::runnable {
+    public:
+      struct entry {
+        std::shared_ptr<base_task> task;
+        std::chrono::steady_clock::time_point deadline;
+        std::shared_ptr<std::promise<std::shared_ptr<base_task>>> result;
+      };
+
+      pipeline_stage(size_t index_, std::shared_ptr<base_scheduler> scheduler_,
+                     const task_converter_type &task_converter_,
+                     size_t buffer_size_)
+          : index{index_}, scheduler{std::move(scheduler_)},
+            task_converter{task_converter_}, buffer_size{buffer_size_} {}
+
+      ~pipeline_stage() override {
+        stop([this]() { request_stop(); });
+        for (auto &e : entries) {
+          e.result->set_value({});
+        }
+      }
+
+      //! \brief 不再接收任務，並叫醒所有等待者
+      void request_stop() {
+        {
+          std::lock_guard lk(mu);
+          stopped = true;
+        }
+        cv.notify_all();
+      }
+
+      void set_next_stage(pipeline_stage *next_stage_) {
+        next_stage = next_stage_;
+      }
+
+      void start_forwarding() { start("pipeline_stage"); }
+
+      //! \brief 放入任務，緩衝區已滿時阻塞
+      void push(entry e) {
+        std::unique_lock lk(mu);
+        auto has_space = [this] {
+          return entries.size() + reserved < buffer_size;
+        };
+        cv.wait_until(lk, e.deadline,
+                      [this, &has_space] { return stopped || has_space(); });
+        if (stopped || !has_space()) {
+          lk.unlock();
+          e.task->mark_invalid();
+          e.result->set_value({});
+          return;
+        }
+        // 先佔住位置，在鎖外提交：調度器可能阻塞或同步完成任務
+        reserved++;
+        lk.unlock();
+        if (!e.task->get_deadline()) {
+          e.task->set_deadline(e.deadline);
+        }
+        scheduler->submit(e.task);
+        lk.lock();
+        reserved--;
+        entries.emplace_back(std::move(e));
+        lk.unlock();
+        cv.notify_all();
+      }
+
+    private:
+      void run(const std::stop_token & /*st*/) override {
+        while (!needs_stop()) {
+          std::unique_lock lk(mu);
+          cv.wait(lk, [this] { return stopped || !entries.empty(); });
+          if (stopped) {
+            return;
+          }
+          auto e = entries.front();
+          lk.unlock();
+
+          bool done = false;
+          while (!needs_stop()) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= e.deadline) {
+              break;
+            }
+            done = e.task->wait_done(std::min<std::chrono::milliseconds>(
+                std::chrono::ceil<std::chrono::milliseconds>(e.deadline - now),
+                std::chrono::milliseconds(100)));
+            if (done || e.task->is_invalid()) {
+              break;
+            }
+          }
+          if (needs_stop()) {
+            return;
+          }
+          // 先交給下一級再釋放本級的位置，下一級滿時本級也跟着阻塞
+          if (!done) {
+            e.task->cancel();
+            e.result->set_value({});
+          } else {
+            auto next_task = task_converter(index, e.task);
+            if (next_stage && next_task) {
+              next_stage->push({next_task, e.deadline, e.result});
+            } else {
+              e.result->set_value(next_task);
+            }
+          }
+          lk.lock();
+          entries.pop_front();
+          lk.unlock();
+          cv.notify_all();
+        }
+      }
+
+      size_t index;
+      std::shared_ptr<base_scheduler> scheduler;
+      task_converter_type task_converter;
+      size_t buffer_size;
+      pipeline_stage *next_stage{nullptr};
+
+      std::mutex mu;
+      std::condition_variable cv;
+      std::deque<entry> entries;
+      //! \brief 已佔住位置但還在提交中的任務數
+      size_t reserved{0};
+      bool stopped{false};
+    };
+
+    class pipeline_type final {
+    public:
+      pipeline_type(
+          const std::vector<std::shared_ptr<base_scheduler>> &schedulers,
+          const task_converter_type &task_converter,
+          size_t stage_buffer_size) {
+        for (size_t i = 0; i < schedulers.size(); i++) {
+          stages.emplace_back(std::make_unique<pipeline_stage>(
+              i, schedulers[i], task_converter, stage_buffer_size));
+        }
+        for (size_t i = 0; i + 1 < stages.size(); i++) {
+          stages[i]->set_next_stage(stages[i + 1].get());
+        }
+        for (auto &stage : stages) {
+          stage->start_forwarding();
+        }
+      }
+      ~pipeline_type() {
+        // 先讓所有級都停止接收任務，以免前一級阻塞在往下一級放任務上；
+        // 再從第一級開始析構，保證前一級的綫程結束後下一級才析構
+        for (auto &stage : stages) {
+          stage->request_stop();
+        }
+        for (auto &stage : stages) {
+          stage.reset();
+        }
+      }
+
+      std::future<std::shared_ptr<base_task>>
+      submit(const std::shared_ptr<base_task> &task,
+             const std::chrono::steady_clock::time_point &deadline) {
+        auto result =
+            std::make_shared<std::promise<std::shared_ptr<base_task>>>();
+        auto future = result->get_future();
+        if (stages.empty()) {
+          result->set_value(task);
+          return future;
+        }
+        stages.front()->push({task, deadline, std::move(result)});
+        return future;
+      }
+
+    private:
+      std::vector<std::unique_ptr<pipeline_stage>> stages;
+    };
+
   private:
     std::vector<std::shared_ptr<base_scheduler>> schedulers;
     task_converter_type task_converter;
+    std::unique_ptr<pipeline_type> pipeline;
   }; // class combined_scheduler
 } // namespace cyy::naive_lib::task
@@ -0,0 +1,24 @@
+/*!
+ * \file coroutine.hpp
+ *
+ * \brief 配合任務句柄使用的協程類型
+ */
+#pragma once
+
+#include <coroutine>
+#include <exception>
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 啓動後自行運行到結束的協程，結束時釋放協程幀，調用者不等待結果
+  //! \note 協程內未捕獲的異常會終止程序
+  struct detached_coroutine {
+    struct promise_type {
+      detached_coroutine get_return_object() noexcept { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() noexcept {}
+      void unhandled_exception() noexcept { std::terminate(); }
+    };
+  };
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,250 @@
+/*!
+ * \file metrics.cpp
+ *
+ * \brief 调度器和處理器的監控指標
+ */
+
+#include "metrics.hpp"
+
+#include <format>
+#include <fstream>
+#include <system_error>
+
+namespace cyy::naive_lib::task {
+
+  namespace {
+    std::string format_labels(const prometheus_writer::label_list &labels,
+                              std::string_view extra_name = {},
+                              std::string_view extra_value = {}) {
+      std::string res;
+      auto append = [&res](std::string_view name, std::string_view value) {
+        res += res.empty() ? "{" : ",";
+        res += name;
+        res += "=\"";
+        for (auto c : value) {
+          switch (c) {
+            case '\\':
+              res += "\\\\";
+              break;
+            case '"':
+              res += "\\\"";
+              break;
+            case '\n':
+              res += "\\n";
+              break;
+            default:
+              res += c;
+          }
+        }
+        res += '"';
+      };
+      for (auto const &[name, value] : labels) {
+        append(name, value);
+      }
+      if (!extra_name.empty()) {
+        append(extra_name, extra_value);
+      }
+      if (!res.empty()) {
+        res += '}';
+      }
+      return res;
+    }
+  } // namespace
+
+  uint64_t histogram::snapshot_type::percentile(double q) const {
+    if (count == 0) {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(q * static_cast<double>(count));
+    if (rank >= count) {
+      rank = count - 1;
+    }
+    uint64_t cum = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+      cum += counts[i];
+      if (cum > rank) {
+        return bucket_upper_bound(i);
+      }
+    }
+    return bucket_upper_bound(counts.size() - 1);
+  }
+
+  histogram::snapshot_type histogram::snapshot() const {
+    snapshot_type res;
+    res.counts.resize(bucket_num);
+    for (size_t i = 0; i < bucket_num; i++) {
+      res.counts[i] = buckets[i].load(std::memory_order_relaxed);
+      res.count += res.counts[i];
+    }
+    res.sum = sum.load(std::memory_order_relaxed);
+    return res;
+  }
+
+  prometheus_writer::family &
+  prometheus_writer::get_family(std::string_view name, std::string_view help,
+                                std::string_view type) {
+    auto it = families.find(name);
+    if (it == families.end()) {
+      family_names.emplace_back(name);
+      it = families
+               .emplace(std::string(name),
+                        family{std::string(help), std::string(type), {}})
+               .first;
+    }
+    return it->second;
+  }
+
+  void prometheus_writer::add_counter(std::string_view name,
+                                      std::string_view help,
+                                      const label_list &labels,
+                                      uint64_t value) {
+    get_family(name, help, "counter").samples +=
+        std::format("{}{} {}\n", name, format_labels(labels), value);
+  }
+
+  void prometheus_writer::add_gauge(std::string_view name,
+                                    std::string_view help,
+                                    const label_list &labels, int64_t value) {
+    get_family(name, help, "gauge").samples +=
+        std::format("{}{} {}\n", name, format_labels(labels), value);
+  }
+
+  void prometheus_writer::add_histogram(
+      std::string_view name, std::string_view help, const label_list &labels,
+      const histogram::snapshot_type &snapshot, double scale) {
+    auto &samples = get_family(name, help, "histogram").samples;
+    // 只在2的冪處輸出桶邊界，避免輸出幾百行；
+    // 每次都輸出全部邊界，同一序列的桶佈局不隨數據變化
+    uint64_t cum = 0;
+    for (size_t i = 0; i < snapshot.counts.size(); i++) {
+      cum += snapshot.counts[i];
+      auto upper_bound = histogram::bucket_upper_bound(i);
+      if (!std::has_single_bit(upper_bound) || upper_bound == UINT64_MAX) {
+        continue;
+      }
+      samples += std::format(
+          "{}_bucket{} {}\n", name,
+          format_labels(labels, "le",
+                        std::format("{}", static_cast<double>(upper_bound) *
+                                              scale)),
+          cum);
+    }
+    samples += std::format("{}_bucket{} {}\n", name,
+                           format_labels(labels, "le", "+Inf"), snapshot.count);
+    samples += std::format("{}_sum{} {}\n", name, format_labels(labels),
+                           static_cast<double>(snapshot.sum) * scale);
+    samples += std::format("{}_count{} {}\n", name, format_labels(labels),
+                           snapshot.count);
+  }
+
+  void prometheus_writer::add(const queue_metrics &metrics,
+                              std::string_view prefix,
+                              const label_list &labels) {
+    add_counter(std::format("{}_enqueued_tasks_total", prefix),
+                "Tasks put into the queue", labels,
+                metrics.enqueued_tasks.get());
+    add_counter(std::format("{}_dropped_tasks_total", prefix),
+                "Expired or invalid tasks dropped by the queue", labels,
+                metrics.dropped_tasks.get());
+    add_counter(std::format("{}_rejected_tasks_total", prefix),
+                "Tasks rejected because the queue was full", labels,
+                metrics.rejected_tasks.get());
+    add_counter(std::format("{}_shed_tasks_total", prefix),
+                "Queued tasks dropped to make room for new ones", labels,
+                metrics.shed_tasks.get());
+    add_gauge(std::format("{}_queue_depth", prefix), "Tasks in the queue",
+              labels, metrics.queue_depth.get());
+    add_histogram(std::format("{}_queue_wait_seconds", prefix),
+                  "Time tasks spent in the queue", labels,
+                  metrics.queue_wait.snapshot(), 1e-6);
+  }
+
+  void prometheus_writer::add(const processor_metrics &metrics,
+                              std::string_view prefix,
+                              const label_list &labels) {
+    add_counter(std::format("{}_processed_tasks_total", prefix),
+                "Tasks passed to process_tasks", labels,
+                metrics.processed_tasks.get());
+    add_counter(std::format("{}_batches_total", prefix),
+                "Calls of process_tasks", labels, metrics.batches.get());
+    add_histogram(std::format("{}_batch_size", prefix),
+                  "Tasks per process_tasks call", labels,
+                  metrics.batch_size.snapshot());
+    add_histogram(std::format("{}_process_seconds", prefix),
+                  "Duration of process_tasks", labels,
+                  metrics.process_latency.snapshot(), 1e-6);
+  }
+
+  void prometheus_writer::add(const coalescing_metrics &metrics,
+                              std::string_view prefix,
+                              const label_list &labels) {
+    add_counter(std::format("{}_forwarded_tasks_total", prefix),
+                "Tasks forwarded to the target scheduler", labels,
+                metrics.forwarded_tasks.get());
+    add_counter(std::format("{}_coalesced_tasks_total", prefix),
+                "Tasks attached to an identical in-flight task", labels,
+                metrics.coalesced_tasks.get());
+    add_counter(std::format("{}_cache_hits_total", prefix),
+                "Tasks completed from cached results", labels,
+                metrics.cache_hits.get());
+    add_counter(std::format("{}_promoted_tasks_total", prefix),
+                "Waiting tasks resubmitted after the in-flight task failed",
+                labels, metrics.promoted_tasks.get());
+  }
+
+  void prometheus_writer::add(const cache_metrics &metrics,
+                              std::string_view prefix,
+                              const label_list &labels) {
+    add_counter(std::format("{}_hits_total", prefix), "Cache lookups that hit",
+                labels, metrics.hits.get());
+    add_counter(std::format("{}_misses_total", prefix),
+                "Cache lookups that missed", labels, metrics.misses.get());
+    add_counter(std::format("{}_insertions_total", prefix),
+                "Results put into the cache", labels,
+                metrics.insertions.get());
+    add_counter(std::format("{}_rejections_total", prefix),
+                "Results not admitted by the frequency filter", labels,
+                metrics.rejections.get());
+    add_counter(std::format("{}_evictions_total", prefix),
+                "Results evicted to stay within the byte budget", labels,
+                metrics.evictions.get());
+    add_counter(std::format("{}_expirations_total", prefix),
+                "Results removed after their TTL", labels,
+                metrics.expirations.get());
+    add_gauge(std::format("{}_entries", prefix), "Results in the cache",
+              labels, metrics.entries.get());
+    add_gauge(std::format("{}_bytes", prefix),
+              "Estimated bytes used by cached results", labels,
+              metrics.bytes.get());
+  }
+
+  std::string prometheus_writer::str() const {
+    std::string res;
+    for (auto const &name : family_names) {
+      auto const &f = families.find(name)->second;
+      res += std::format("# HELP {} {}\n# TYPE {} {}\n", name, f.help, name,
+                         f.type);
+      res += f.samples;
+    }
+    return res;
+  }
+
+  bool prometheus_writer::write_to_file(
+      const std::filesystem::path &path) const {
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    {
+      std::ofstream out(tmp_path, std::ios::trunc);
+      if (!out) {
+        return false;
+      }
+      out << str();
+      if (!out) {
+        return false;
+      }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    return !ec;
+  }
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,202 @@
+/*!
+ * \file metrics.hpp
+ *
+ * \brief 调度器和處理器的監控指標
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 單調遞增的計數器
+  class counter {
+  public:
+    void add(uint64_t n = 1) noexcept {
+      value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t get() const noexcept {
+      return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> value{0};
+  };
+
+  //! \brief 可增可減的瞬時值
+  class gauge {
+  public:
+    void add(int64_t n) noexcept {
+      value.fetch_add(n, std::memory_order_relaxed);
+    }
+    void set(int64_t n) noexcept { value.store(n, std::memory_order_relaxed); }
+    int64_t get() const noexcept {
+      return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<int64_t> value{0};
+  };
+
+  //! \brief HDR風格的直方圖：按2的冪分組，每組再線性分成8份，相對誤差不超過12.5%
+  //! \note 記錄只有兩次relaxed原子加，可以在熱路徑上常開
+  class histogram {
+  public:
+    static constexpr size_t sub_bucket_bits = 3;
+    static constexpr size_t sub_bucket_num = size_t(1) << sub_bucket_bits;
+    static constexpr size_t bucket_num =
+        sub_bucket_num * (65 - sub_bucket_bits);
+
+    struct snapshot_type {
+      std::vector<uint64_t> counts;
+      uint64_t count{0};
+      uint64_t sum{0};
+      //! \brief 分位數的近似值（所在桶的上界）
+      uint64_t percentile(double q) const;
+    };
+
+    void record(uint64_t value) noexcept {
+      buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+      sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    //! \brief 以微秒為單位記錄時長
+    void record(std::chrono::nanoseconds duration) noexcept {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration)
+                    .count();
+      record(static_cast<uint64_t>(us < 0 ? 0 : us));
+    }
+
+    snapshot_type snapshot() const;
+
+    static constexpr size_t bucket_index(uint64_t value) noexcept {
+      if (value < sub_bucket_num) {
+        return static_cast<size_t>(value);
+      }
+      auto exp = static_cast<size_t>(std::bit_width(value)) - 1;
+      auto sub = static_cast<size_t>(value >> (exp - sub_bucket_bits)) &
+                 (sub_bucket_num - 1);
+      return sub_bucket_num + (exp - sub_bucket_bits) * sub_bucket_num + sub;
+    }
+
+    //! \brief 桶的上界（不含）
+    static constexpr uint64_t bucket_upper_bound(size_t index) noexcept {
+      if (index < sub_bucket_num) {
+        return index + 1;
+      }
+      auto exp = (index - sub_bucket_num) / sub_bucket_num;
+      auto sub = (index - sub_bucket_num) % sub_bucket_num;
+      auto base = uint64_t(sub_bucket_num + sub + 1);
+      if (exp >= static_cast<size_t>(std::countl_zero(base))) {
+        return UINT64_MAX;
+      }
+      return base << exp;
+    }
+
+  private:
+    std::array<std::atomic<uint64_t>, bucket_num> buckets{};
+    std::atomic<uint64_t> sum{0};
+  };
+
+  //! \brief 任务队列的指標
+  struct queue_metrics {
+    counter enqueued_tasks;
+    //! \brief 出隊時丟棄的過期或作廢任務
+    counter dropped_tasks;
+    //! \brief 隊列滿時被拒絕的新任務
+    counter rejected_tasks;
+    //! \brief 隊列滿時為新任務騰位置而丟棄的任務
+    counter shed_tasks;
+    gauge queue_depth;
+    //! \brief 任務在隊列中等待的時間，微秒
+    histogram queue_wait;
+  };
+
+  //! \brief 處理器的指標
+  struct processor_metrics {
+    counter processed_tasks;
+    counter batches;
+    histogram batch_size;
+    //! \brief process_tasks的耗時，微秒
+    histogram process_latency;
+  };
+
+  //! \brief 合并重複請求的指標
+  struct coalescing_metrics {
+    //! \brief 轉交下游调度器計算的任務
+    counter forwarded_tasks;
+    //! \brief 附加到相同的在途任務上的任務
+    counter coalesced_tasks;
+    //! \brief 直接由緩存的結果完成的任務
+    counter cache_hits;
+    //! \brief 在途任務失敗後，改由等待者重新計算的次數
+    counter promoted_tasks;
+  };
+
+  //! \brief 結果緩存的指標
+  struct cache_metrics {
+    counter hits;
+    counter misses;
+    counter insertions;
+    //! \brief 訪問頻率不如被淘汰者而沒有放入的結果
+    counter rejections;
+    //! \brief 為騰出空間淘汰的結果
+    counter evictions;
+    //! \brief 過期刪除的結果
+    counter expirations;
+    gauge entries;
+    gauge bytes;
+  };
+
+  //! \brief 把指標輸出成Prometheus的文本格式
+  class prometheus_writer {
+  public:
+    using label_list = std::vector<std::pair<std::string, std::string>>;
+
+    void add_counter(std::string_view name, std::string_view help,
+                     const label_list &labels, uint64_t value);
+    void add_gauge(std::string_view name, std::string_view help,
+                   const label_list &labels, int64_t value);
+    //! \brief 輸出直方圖
+    //! \param scale 把記錄的值換算成輸出單位的倍數，例如微秒換成秒時為1e-6
+    void add_histogram(std::string_view name, std::string_view help,
+                       const label_list &labels,
+                       const histogram::snapshot_type &snapshot,
+                       double scale = 1);
+
+    void add(const queue_metrics &metrics, std::string_view prefix,
+             const label_list &labels);
+    void add(const processor_metrics &metrics, std::string_view prefix,
+             const label_list &labels);
+    void add(const coalescing_metrics &metrics, std::string_view prefix,
+             const label_list &labels);
+    void add(const cache_metrics &metrics, std::string_view prefix,
+             const label_list &labels);
+
+    std::string str() const;
+    //! \brief 先寫臨時文件再改名，讀取者不會看到寫了一半的內容
+    bool write_to_file(const std::filesystem::path &path) const;
+
+  private:
+    struct family {
+      std::string help;
+      std::string type;
+      std::string samples;
+    };
+    family &get_family(std::string_view name, std::string_view help,
+                       std::string_view type);
+
+    std::vector<std::string> family_names;
+    std::map<std::string, family, std::less<>> families;
+  };
+} // namespace cyy::naive_lib::task
@@ -7,7 +7,10 @@
  */
 #pragma once
 
+#include <string>
+
 #include "base_processor.hpp"
+#include "neural_network_task.hpp"
 
 namespace cyy::naive_lib::task {
 
@@ -17,9 +20,25 @@ namespace cyy::naive_lib::task {
     neural_network_processor() = default;
     ~neural_network_processor() override = default;
 
+    //! \brief 設置模型版本，需在start之前設置
     void set_model_version(const std::string &version) {
       model_version = version;
     }
+    const std::string &get_model_version() const noexcept {
+      return model_version;
+    }
+
+    //! \brief 設置了模型版本時只處理要求該版本或不要求版本的任務
+    //! \note 要求其他版本的任務在提交時被拒絕，滾動替換期間交給對應版本的processor
+    bool is_selective() const override { return !model_version.empty(); }
+    bool accepts(const base_task &task) const override {
+      if (model_version.empty()) {
+        return true;
+      }
+      auto const *nn_task = dynamic_cast<const neural_network_task_base *>(&task);
+      return nn_task == nullptr || nn_task->model_version.empty() ||
+             nn_task->model_version == model_version;
+    }
 
   protected:
     std::string model_version;
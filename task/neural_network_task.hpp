@@ -8,21 +8,31 @@
 
 #pragma once
 
+#include <string>
+
 #include "base_task.hpp"
 
 namespace cyy::naive_lib::task {
 
+  //! \brief 神经网络任务與參數類型無關的部分，處理器據此按模型版本選取任務
+  class neural_network_task_base {
+  public:
+    virtual ~neural_network_task_base() = default;
+
+  public:
+    //! \brief 需要的模型版本，為空時任何版本都可以處理
+    std::string model_version;
+  };
+
   //! \brief 神经网络任务
   template <typename ArgumentType, typename ResultType = void>
   class neural_network_task
-      : public task_with_argument_and_result<ArgumentType, ResultType> {
+      : public task_with_argument_and_result<ArgumentType, ResultType>,
+        public neural_network_task_base {
   public:
     using task_with_argument_and_result<
         ArgumentType, ResultType>::task_with_argument_and_result;
     ~neural_network_task() override = default;
-
-  public:
-    std::string model_version;
   };
 
 } // namespace cyy::naive_lib::task
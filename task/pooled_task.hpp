@@ -0,0 +1,80 @@
+/*!
+ * \file pooled_task.hpp
+ *
+ * \brief 從內存池分配的任務
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "base_task.hpp"
+#include "task_pool.hpp"
+#include "util/atomic_wait.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 帶參數和結果的任務，語義同task_with_argument_and_result
+  //! \note 對象和shared_ptr的控制塊一起從內存池分配，完成信號用原子變量和futex，
+  //! 省掉了std::promise和std::future共享狀態的堆分配；
+  //! 基類按需創建的取消令牌等狀態仍可能分配內存
+  template <typename ArgumentType, typename ResultType>
+  class pooled_task final : public base_task {
+    static_assert(!std::is_same_v<ResultType, void>);
+
+  public:
+    explicit pooled_task(ArgumentType argument_)
+        : argument{std::move(argument_)} {}
+    ~pooled_task() override = default;
+
+    static std::shared_ptr<pooled_task> create(ArgumentType argument) {
+      return std::allocate_shared<pooled_task>(pool_allocator<pooled_task>(),
+                                               std::move(argument));
+    }
+
+    auto const &get_argument() const { return argument; }
+
+    //! \brief 由處理器設置結果並喚醒等待者，只能調用一次
+    void set_result(ResultType result) {
+      result_opt.emplace(std::move(result));
+      done.store(1, std::memory_order_release);
+      // 與_wait_done中先登記再等待配對，沒有等待者時不進入內核
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiters.load(std::memory_order_relaxed) != 0) {
+        cyy::naive_lib::atomic_notify_all(done);
+      }
+    }
+
+    //! \brief 等待並返回結果，任務未完成時返回空
+    auto const &get_result(const std::chrono::milliseconds &timeout =
+                               std::chrono::milliseconds(1)) {
+      static const std::optional<ResultType> empty_result;
+      if (!this->wait_done(timeout)) {
+        return empty_result;
+      }
+      return result_opt;
+    }
+
+  protected:
+    bool _wait_done(const std::chrono::milliseconds &timeout) override {
+      if (done.load(std::memory_order_acquire) != 0) {
+        return true;
+      }
+      waiters.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto res = cyy::naive_lib::atomic_wait_for(done, 0, timeout);
+      waiters.fetch_sub(1, std::memory_order_relaxed);
+      return res;
+    }
+
+  private:
+    ArgumentType argument;
+    std::optional<ResultType> result_opt;
+    std::atomic<uint32_t> done{0};
+    //! \brief 正在等待done的綫程數
+    std::atomic<uint32_t> waiters{0};
+  };
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,44 @@
+/*!
+ * \file processor_placement.cpp
+ *
+ * \brief 按CPU拓撲放置處理器綫程
+ */
+
+#include "processor_placement.hpp"
+
+#include "hardware/topology.hpp"
+
+namespace cyy::naive_lib::task {
+
+  std::vector<size_t> placement_cpus(processor_placement placement,
+                                     size_t index) {
+    auto const &topology = cyy::naive_lib::hardware::cpu_topology::get();
+    switch (placement) {
+      case processor_placement::physical_core: {
+        auto cpus = topology.one_cpu_per_core();
+        if (cpus.empty()) {
+          return {};
+        }
+        return {cpus[index % cpus.size()]};
+      }
+      case processor_placement::numa_node: {
+        auto nodes = topology.nodes();
+        if (nodes.empty()) {
+          return {};
+        }
+        return topology.cpus_of_node(nodes[index % nodes.size()]);
+      }
+      case processor_placement::none:
+        break;
+    }
+    return {};
+  }
+
+  size_t placement_node(const std::vector<size_t> &cpus) {
+    if (cpus.empty()) {
+      return 0;
+    }
+    return cyy::naive_lib::hardware::cpu_topology::get().node_of_cpu(
+        cpus.front());
+  }
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,28 @@
+/*!
+ * \file processor_placement.hpp
+ *
+ * \brief 按CPU拓撲放置處理器綫程
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 處理器綫程的放置方式
+  enum class processor_placement : uint8_t {
+    none,          //!< 不綁定，由操作系統調度
+    physical_core, //!< 每個處理器獨佔一個物理核，先排滿一個NUMA節點再到下一個
+    numa_node,     //!< 處理器輪流綁定到各NUMA節點的全部cpu上
+  };
+
+  //! \brief 第index個處理器應綁定的cpu
+  //! \return 空表示不綁定
+  std::vector<size_t> placement_cpus(processor_placement placement,
+                                     size_t index);
+
+  //! \brief cpu集合所在的NUMA節點，取第一個cpu的節點，空集合返回0
+  size_t placement_node(const std::vector<size_t> &cpus);
+} // namespace cyy::naive_lib::task
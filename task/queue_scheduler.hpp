@@ -8,17 +8,27 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
-#include <cyy/algorithm/thread_safe_container.hpp>
-
 #include "base_processor.hpp"
 #include "base_scheduler.hpp"
+#include "metrics.hpp"
+#include "processor_placement.hpp"
+#include "task_queue.hpp"
+#include "util/runnable.hpp"
 
 namespace cyy::naive_lib::task {
 
@@ -27,6 +37,20 @@ namespace cyy::naive_lib::task {
   public:
     using processor_factory = std::function<std::unique_ptr<base_processor>()>;
 
+    //! \brief 自動伸縮的參數
+    struct autoscaling_config {
+      //! \brief 創建新processor的工廠
+      processor_factory factory;
+      size_t min_processors{1};
+      size_t max_processors{1};
+      //! \brief 最早的任務等待超過此時間時增加一個processor
+      std::chrono::milliseconds scale_up_wait{50};
+      //! \brief processor空閒超過此時間且數量多於最小值時退役
+      std::chrono::milliseconds idle_timeout{30000};
+      //! \brief 檢查隊列壓力的間隔
+      std::chrono::milliseconds check_interval{100};
+    };
+
   public:
     queue_scheduler() = default;
     queue_scheduler(const queue_scheduler &) = delete;
@@ -39,7 +63,9 @@ namespace cyy::naive_lib::task {
     }
 
     void replace_processor(const std::vector<processor_factory> &makers) {
+      std::lock_guard replace_lk(replace_mutex);
       std::unique_lock<std::mutex> lk(processor_mutex);
+      release_placement_slots(processors);
       processors = make_processors(makers);
     }
 
@@ -52,6 +78,167 @@ namespace cyy::naive_lib::task {
       return;
     }
 
+    //! \brief 滾動替換processor，替換期間不中斷服務
+    //! \details 先啓動新processor並等待預熱完成，再讓它們加入取任務；
+    //! 舊processor繼續處理隊列中只有它們能接受的任務（例如舊模型版本的任務），
+    //! 這些任務處理完或超過drain_timeout後，舊processor處理完手中的批次再退役。
+    //! 只有替換期間隊列按processor的accepts分配任務，之後剩下的沒有processor接受的任務標記作廢
+    //! \param warm_up_timeout 等待新processor預熱的時間，超時則放棄替換，保留舊processor
+    //! \param drain_timeout 等待舊processor清空積壓任務的最長時間
+    //! \return 是否完成替換
+    bool rolling_replace_processor(
+        const std::vector<processor_factory> &makers,
+        const std::chrono::milliseconds &warm_up_timeout,
+        const std::chrono::milliseconds &drain_timeout) {
+      std::lock_guard replace_lk(replace_mutex);
+      // 新舊processor並存時按accepts分配，舊processor不會取走新版本的任務
+      queue.set_selective(true);
+      processor_list_type new_processors;
+      {
+        std::unique_lock<std::mutex> lk(processor_mutex);
+        new_processors = make_processors(makers);
+        for (auto const &processor : new_processors) {
+          warming_processors.push_back(processor.get());
+        }
+      }
+      bool ready = true;
+      auto warm_up_deadline = std::chrono::steady_clock::now() + warm_up_timeout;
+      for (auto const &processor : new_processors) {
+        auto left = warm_up_deadline - std::chrono::steady_clock::now();
+        if (!processor->wait_ready(
+                std::chrono::ceil<std::chrono::milliseconds>(left))) {
+          ready = false;
+          break;
+        }
+      }
+
+      processor_list_type retired;
+      if (ready) {
+        std::vector<const base_processor *> old_processors;
+        std::vector<const base_processor *> fresh_processors;
+        {
+          std::unique_lock<std::mutex> lk(processor_mutex);
+          warming_processors.clear();
+          for (auto const &processor : processors) {
+            old_processors.push_back(processor.get());
+          }
+          for (auto &processor : new_processors) {
+            fresh_processors.push_back(processor.get());
+            processors.emplace_back(std::move(processor));
+          }
+        }
+
+        // 只有舊processor能處理的任務留給它們處理完，持有replace_mutex時processor不會被移除
+        queue.wait_none_of(
+            [&](const base_task &task) {
+              return std::ranges::any_of(old_processors,
+                                         [&task](auto const *p) {
+                                           return p->accepts(task);
+                                         }) &&
+                     std::ranges::none_of(fresh_processors,
+                                          [&task](auto const *p) {
+                                            return p->accepts(task);
+                                          });
+            },
+            std::chrono::steady_clock::now() + drain_timeout);
+
+        std::unique_lock<std::mutex> lk(processor_mutex);
+        for (auto it = processors.begin(); it != processors.end();) {
+          if (std::ranges::find(old_processors, it->get()) !=
+              old_processors.end()) {
+            retired.emplace_back(std::move(*it));
+            it = processors.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        release_placement_slots(retired);
+      } else {
+        std::unique_lock<std::mutex> lk(processor_mutex);
+        warming_processors.clear();
+        retired = std::move(new_processors);
+        release_placement_slots(retired);
+      }
+      // 在鎖外析構，等待退役的processor處理完手中的批次；析構之前它們仍然按accepts取任務
+      retired.clear();
+
+      std::vector<std::shared_ptr<base_task>> unroutable;
+      {
+        std::unique_lock admission_lk(admission_mutex);
+        std::unique_lock<std::mutex> lk(processor_mutex);
+        unroutable = queue.remove_if(
+            [this](const base_task &task) { return !routable(task); });
+        queue.set_selective(false);
+      }
+      for (auto const &task : unroutable) {
+        task->mark_invalid();
+      }
+      return ready;
+    }
+
+    //! \brief 開啓自動伸縮，並立即補足min_processors個processor
+    //! \note 每次檢查最多增加或退役一個processor；退役的processor處理完手中的批次後才結束
+    void enable_autoscaling(autoscaling_config config) {
+      if (!config.factory) {
+        throw std::invalid_argument("autoscaling needs a processor factory");
+      }
+      config.max_processors =
+          std::max(config.max_processors, config.min_processors);
+      {
+        std::unique_lock<std::mutex> lk(processor_mutex);
+        if (autoscaling) {
+          throw std::runtime_error("autoscaling is already enabled");
+        }
+        while (processors.size() < config.min_processors) {
+          for (auto &processor : make_processors({config.factory})) {
+            processors.emplace_back(std::move(processor));
+          }
+        }
+        autoscaling_cfg = config;
+        // 在鎖內賦值，並發調用時只有一個能通過上面的檢查
+        autoscaling =
+            std::make_unique<autoscaler>(*this, config.check_interval);
+      }
+    }
+
+    size_t processor_num() {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      return processors.size();
+    }
+
+    //! \brief 設置之後創建的處理器的綫程放置方式，默認不綁定
+    void set_processor_placement(processor_placement placement_) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      placement = placement_;
+    }
+
+    //! \brief 設置任務出隊順序，默認先進先出
+    void set_queue_order(task_queue::order order) { queue.set_order(order); }
+
+    //! \brief 限制隊列長度
+    //! \param capacity 隊列容量，0表示不限制
+    //! \param policy 隊列滿時的處理方式，被拒絕或丟棄的任務會標記作廢
+    void set_queue_capacity(size_t capacity, task_queue::overflow_policy policy) {
+      queue.set_capacity(capacity, policy);
+    }
+
+    const queue_metrics &get_queue_metrics() const noexcept {
+      return queue.get_metrics();
+    }
+
+    //! \brief 輸出隊列和每個處理器的指標，處理器以processor標籤區分
+    void export_metrics(prometheus_writer &writer,
+                        const prometheus_writer::label_list &labels = {}) {
+      writer.add(queue.get_metrics(), "task_scheduler", labels);
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      for (size_t i = 0; i < processors.size(); i++) {
+        auto processor_labels = labels;
+        processor_labels.emplace_back("processor", std::to_string(i));
+        writer.add(processors[i]->get_metrics(), "task_processor",
+                   processor_labels);
+      }
+    }
+
     void foreach_processor(
         const std::function<bool(const base_processor *)> &call_back) {
       std::unique_lock<std::mutex> lk(processor_mutex);
@@ -61,36 +248,229 @@ namespace cyy::naive_lib::task {
       }
     }
 
-    //! \brief 調度任务
-    //! \param task 任務
-    //! \param timeout 任務處理超时时间
-    bool schedule(const std::shared_ptr<base_task> &task,
-                  const std::chrono::milliseconds &timeout) override {
-      queue.push_back(task);
-      return task->wait_done(timeout);
-    }
-
     ~queue_scheduler() override {
+      autoscaling.reset();
       // 我们必须在这边明确地把processors清理掉，这样做是为了处理完任务队列内积压的任务，避免内存泄露
       // 在这边不能依赖processors的析构函数，因为这样的话queue和processors的析构函数的顺序依赖于成员声明的位置，很容易在重构时跪掉
       processors.clear();
     }
 
+  protected:
+    //! \note 有processor只接受部分任務時，沒有processor接受的任務不入隊，直接標記作廢
+    void enqueue(const std::shared_ptr<base_task> &task) override {
+      if (!has_selective.load(std::memory_order_relaxed)) {
+        queue.push_back(task);
+        return;
+      }
+      std::shared_lock admission_lk(admission_mutex);
+      if (!routable_with_lock(*task)) {
+        admission_lk.unlock();
+        task->mark_invalid();
+        return;
+      }
+      queue.push_back(task);
+    }
+
+    bool try_enqueue(const std::shared_ptr<base_task> &task) override {
+      if (!has_selective.load(std::memory_order_relaxed)) {
+        return queue.try_push_back(task);
+      }
+      std::shared_lock admission_lk(admission_mutex);
+      return routable_with_lock(*task) && queue.try_push_back(task);
+    }
+
+    void
+    enqueue_batch(std::span<const std::shared_ptr<base_task>> tasks) override {
+      if (!has_selective.load(std::memory_order_relaxed)) {
+        queue.push_back(tasks);
+        return;
+      }
+      std::vector<std::shared_ptr<base_task>> routed;
+      std::vector<std::shared_ptr<base_task>> unroutable;
+      {
+        std::shared_lock admission_lk(admission_mutex);
+        {
+          std::unique_lock<std::mutex> lk(processor_mutex);
+          for (auto const &task : tasks) {
+            (routable(*task) ? routed : unroutable).emplace_back(task);
+          }
+        }
+        queue.push_back(routed);
+      }
+      for (auto const &task : unroutable) {
+        task->mark_invalid();
+      }
+    }
+
   private:
     using processor_list_type = std::vector<std::unique_ptr<base_processor>>;
 
+    //! \brief 定期檢查隊列壓力並伸縮processor的綫程
+    class autoscaler final : private cyy::naive_lib::runnable {
+    public:
+      autoscaler(queue_scheduler &scheduler_,
+                 const std::chrono::milliseconds &check_interval_)
+          : scheduler{scheduler_}, check_interval{check_interval_} {
+        start("autoscaler");
+      }
+
+      ~autoscaler() override {
+        stop([this]() {
+          {
+            std::lock_guard lk(mu);
+            stopped = true;
+          }
+          cv.notify_all();
+        });
+      }
+
+    private:
+      void run(const std::stop_token & /*st*/) override {
+        std::unique_lock lk(mu);
+        while (!needs_stop()) {
+          if (cv.wait_for(lk, check_interval, [this] { return stopped; })) {
+            return;
+          }
+          lk.unlock();
+          scheduler.autoscale_once();
+          lk.lock();
+        }
+      }
+
+      queue_scheduler &scheduler;
+      std::chrono::milliseconds check_interval;
+      std::mutex mu;
+      std::condition_variable cv;
+      bool stopped{false};
+    };
+
+    //! \brief 是否有processor（包括預熱中的）接受該任務，調用者持有processor_mutex
+    bool routable(const base_task &task) const {
+      auto accepts = [&task](auto const &processor) {
+        return processor->accepts(task);
+      };
+      return std::ranges::any_of(processors, accepts) ||
+             std::ranges::any_of(warming_processors, accepts);
+    }
+
+    bool routable_with_lock(const base_task &task) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      return routable(task);
+    }
+
+    //! \brief 隊列處於篩選模式時只取processor接受的任務
+    void set_selective_funcs(base_processor &processor) {
+      has_selective.store(true, std::memory_order_relaxed);
+      auto accept = [&processor](const base_task &task) {
+        return processor.accepts(task);
+      };
+      processor.set_get_task_func(
+          [this, accept](const std::chrono::milliseconds &timeout)
+              -> std::optional<std::shared_ptr<base_task>> {
+            std::vector<std::shared_ptr<base_task>> out;
+            if (queue.pop_up_to_if(out, 1,
+                                   std::chrono::steady_clock::now() + timeout,
+                                   accept) == 0) {
+              return {};
+            }
+            return std::move(out.front());
+          });
+      processor.set_get_tasks_func(
+          [this, accept](std::vector<std::shared_ptr<base_task>> &tasks,
+                         size_t n,
+                         const std::chrono::steady_clock::time_point &deadline) {
+            return queue.pop_up_to_if(tasks, n, deadline, accept);
+          });
+    }
+
+    void autoscale_once() {
+      // 滾動替換期間不伸縮，替換要求舊processor在排空前一直存在
+      std::unique_lock replace_lk(replace_mutex, std::try_to_lock);
+      if (!replace_lk.owns_lock()) {
+        return;
+      }
+      auto now = std::chrono::steady_clock::now();
+      auto wait = queue.oldest_wait(now);
+      processor_list_type retired;
+      {
+        std::unique_lock<std::mutex> lk(processor_mutex);
+        auto const &config = *autoscaling_cfg;
+        if (processors.size() < config.min_processors ||
+            (wait >= config.scale_up_wait &&
+             processors.size() < config.max_processors)) {
+          for (auto &processor : make_processors({config.factory})) {
+            processors.emplace_back(std::move(processor));
+          }
+        } else if (processors.size() > config.min_processors) {
+          // 只退役空閒最久的一個，負載回升時不至於一下子失去太多處理能力
+          auto it = std::ranges::min_element(
+              processors, {},
+              [](auto const &processor) {
+                return processor->is_processing()
+                           ? std::chrono::steady_clock::time_point::max()
+                           : processor->get_last_active_time();
+              });
+          if (!(*it)->is_processing() &&
+              now - (*it)->get_last_active_time() >= config.idle_timeout) {
+            retired.emplace_back(std::move(*it));
+            processors.erase(it);
+            release_placement_slots(retired);
+          }
+        }
+      }
+      // 在鎖外析構退役的processor，等待它處理完手中的批次
+      retired.clear();
+    }
+
+    //! \brief 佔用最小的空閒放置序號，用於決定綁定的cpu；退役processor的序號會被重用
+    //! \note 調用者持有processor_mutex
+    size_t acquire_placement_slot() {
+      auto it = std::ranges::find(placement_slot_used, false);
+      if (it == placement_slot_used.end()) {
+        placement_slot_used.push_back(true);
+        return placement_slot_used.size() - 1;
+      }
+      *it = true;
+      return static_cast<size_t>(it - placement_slot_used.begin());
+    }
+
+    //! \brief 歸還processor佔用的放置序號，調用者持有processor_mutex
+    void release_placement_slots(const processor_list_type &list) {
+      for (auto const &processor : list) {
+        auto node = placement_slots.extract(processor.get());
+        if (!node.empty()) {
+          placement_slot_used[node.mapped()] = false;
+        }
+      }
+    }
+
+    //! \note 調用者持有processor_mutex
     processor_list_type
     make_processors(const std::vector<processor_factory> &makers) {
       processor_list_type new_processors;
       // 先构造新的processor
       for (auto maker : makers) {
         auto tmp = maker();
-        tmp->set_get_task_func(
-            [this](const std::chrono::milliseconds &timeout) {
-              return queue.pop_front(timeout);
-            }
+        auto slot = acquire_placement_slot();
+        placement_slots.emplace(tmp.get(), slot);
+        if (placement != processor_placement::none) {
+          tmp->set_cpu_affinity(placement_cpus(placement, slot));
+        }
+        if (tmp->is_selective()) {
+          set_selective_funcs(*tmp);
+        } else {
+          tmp->set_get_task_func(
+              [this](const std::chrono::milliseconds &timeout) {
+                return queue.pop_front(timeout);
+              }
 
-        );
+          );
+          tmp->set_get_tasks_func(
+              [this](std::vector<std::shared_ptr<base_task>> &tasks, size_t n,
+                     const std::chrono::steady_clock::time_point &deadline) {
+                return queue.pop_up_to(tasks, n, deadline);
+              });
+        }
         new_processors.emplace_back(std::move(tmp));
       }
 
@@ -101,11 +481,23 @@ namespace cyy::naive_lib::task {
     }
 
   private:
-    cyy::algorithm::thread_safe_linear_container<
-        std::vector<std::shared_ptr<base_task>>>
-        queue;
+    task_queue queue;
 
     processor_list_type processors;
+    processor_placement placement{processor_placement::none};
+    //! \brief 每個processor佔用的放置序號
+    std::unordered_map<const base_processor *, size_t> placement_slots;
+    std::vector<bool> placement_slot_used;
+    std::optional<autoscaling_config> autoscaling_cfg;
     std::mutex processor_mutex;
+    //! \brief 滾動替換期間預熱中的processor，提交任務時也算作可以接受任務
+    std::vector<const base_processor *> warming_processors;
+    //! \brief 是否創建過只接受部分任務的processor，是的話提交時檢查任務能否被接受
+    std::atomic<bool> has_selective{false};
+    //! \brief 提交時共享持有，結束替換時獨佔持有，檢查和入隊之間替換不會結束
+    std::shared_mutex admission_mutex;
+    //! \brief 滾動替換期間持有，防止processor在替換過程中被移除
+    std::mutex replace_mutex;
+    std::unique_ptr<autoscaler> autoscaling;
   }; // class queue_scheduler
 } // namespace cyy::naive_lib::task
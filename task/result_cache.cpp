@@ -0,0 +1,60 @@
+/*!
+ * \file result_cache.cpp
+ *
+ * \brief 按參數緩存任務結果
+ */
+
+#include "result_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+namespace cyy::naive_lib::task {
+
+  namespace {
+    constexpr std::array<uint64_t, 4> seeds{
+        0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL,
+        0xd6e8feb86659fd93ULL};
+  } // namespace
+
+  frequency_sketch::frequency_sketch(size_t width_)
+      : mask{std::bit_ceil(std::max<size_t>(width_, 16)) - 1},
+        table(depth * (mask + 1), 0), sample_size{10 * (mask + 1)} {}
+
+  size_t frequency_sketch::index(uint64_t hash, size_t row) const noexcept {
+    auto h = (hash + seeds[row]) * seeds[(row + 1) % depth];
+    h ^= h >> 32;
+    return row * (mask + 1) + static_cast<size_t>(h & mask);
+  }
+
+  void frequency_sketch::increment(uint64_t hash) noexcept {
+    bool added = false;
+    for (size_t row = 0; row < depth; row++) {
+      auto &c = table[index(hash, row)];
+      if (c < max_count) {
+        c++;
+        added = true;
+      }
+    }
+    if (added && ++additions >= sample_size) {
+      reset();
+    }
+  }
+
+  uint32_t frequency_sketch::estimate(uint64_t hash) const noexcept {
+    uint32_t res = max_count;
+    for (size_t row = 0; row < depth; row++) {
+      res = std::min<uint32_t>(res, table[index(hash, row)]);
+    }
+    return res;
+  }
+
+  //! \brief 所有計數減半，讓頻率反映最近的訪問
+  void frequency_sketch::reset() noexcept {
+    for (auto &c : table) {
+      c /= 2;
+    }
+    additions /= 2;
+  }
+} // namespace cyy::naive_lib::task
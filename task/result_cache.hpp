@@ -0,0 +1,232 @@
+/*!
+ * \file result_cache.hpp
+ *
+ * \brief 按參數緩存任務結果
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "metrics.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 4行的Count-Min計數器，估計鍵最近的訪問頻率
+  //! \note 計數達到上限後全部減半，舊的熱點逐漸冷卻；不是綫程安全的
+  class frequency_sketch {
+  public:
+    explicit frequency_sketch(size_t width_);
+
+    void increment(uint64_t hash) noexcept;
+    uint32_t estimate(uint64_t hash) const noexcept;
+
+  private:
+    static constexpr size_t depth = 4;
+    static constexpr uint8_t max_count = 15;
+
+    size_t index(uint64_t hash, size_t row) const noexcept;
+    void reset() noexcept;
+
+    size_t mask;
+    std::vector<uint8_t> table;
+    size_t additions{0};
+    size_t sample_size;
+  };
+
+  //! \brief 分片的結果緩存：LRU淘汰，TinyLFU准入，每個結果有自己的TTL，總大小有上限
+  //! \note 每個分片有自己的鎖，鍵按哈希分到分片上
+  template <typename KeyType, typename ValueType,
+            typename Hash = std::hash<KeyType>,
+            typename KeyEqual = std::equal_to<KeyType>>
+  class result_cache {
+  public:
+    //! \brief 估計一條緩存佔用的字節數
+    using size_func_type =
+        std::function<size_t(const KeyType &, const ValueType &)>;
+
+    struct config {
+      //! \brief 所有分片合計的字節上限
+      size_t byte_budget{64 * 1024 * 1024};
+      size_t shard_num{16};
+      //! \brief put沒有指定TTL時使用
+      std::chrono::milliseconds default_ttl{std::chrono::minutes(1)};
+      //! \brief 新結果的訪問頻率不高於將被淘汰的結果時不放入，防止一次性的鍵沖掉熱點
+      bool frequency_admission{true};
+      //! \brief 每個分片的頻率計數器寬度
+      size_t sketch_width{4096};
+    };
+
+    explicit result_cache(
+        const config &conf_ = {},
+        size_func_type size_func_ = [](const KeyType &, const ValueType &) {
+          return sizeof(KeyType) + sizeof(ValueType);
+        })
+        : conf{conf_}, size_func{std::move(size_func_)} {
+      if (conf.shard_num == 0) {
+        throw std::invalid_argument("shard_num must be positive");
+      }
+      shard_budget = conf.byte_budget / conf.shard_num;
+      shards.reserve(conf.shard_num);
+      for (size_t i = 0; i < conf.shard_num; i++) {
+        shards.emplace_back(std::make_unique<shard>(conf.sketch_width));
+      }
+    }
+
+    //! \brief 查找沒有過期的結果，命中時移到LRU的頭部
+    std::optional<ValueType> get(const KeyType &key) {
+      auto hash = hasher(key);
+      auto &s = get_shard(hash);
+      auto now = std::chrono::steady_clock::now();
+      std::lock_guard lk(s.mu);
+      s.sketch.increment(hash);
+      auto it = s.index.find(key);
+      if (it == s.index.end()) {
+        metrics.misses.add();
+        return {};
+      }
+      auto entry_it = it->second;
+      if (entry_it->expiry <= now) {
+        remove(s, entry_it);
+        metrics.expirations.add();
+        metrics.misses.add();
+        return {};
+      }
+      s.lru.splice(s.lru.begin(), s.lru, entry_it);
+      metrics.hits.add();
+      return entry_it->value;
+    }
+
+    //! \brief 放入結果，已有的同鍵結果被替換
+    //! \param ttl 為空時使用default_ttl
+    //! \return 結果超過分片的預算或未被准入時返回false
+    bool put(const KeyType &key, ValueType value,
+             std::optional<std::chrono::milliseconds> ttl = {}) {
+      auto bytes = size_func(key, value);
+      auto hash = hasher(key);
+      auto &s = get_shard(hash);
+      auto now = std::chrono::steady_clock::now();
+      auto expiry = now + ttl.value_or(conf.default_ttl);
+      std::lock_guard lk(s.mu);
+      if (bytes > shard_budget) {
+        metrics.rejections.add();
+        return false;
+      }
+      if (auto it = s.index.find(key); it != s.index.end()) {
+        remove(s, it->second);
+      }
+      // 先清掉LRU尾部已過期的結果，它們不參與准入比較
+      while (!s.lru.empty() && s.lru.back().expiry <= now) {
+        remove(s, std::prev(s.lru.end()));
+        metrics.expirations.add();
+      }
+      if (s.bytes + bytes > shard_budget) {
+        if (conf.frequency_admission &&
+            s.sketch.estimate(hash) <=
+                s.sketch.estimate(hasher(s.lru.back().key))) {
+          metrics.rejections.add();
+          return false;
+        }
+        while (s.bytes + bytes > shard_budget) {
+          remove(s, std::prev(s.lru.end()));
+          metrics.evictions.add();
+        }
+      }
+      s.lru.emplace_front(key, std::move(value), expiry, bytes);
+      s.index.emplace(key, s.lru.begin());
+      s.bytes += bytes;
+      metrics.insertions.add();
+      metrics.entries.add(1);
+      metrics.bytes.add(static_cast<int64_t>(bytes));
+      return true;
+    }
+
+    bool erase(const KeyType &key) {
+      auto &s = get_shard(hasher(key));
+      std::lock_guard lk(s.mu);
+      auto it = s.index.find(key);
+      if (it == s.index.end()) {
+        return false;
+      }
+      remove(s, it->second);
+      return true;
+    }
+
+    void clear() {
+      for (auto &s : shards) {
+        std::lock_guard lk(s->mu);
+        while (!s->lru.empty()) {
+          remove(*s, s->lru.begin());
+        }
+      }
+    }
+
+    size_t size() const {
+      return static_cast<size_t>(metrics.entries.get());
+    }
+    size_t byte_size() const {
+      return static_cast<size_t>(metrics.bytes.get());
+    }
+
+    const cache_metrics &get_metrics() const noexcept { return metrics; }
+
+  private:
+    struct entry {
+      entry(KeyType key_, ValueType value_,
+            std::chrono::steady_clock::time_point expiry_, size_t bytes_)
+          : key{std::move(key_)}, value{std::move(value_)}, expiry{expiry_},
+            bytes{bytes_} {}
+      KeyType key;
+      ValueType value;
+      std::chrono::steady_clock::time_point expiry;
+      size_t bytes;
+    };
+    using entry_list = std::list<entry>;
+
+    struct shard {
+      explicit shard(size_t sketch_width) : sketch(sketch_width) {}
+      std::mutex mu;
+      //! \brief 頭部是最近使用的結果
+      entry_list lru;
+      std::unordered_map<KeyType, typename entry_list::iterator, Hash,
+                         KeyEqual>
+          index;
+      frequency_sketch sketch;
+      size_t bytes{0};
+    };
+
+    uint64_t hasher(const KeyType &key) const {
+      // 標準庫的整數哈希是恆等函數，打散後再分片
+      auto h = static_cast<uint64_t>(Hash{}(key));
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      return h;
+    }
+
+    shard &get_shard(uint64_t hash) { return *shards[hash % shards.size()]; }
+
+    void remove(shard &s, typename entry_list::iterator it) {
+      s.bytes -= it->bytes;
+      metrics.entries.add(-1);
+      metrics.bytes.add(-static_cast<int64_t>(it->bytes));
+      s.index.erase(it->key);
+      s.lru.erase(it);
+    }
+
+    config conf;
+    size_func_type size_func;
+    size_t shard_budget{0};
+    std::vector<std::unique_ptr<shard>> shards;
+    cache_metrics metrics;
+  };
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,269 @@
+/*!
+ * \file routing_scheduler.hpp
+ *
+ * \brief 按鍵把任務分到多個隊列的调度器
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "base_processor.hpp"
+#include "base_scheduler.hpp"
+#include "metrics.hpp"
+#include "neural_network_task.hpp"
+#include "task_queue.hpp"
+#include "util/atomic_wait.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 按鍵把任務放入不同的隊列，processor只訂閱自己處理的鍵
+  //! \note 每個批次只從一個隊列中取任務，批次內的任務鍵相同。
+  //! 沒有processor訂閱的鍵不建隊列，這些任務在提交時被拒絕，所以要先添加processor再提交
+  class routing_scheduler : public base_scheduler {
+  public:
+    using key_type = std::string;
+    using key_func_type = std::function<key_type(const base_task &)>;
+    using processor_factory = std::function<std::unique_ptr<base_processor>()>;
+
+  public:
+    //! \param key_func_ 計算任務的鍵，默認用神经网络任务的模型版本
+    explicit routing_scheduler(key_func_type key_func_ = model_version_key)
+        : key_func{std::move(key_func_)} {}
+    routing_scheduler(const routing_scheduler &) = delete;
+    routing_scheduler &operator=(const routing_scheduler &) = delete;
+    routing_scheduler(routing_scheduler &&) = delete;
+    routing_scheduler &operator=(routing_scheduler &&) = delete;
+
+    ~routing_scheduler() override {
+      // 與queue_scheduler相同，明確地先清理processors，不依賴成員的析構順序
+      processors.clear();
+    }
+
+    //! \brief 神经网络任务的模型版本，其它任務為空
+    static key_type model_version_key(const base_task &task) {
+      auto const *nn_task = dynamic_cast<const neural_network_task_base *>(&task);
+      if (nn_task == nullptr) {
+        return {};
+      }
+      return nn_task->model_version;
+    }
+
+    //! \brief 添加processor並訂閱keys對應的隊列
+    //! \param keys 為空時訂閱所有的鍵，包括之後出現的鍵
+    void add_processor(const std::vector<processor_factory> &makers,
+                       const std::vector<key_type> &keys) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      for (auto const &maker : makers) {
+        auto processor = maker();
+        auto sub = std::make_unique<subscription>();
+        {
+          std::unique_lock route_lk(route_mutex);
+          if (keys.empty()) {
+            wildcard_subscriptions.push_back(sub.get());
+            for (auto &[_, r] : routes) {
+              subscribe(*sub, *r);
+            }
+          } else {
+            for (auto const &key : keys) {
+              subscribe(*sub, get_route_locked(key));
+            }
+          }
+        }
+        processor->set_get_tasks_func(
+            [this, sub = sub.get()](
+                std::vector<std::shared_ptr<base_task>> &tasks, size_t n,
+                const std::chrono::steady_clock::time_point &deadline) {
+              return get_tasks(*sub, tasks, n, deadline);
+            });
+        processor->start();
+        subscriptions.emplace_back(std::move(sub));
+        processors.emplace_back(std::move(processor));
+      }
+    }
+
+    //! \brief 輸出每個隊列和每個處理器的指標，隊列以key標籤區分
+    void export_metrics(prometheus_writer &writer,
+                        const prometheus_writer::label_list &labels = {}) {
+      {
+        std::shared_lock route_lk(route_mutex);
+        for (auto const &[key, r] : routes) {
+          auto route_labels = labels;
+          route_labels.emplace_back("key", key);
+          writer.add(r->queue.get_metrics(), "task_scheduler", route_labels);
+        }
+      }
+      writer.add_counter("task_scheduler_unrouted_tasks_total",
+                         "Tasks rejected because no processor subscribes "
+                         "to their key",
+                         labels, unrouted_tasks.get());
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      for (size_t i = 0; i < processors.size(); i++) {
+        auto processor_labels = labels;
+        processor_labels.emplace_back("processor", std::to_string(i));
+        writer.add(processors[i]->get_metrics(), "task_processor",
+                   processor_labels);
+      }
+    }
+
+    void foreach_processor(
+        const std::function<bool(const base_processor *)> &call_back) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      for (const auto &processor : processors) {
+        if (call_back(processor.get()))
+          break;
+      }
+    }
+
+  protected:
+    //! \note 沒有processor訂閱任務的鍵時標記作廢，否則任務會永遠留在隊列中
+    void enqueue(const std::shared_ptr<base_task> &task) override {
+      auto *r = find_route(key_func(*task));
+      if (r == nullptr) {
+        unrouted_tasks.add();
+        task->mark_invalid();
+        return;
+      }
+      r->queue.push_back(task);
+      wake_subscribers(*r);
+    }
+
+    bool try_enqueue(const std::shared_ptr<base_task> &task) override {
+      auto *r = find_route(key_func(*task));
+      if (r == nullptr) {
+        unrouted_tasks.add();
+        return false;
+      }
+      if (!r->queue.try_push_back(task)) {
+        return false;
+      }
+      wake_subscribers(*r);
+      return true;
+    }
+
+  private:
+    struct subscription;
+
+    //! \brief 一個鍵對應的隊列及其訂閱者
+    struct route {
+      task_queue queue;
+      //! \brief 受route_mutex保護
+      std::vector<subscription *> subscribers;
+    };
+
+    //! \brief 一個processor訂閱的隊列
+    struct subscription {
+      //! \brief 受route_mutex保護
+      std::vector<route *> routes;
+      //! \brief 訂閱的隊列有新任務時遞增，processor在上面等待
+      std::atomic<uint32_t> epoch{0};
+      std::atomic<bool> waiting{false};
+      //! \brief 以下只由processor綫程訪問
+      size_t next_route{0};
+      route *current_route{nullptr};
+    };
+
+    static void subscribe(subscription &sub, route &r) {
+      sub.routes.push_back(&r);
+      r.subscribers.push_back(&sub);
+    }
+
+    //! \brief 找到鍵對應的隊列，有通配訂閱者時為新的鍵建隊列
+    //! \return 沒有processor訂閱該鍵時返回空
+    //! \note 隊列只在有訂閱者時創建，訂閱不會取消，所以隊列不會變成無人處理，也不需要刪除
+    route *find_route(const key_type &key) {
+      {
+        std::shared_lock lk(route_mutex);
+        if (auto it = routes.find(key); it != routes.end()) {
+          return it->second.get();
+        }
+        if (wildcard_subscriptions.empty()) {
+          return nullptr;
+        }
+      }
+      std::unique_lock lk(route_mutex);
+      return &get_route_locked(key);
+    }
+
+    //! \note 調用者需獨佔route_mutex
+    route &get_route_locked(const key_type &key) {
+      auto [it, inserted] = routes.try_emplace(key);
+      if (inserted) {
+        it->second = std::make_unique<route>();
+        for (auto *sub : wildcard_subscriptions) {
+          subscribe(*sub, *it->second);
+        }
+      }
+      return *it->second;
+    }
+
+    void wake_subscribers(route &r) {
+      std::shared_lock lk(route_mutex);
+      for (auto *sub : r.subscribers) {
+        // 與get_tasks中先置waiting再讀epoch配對，保證不會錯過喚醒
+        sub->epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (sub->waiting.load(std::memory_order_seq_cst)) {
+          cyy::naive_lib::atomic_notify_one(sub->epoch);
+        }
+      }
+    }
+
+    //! \brief 批次的第一個任務從訂閱的隊列中輪流選取，之後只從同一隊列湊批
+    size_t get_tasks(subscription &sub,
+                     std::vector<std::shared_ptr<base_task>> &tasks, size_t n,
+                     const std::chrono::steady_clock::time_point &deadline) {
+      if (!tasks.empty() && sub.current_route != nullptr) {
+        return sub.current_route->queue.pop_up_to(tasks, n, deadline);
+      }
+      while (true) {
+        auto epoch = sub.epoch.load(std::memory_order_seq_cst);
+        {
+          std::shared_lock lk(route_mutex);
+          auto route_num = sub.routes.size();
+          for (size_t i = 0; i < route_num; i++) {
+            auto idx = (sub.next_route + i) % route_num;
+            auto *r = sub.routes[idx];
+            // 截止時間已過，不等待
+            auto cnt = r->queue.pop_up_to(tasks, n, {});
+            if (cnt != 0) {
+              sub.next_route = idx + 1;
+              sub.current_route = r;
+              return cnt;
+            }
+          }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+          return 0;
+        }
+        sub.waiting.store(true, std::memory_order_seq_cst);
+        if (sub.epoch.load(std::memory_order_seq_cst) == epoch) {
+          cyy::naive_lib::atomic_wait_for(sub.epoch, epoch, deadline - now);
+        }
+        sub.waiting.store(false, std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    key_func_type key_func;
+
+    std::shared_mutex route_mutex;
+    std::map<key_type, std::unique_ptr<route>, std::less<>> routes;
+    std::vector<subscription *> wildcard_subscriptions;
+    //! \brief 沒有processor訂閱而被拒絕的任務數
+    counter unrouted_tasks;
+
+    std::vector<std::unique_ptr<subscription>> subscriptions;
+    std::vector<std::unique_ptr<base_processor>> processors;
+    std::mutex processor_mutex;
+  }; // class routing_scheduler
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,72 @@
+/*!
+ * \file task_handle.hpp
+ *
+ * \brief 已提交任务的句柄
+ */
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <memory>
+
+#include "base_task.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief submit返回的句柄，通過任務的result_promise等待結果
+  template <typename TaskType> class task_handle {
+  public:
+    explicit task_handle(std::shared_ptr<TaskType> task_)
+        : task{std::move(task_)} {}
+
+    bool wait_done(const std::chrono::milliseconds &timeout) {
+      return task->wait_done(timeout);
+    }
+
+    auto const &get_result(const std::chrono::milliseconds &timeout =
+                               std::chrono::milliseconds(1))
+      requires requires(TaskType &t) { t.get_result(timeout); }
+    {
+      return task->get_result(timeout);
+    }
+
+    const std::shared_ptr<TaskType> &get_task() const { return task; }
+
+    //! \brief 不再需要結果時取消任務
+    void cancel() { task->cancel(); }
+
+    //! \brief 在協程中等待任務處理完，不佔用綫程
+    //! \note 協程在處理器綫程上恢復執行；結果為任務是否處理成功
+    auto operator co_await() const noexcept { return awaiter(task); }
+
+  private:
+    class awaiter : private base_task::done_callback {
+    public:
+      explicit awaiter(std::shared_ptr<TaskType> task_) noexcept
+          : task{std::move(task_)} {
+        func = &resume;
+      }
+      awaiter(const awaiter &) = delete;
+      awaiter &operator=(const awaiter &) = delete;
+
+      bool await_ready() const noexcept { return !task->can_process(); }
+      bool await_suspend(std::coroutine_handle<> handle_) noexcept {
+        handle = handle_;
+        return task->add_done_callback(*this);
+      }
+      bool await_resume() {
+        return task->wait_done(std::chrono::milliseconds(0));
+      }
+
+    private:
+      static void resume(base_task::done_callback &callback) noexcept {
+        static_cast<awaiter &>(callback).handle.resume();
+      }
+
+      std::shared_ptr<TaskType> task;
+      std::coroutine_handle<> handle;
+    };
+
+    std::shared_ptr<TaskType> task;
+  };
+} // namespace cyy::naive_lib::task
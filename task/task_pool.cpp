@@ -0,0 +1,64 @@
+/*!
+ * \file task_pool.cpp
+ *
+ * \brief 任務對象的定長內存池
+ */
+
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <new>
+
+namespace cyy::naive_lib::task {
+
+  block_pool::block_pool(size_t block_size_, size_t block_alignment_)
+      : block_alignment{std::max(block_alignment_, alignof(free_block))} {
+    block_size = std::max(block_size_, sizeof(free_block));
+    // 塊大小取對齊的整數倍，保證塊組內每個塊都對齊
+    block_size = (block_size + block_alignment - 1) / block_alignment *
+                 block_alignment;
+  }
+
+  block_pool::~block_pool() {
+    for (auto *chunk : chunks) {
+      ::operator delete(chunk, std::align_val_t(block_alignment));
+    }
+  }
+
+  void *block_pool::allocate() {
+    std::lock_guard lk(mu);
+    if (free_list == nullptr) {
+      grow();
+    }
+    auto *block = free_list;
+    free_list = block->next;
+    return block;
+  }
+
+  void block_pool::deallocate(void *block) noexcept {
+    auto *node = ::new (block) free_block{};
+    std::lock_guard lk(mu);
+    node->next = free_list;
+    free_list = node;
+  }
+
+  size_t block_pool::capacity() const {
+    std::lock_guard lk(mu);
+    return block_num;
+  }
+
+  //! \note 調用者需持有mu
+  void block_pool::grow() {
+    auto *chunk = static_cast<std::byte *>(::operator new(
+        block_size * chunk_block_num, std::align_val_t(block_alignment)));
+    chunks.push_back(chunk);
+    block_num += chunk_block_num;
+    for (size_t i = chunk_block_num; i > 0; i--) {
+      auto *node = ::new (chunk + (i - 1) * block_size) free_block{};
+      node->next = free_list;
+      free_list = node;
+    }
+    // 塊組逐次加倍，減少向系統申請的次數
+    chunk_block_num = std::min<size_t>(chunk_block_num * 2, 4096);
+  }
+} // namespace cyy::naive_lib::task
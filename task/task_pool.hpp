@@ -0,0 +1,86 @@
+/*!
+ * \file task_pool.hpp
+ *
+ * \brief 任務對象的定長內存池
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 定長內存塊池，空閒塊串成鏈表，由互斥量保護
+  //! \note 內存按塊組向系統申請，只回收到池中，不歸還給系統
+  class block_pool final {
+  public:
+    block_pool(size_t block_size_, size_t block_alignment_);
+    block_pool(const block_pool &) = delete;
+    block_pool &operator=(const block_pool &) = delete;
+    ~block_pool();
+
+    [[nodiscard]] void *allocate();
+    void deallocate(void *block) noexcept;
+
+    //! \brief 已向系統申請的塊數
+    [[nodiscard]] size_t capacity() const;
+
+    //! \brief 按塊大小和對齊共享的池，永不析構，避免靜態對象析構順序問題
+    template <size_t block_size, size_t block_alignment>
+    static block_pool &instance() {
+      static auto *pool = new block_pool(block_size, block_alignment);
+      return *pool;
+    }
+
+  private:
+    struct free_block {
+      free_block *next;
+    };
+    void grow();
+
+    size_t block_size;
+    size_t block_alignment;
+    size_t chunk_block_num{64};
+    size_t block_num{0};
+    mutable std::mutex mu;
+    free_block *free_list{nullptr};
+    std::vector<void *> chunks;
+  };
+
+  //! \brief 從block_pool分配單個對象的分配器，可用於std::allocate_shared，
+  //! 控制塊和對象一起放在池中的一個塊裡
+  template <typename T> class pool_allocator {
+  public:
+    using value_type = T;
+
+    pool_allocator() noexcept = default;
+    template <typename U>
+    explicit(false) pool_allocator(const pool_allocator<U> & /*unused*/) noexcept {}
+
+    [[nodiscard]] T *allocate(size_t n) {
+      if (n != 1) {
+        return std::allocator<T>().allocate(n);
+      }
+      return static_cast<T *>(pool().allocate());
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+      if (n != 1) {
+        std::allocator<T>().deallocate(p, n);
+        return;
+      }
+      pool().deallocate(p);
+    }
+
+    static block_pool &pool() {
+      return block_pool::instance<sizeof(T), alignof(T)>();
+    }
+
+    template <typename U>
+    bool operator==(const pool_allocator<U> & /*unused*/) const noexcept {
+      return true;
+    }
+  };
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,522 @@
+/*!
+ * \file task_queue.hpp
+ *
+ * \brief 调度器内部使用的任务队列
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "base_task.hpp"
+#include "metrics.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 加鎖的任务队列，支持一次加鎖放入多個任务
+  //! \note 過期或已作廢的任務在出隊時直接丟棄，不佔用批次的位置。
+  //! 作廢會觸發完成回調，所以只在釋放鎖之後才標記任務作廢
+  class task_queue {
+  public:
+    //! \brief 出隊順序
+    enum class order : uint8_t {
+      fifo,                    //!< 先進先出
+      earliest_deadline_first, //!< 截止時間早的先出，其次看優先級
+    };
+
+    //! \brief 隊列滿時的處理方式
+    enum class overflow_policy : uint8_t {
+      block,                //!< 阻塞生產者，最多等到任務的截止時間
+      reject,               //!< 拒絕新任務
+      drop_oldest,          //!< 丟棄最早入隊的任務
+      drop_lowest_priority, //!< 丟棄優先級最低的任務，新任務最低時拒絕新任務
+    };
+
+    task_queue() = default;
+    task_queue(const task_queue &) = delete;
+    task_queue &operator=(const task_queue &) = delete;
+
+    void set_order(order order_) {
+      std::lock_guard lk(mu);
+      if (queue_order == order_) {
+        return;
+      }
+      queue_order = order_;
+      if (queue_order == order::earliest_deadline_first) {
+        std::ranges::make_heap(entries, later);
+      } else {
+        std::ranges::sort(entries, {}, &entry::seq);
+      }
+    }
+
+    //! \brief 設置容量，0表示不限制
+    void set_capacity(size_t capacity_, overflow_policy policy_) {
+      {
+        std::lock_guard lk(mu);
+        capacity = capacity_;
+        policy = policy_;
+      }
+      not_full_cv.notify_all();
+    }
+
+    //! \brief 放入任務，被拒絕或被丟棄的任務都會標記作廢
+    //! \return 任務是否進入隊列
+    bool push_back(const std::shared_ptr<base_task> &task) {
+      bool res = false;
+      std::vector<std::shared_ptr<base_task>> invalidated;
+      {
+        std::unique_lock lk(mu);
+        res = push_with_policy(lk, task, true, invalidated);
+      }
+      invalidate(invalidated);
+      if (res) {
+        notify_consumers(1);
+      }
+      return res;
+    }
+
+    //! \brief 不阻塞地放入任務，被拒絕時不修改任務狀態
+    //! \return 任務是否進入隊列
+    bool try_push_back(const std::shared_ptr<base_task> &task) {
+      bool res = false;
+      std::vector<std::shared_ptr<base_task>> invalidated;
+      {
+        std::unique_lock lk(mu);
+        res = push_with_policy(lk, task, false, invalidated);
+      }
+      invalidate(invalidated);
+      if (res) {
+        notify_consumers(1);
+      }
+      return res;
+    }
+
+    //! \return 進入隊列的任務數
+    size_t push_back(std::span<const std::shared_ptr<base_task>> new_tasks) {
+      size_t cnt = 0;
+      std::vector<std::shared_ptr<base_task>> invalidated;
+      {
+        std::unique_lock lk(mu);
+        for (auto const &task : new_tasks) {
+          if (push_with_policy(lk, task, true, invalidated)) {
+            cnt++;
+          }
+        }
+      }
+      invalidate(invalidated);
+      notify_consumers(cnt);
+      return cnt;
+    }
+
+    std::optional<std::shared_ptr<base_task>>
+    pop_front(const std::chrono::milliseconds &timeout) {
+      std::vector<std::shared_ptr<base_task>> out;
+      if (pop_up_to(out, 1, std::chrono::steady_clock::now() + timeout) == 0) {
+        return {};
+      }
+      return std::move(out.front());
+    }
+
+    //! \brief 一次加鎖取出最多n個任務追加到out末尾
+    //! \note 隊列為空時最多等到deadline
+    //! \return 取出的任務數
+    size_t pop_up_to(std::vector<std::shared_ptr<base_task>> &out, size_t n,
+                     const std::chrono::steady_clock::time_point &deadline) {
+      std::vector<std::shared_ptr<base_task>> invalidated;
+      std::unique_lock lk(mu);
+      size_t cnt = 0;
+      while (cnt == 0) {
+        if (!cv.wait_until(lk, deadline, [this] { return !entries.empty(); })) {
+          break;
+        }
+        auto now = std::chrono::steady_clock::now();
+        while (cnt < n && !entries.empty()) {
+          auto [task, enqueue_time] = pop_locked();
+          metrics.queue_depth.add(-1);
+          if (task->is_expired(now)) {
+            metrics.dropped_tasks.add();
+            invalidated.emplace_back(std::move(task));
+            continue;
+          }
+          if (!task->can_process()) {
+            metrics.dropped_tasks.add();
+            continue;
+          }
+          metrics.queue_wait.record(now - enqueue_time);
+          out.emplace_back(std::move(task));
+          cnt++;
+        }
+        invalidate_if_idle(lk, cnt, invalidated);
+      }
+      finish_pop(lk, invalidated);
+      return cnt;
+    }
+
+    //! \brief 篩選模式下只取出accept接受的任務，其餘任務留在隊列中；
+    //! 否則與pop_up_to相同
+    //! \note 沒有可接受的任務時等待新任務入隊，最多等到deadline
+    //! \return 取出的任務數
+    template <typename Filter>
+    size_t pop_up_to_if(std::vector<std::shared_ptr<base_task>> &out, size_t n,
+                        const std::chrono::steady_clock::time_point &deadline,
+                        Filter accept) {
+      std::vector<std::shared_ptr<base_task>> invalidated;
+      std::unique_lock lk(mu);
+      size_t cnt = 0;
+      auto scanned_seq = next_seq;
+      bool scanned = false;
+      while (cnt == 0) {
+        // 掃描過一遍沒有可接受的任務時，只有新任務入隊才值得再掃描
+        if (!cv.wait_until(lk, deadline, [this, scanned, scanned_seq] {
+              return !entries.empty() &&
+                     (!scanned || next_seq != scanned_seq ||
+                      !selective.load(std::memory_order_relaxed));
+            })) {
+          break;
+        }
+        scanned = true;
+        scanned_seq = next_seq;
+        if (selective.load(std::memory_order_relaxed)) {
+          cnt = take_locked(out, n, accept, invalidated);
+        } else {
+          auto accept_all = [](const base_task &) { return true; };
+          cnt = take_locked(out, n, accept_all, invalidated);
+        }
+        invalidate_if_idle(lk, cnt, invalidated);
+      }
+      finish_pop(lk, invalidated);
+      return cnt;
+    }
+
+    //! \brief 打開或關閉篩選模式，只在有處理器只接受部分任務時打開
+    //! \note 篩選模式下入隊需叫醒所有等待者
+    void set_selective(bool selective_) {
+      {
+        std::lock_guard lk(mu);
+        selective.store(selective_, std::memory_order_relaxed);
+      }
+      cv.notify_all();
+    }
+
+    //! \brief 等到隊列中沒有pred為真的任務，有任務出隊時重新檢查
+    //! \return 超時返回false
+    template <typename Predicate>
+    bool wait_none_of(Predicate pred,
+                      const std::chrono::steady_clock::time_point &deadline) {
+      std::unique_lock lk(mu);
+      taken_waiters++;
+      auto res = taken_cv.wait_until(lk, deadline, [this, &pred] {
+        return std::ranges::none_of(
+            entries, [&pred](auto const &e) { return pred(*e.task); });
+      });
+      taken_waiters--;
+      return res;
+    }
+
+    //! \brief 移出pred為真的任務，由調用者在釋放鎖後標記作廢
+    template <typename Predicate>
+    std::vector<std::shared_ptr<base_task>> remove_if(Predicate pred) {
+      std::vector<std::shared_ptr<base_task>> removed;
+      {
+        std::lock_guard lk(mu);
+        std::erase_if(entries, [&pred, &removed](entry &e) {
+          if (!pred(*e.task)) {
+            return false;
+          }
+          removed.emplace_back(std::move(e.task));
+          return true;
+        });
+        if (removed.empty()) {
+          return removed;
+        }
+        metrics.dropped_tasks.add(removed.size());
+        metrics.queue_depth.add(-static_cast<int64_t>(removed.size()));
+        if (queue_order == order::earliest_deadline_first) {
+          std::ranges::make_heap(entries, later);
+        }
+      }
+      not_full_cv.notify_all();
+      return removed;
+    }
+
+    size_t size() const {
+      std::lock_guard lk(mu);
+      return entries.size();
+    }
+
+    //! \brief 隊列中最早入隊的任務已等待的時間，隊列為空時為0
+    std::chrono::steady_clock::duration
+    oldest_wait(const std::chrono::steady_clock::time_point &now) const {
+      std::lock_guard lk(mu);
+      if (entries.empty()) {
+        return {};
+      }
+      if (queue_order == order::fifo) {
+        return now - entries.front().enqueue_time;
+      }
+      return now - std::ranges::min_element(entries, {}, &entry::seq)
+                       ->enqueue_time;
+    }
+
+    const queue_metrics &get_metrics() const noexcept { return metrics; }
+
+  private:
+    //! \brief 在鎖外標記任務作廢，完成回調可以再次提交任務
+    static void
+    invalidate(const std::vector<std::shared_ptr<base_task>> &tasks) {
+      for (auto const &task : tasks) {
+        task->mark_invalid();
+      }
+    }
+
+    //! \brief 還要繼續等待時先在鎖外作廢已丟棄的任務，不把完成通知推遲到超時
+    void
+    invalidate_if_idle(std::unique_lock<std::mutex> &lk, size_t cnt,
+                       std::vector<std::shared_ptr<base_task>> &invalidated) {
+      if (cnt != 0 || invalidated.empty()) {
+        return;
+      }
+      lk.unlock();
+      invalidate(invalidated);
+      invalidated.clear();
+      lk.lock();
+    }
+
+    //! \brief 出隊結束時釋放鎖，作廢丟棄的任務並叫醒等待空位或等待出隊的綫程
+    void finish_pop(std::unique_lock<std::mutex> &lk,
+                    const std::vector<std::shared_ptr<base_task>> &invalidated) {
+      auto has_capacity = capacity != 0;
+      auto has_taken_waiters = taken_waiters != 0;
+      lk.unlock();
+      invalidate(invalidated);
+      if (has_capacity) {
+        not_full_cv.notify_all();
+      }
+      if (has_taken_waiters) {
+        taken_cv.notify_all();
+      }
+    }
+
+    void notify_consumers(size_t new_task_num) {
+      if (new_task_num == 0) {
+        return;
+      }
+      if (new_task_num == 1 && !selective.load(std::memory_order_relaxed)) {
+        cv.notify_one();
+      } else {
+        cv.notify_all();
+      }
+    }
+
+    struct entry {
+      std::shared_ptr<base_task> task;
+      std::chrono::steady_clock::time_point deadline;
+      std::chrono::steady_clock::time_point enqueue_time;
+      uint64_t seq;
+    };
+
+    //! \brief 堆的比較函數，a比b晚出隊時返回true
+    static bool later(const entry &a, const entry &b) noexcept {
+      if (a.deadline != b.deadline) {
+        return a.deadline > b.deadline;
+      }
+      auto a_priority = a.task->get_priority();
+      auto b_priority = b.task->get_priority();
+      if (a_priority != b_priority) {
+        return a_priority < b_priority;
+      }
+      return a.seq > b.seq;
+    }
+
+    //! \param can_block 為false時不阻塞，也不把被拒絕的新任務標記作廢
+    //! \param invalidated 收集需要標記作廢的任務，由調用者在釋放鎖後處理
+    bool push_with_policy(
+        std::unique_lock<std::mutex> &lk,
+        const std::shared_ptr<base_task> &task, bool can_block,
+        std::vector<std::shared_ptr<base_task>> &invalidated) {
+      auto reject = [this, &task, can_block, &invalidated]() {
+        metrics.rejected_tasks.add();
+        if (can_block) {
+          invalidated.emplace_back(task);
+        }
+        return false;
+      };
+      if (capacity == 0 || entries.size() < capacity) {
+        push_locked(task);
+        return true;
+      }
+      switch (policy) {
+        case overflow_policy::block: {
+          if (!can_block) {
+            return reject();
+          }
+          auto has_space = [this] {
+            return capacity == 0 || entries.size() < capacity;
+          };
+          // 批量放入時前面的任務可能還沒通知消費者，阻塞前先叫醒它們騰出空位
+          cv.notify_all();
+          if (!invalidated.empty()) {
+            lk.unlock();
+            invalidate(invalidated);
+            invalidated.clear();
+            lk.lock();
+          }
+          if (auto const &deadline = task->get_deadline()) {
+            if (!not_full_cv.wait_until(lk, *deadline, has_space)) {
+              return reject();
+            }
+          } else {
+            not_full_cv.wait(lk, has_space);
+          }
+          break;
+        }
+        case overflow_policy::reject:
+          return reject();
+        case overflow_policy::drop_oldest:
+          shed(std::ranges::min_element(entries, {}, &entry::seq),
+               invalidated);
+          break;
+        case overflow_policy::drop_lowest_priority: {
+          // 優先級最低的任務中丟棄最晚入隊的
+          auto it = std::ranges::min_element(entries, [](auto const &a,
+                                                         auto const &b) {
+            auto a_priority = a.task->get_priority();
+            auto b_priority = b.task->get_priority();
+            if (a_priority != b_priority) {
+              return a_priority < b_priority;
+            }
+            return a.seq > b.seq;
+          });
+          if (it->task->get_priority() >= task->get_priority()) {
+            return reject();
+          }
+          shed(it, invalidated);
+          break;
+        }
+      }
+      push_locked(task);
+      return true;
+    }
+
+    //! \brief 丟棄隊列中的任務，放入invalidated等待標記作廢
+    void shed(std::deque<entry>::iterator it,
+              std::vector<std::shared_ptr<base_task>> &invalidated) {
+      invalidated.emplace_back(std::move(it->task));
+      metrics.shed_tasks.add();
+      metrics.queue_depth.add(-1);
+      if (queue_order == order::earliest_deadline_first) {
+        std::swap(*it, entries.back());
+        entries.pop_back();
+        std::ranges::make_heap(entries, later);
+      } else {
+        entries.erase(it);
+      }
+    }
+
+    void push_locked(const std::shared_ptr<base_task> &task) {
+      entries.emplace_back(
+          task,
+          task->get_deadline().value_or(
+              std::chrono::steady_clock::time_point::max()),
+          std::chrono::steady_clock::now(), next_seq++);
+      metrics.enqueued_tasks.add();
+      metrics.queue_depth.add(1);
+      if (queue_order == order::earliest_deadline_first) {
+        std::ranges::push_heap(entries, later);
+      }
+    }
+
+    //! \brief 取出最多n個accept接受的任務，順帶丟棄掃描到的過期或作廢任務
+    template <typename Filter>
+    size_t take_locked(std::vector<std::shared_ptr<base_task>> &out, size_t n,
+                       Filter &accept,
+                       std::vector<std::shared_ptr<base_task>> &invalidated) {
+      auto now = std::chrono::steady_clock::now();
+      size_t cnt = 0;
+      auto take = [&](entry &e) {
+        if (e.task->is_expired(now)) {
+          metrics.dropped_tasks.add();
+          metrics.queue_depth.add(-1);
+          invalidated.emplace_back(std::move(e.task));
+          return true;
+        }
+        if (!e.task->can_process()) {
+          metrics.dropped_tasks.add();
+          metrics.queue_depth.add(-1);
+          return true;
+        }
+        if (!accept(*e.task)) {
+          return false;
+        }
+        metrics.queue_depth.add(-1);
+        metrics.queue_wait.record(now - e.enqueue_time);
+        out.emplace_back(std::move(e.task));
+        cnt++;
+        return true;
+      };
+      if (queue_order == order::fifo) {
+        for (auto it = entries.begin(); cnt < n && it != entries.end();) {
+          if (take(*it)) {
+            it = entries.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        return cnt;
+      }
+      std::vector<entry> skipped;
+      while (cnt < n && !entries.empty()) {
+        std::ranges::pop_heap(entries, later);
+        if (!take(entries.back())) {
+          skipped.emplace_back(std::move(entries.back()));
+        }
+        entries.pop_back();
+      }
+      for (auto &e : skipped) {
+        entries.emplace_back(std::move(e));
+        std::ranges::push_heap(entries, later);
+      }
+      return cnt;
+    }
+
+    std::pair<std::shared_ptr<base_task>, std::chrono::steady_clock::time_point>
+    pop_locked() {
+      if (queue_order == order::earliest_deadline_first) {
+        std::ranges::pop_heap(entries, later);
+        auto res = std::pair(std::move(entries.back().task),
+                             entries.back().enqueue_time);
+        entries.pop_back();
+        return res;
+      }
+      auto res = std::pair(std::move(entries.front().task),
+                           entries.front().enqueue_time);
+      entries.pop_front();
+      return res;
+    }
+
+  private:
+    mutable std::mutex mu;
+    std::condition_variable cv;
+    std::condition_variable not_full_cv;
+    //! \brief 有任務出隊時通知wait_none_of
+    std::condition_variable taken_cv;
+    size_t taken_waiters{0};
+    std::deque<entry> entries;
+    order queue_order{order::fifo};
+    size_t capacity{0};
+    overflow_policy policy{overflow_policy::block};
+    std::atomic<bool> selective{false};
+    uint64_t next_seq{0};
+    queue_metrics metrics;
+  };
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,79 @@
+/*!
+ * \file adaptive_batch_policy_test.cpp
+ *
+ */
+
+#include <doctest/doctest.h>
+
+#include "../adaptive_batch_policy.hpp"
+
+using namespace std::chrono_literals;
+
+TEST_CASE("adaptive_batch_policy") {
+  cyy::naive_lib::task::adaptive_batch_policy policy(
+      {.max_batch_size = 32, .latency_target = 100ms});
+  CHECK_EQ(policy.batch_size(), 1);
+  CHECK_EQ(policy.fill_timeout(), 0us);
+
+  // 模擬的時鐘，任務按固定間隔到達
+  auto clock = std::chrono::steady_clock::time_point(1s);
+  auto arrive = [&clock](cyy::naive_lib::task::adaptive_batch_policy &p,
+                         size_t n, std::chrono::microseconds interval) {
+    for (size_t i = 0; i < n; i++) {
+      clock += interval;
+      p.observe_arrival(clock);
+    }
+  };
+
+  SUBCASE("lone tasks are not delayed") {
+    cyy::naive_lib::task::adaptive_batch_policy policy(
+        {.max_batch_size = 32, .latency_target = 100ms});
+    for (int i = 0; i < 20; i++) {
+      arrive(policy, 1, 1s);
+      policy.observe(1, 0ms, 1ms);
+    }
+    CHECK_EQ(policy.batch_size(), 1);
+    CHECK_EQ(policy.fill_timeout(), 0us);
+    CHECK_EQ(policy.p99_latency(), 1ms);
+  }
+
+  SUBCASE("batch grows under high load") {
+    // 每毫秒到達10個任務，處理耗時 1ms + 0.1ms * batch_size，
+    // 每批的大小由策略自己決定
+    cyy::naive_lib::task::adaptive_batch_policy policy(
+        {.max_batch_size = 32, .latency_target = 100ms});
+    for (int i = 0; i < 50; i++) {
+      auto size = policy.batch_size();
+      arrive(policy, size, 100us);
+      policy.observe(size, std::chrono::microseconds((size - 1) * 100),
+                     std::chrono::microseconds(1000 + size * 100));
+    }
+    CHECK_EQ(policy.batch_size(), 32);
+    CHECK_LE(policy.fill_timeout(), 100ms);
+  }
+
+  SUBCASE("batch grows from one when fill time is negligible") {
+    // 隊列積壓時湊批不需要等待
+    cyy::naive_lib::task::adaptive_batch_policy policy(
+        {.max_batch_size = 32, .latency_target = 100ms});
+    for (int i = 0; i < 50; i++) {
+      auto size = policy.batch_size();
+      arrive(policy, size, 100us);
+      policy.observe(size, 5ns, std::chrono::microseconds(1000 + size * 100));
+    }
+    CHECK_GT(policy.batch_size(), 1);
+  }
+
+  SUBCASE("batch shrinks when processing is slow") {
+    cyy::naive_lib::task::adaptive_batch_policy policy(
+        {.max_batch_size = 32, .latency_target = 100ms});
+    for (int i = 0; i < 50; i++) {
+      auto size = policy.batch_size();
+      arrive(policy, size, 100us);
+      policy.observe(size, std::chrono::microseconds((size - 1) * 100),
+                     std::chrono::milliseconds(10 * size));
+    }
+    CHECK_GT(policy.batch_size(), 1);
+    CHECK_LT(policy.batch_size(), 10);
+  }
+}
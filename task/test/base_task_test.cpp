@@ -76,4 +76,21 @@ TEST_CASE("base_task") {
     CHECK_EQ(task.get_result(0ms).value(), 123);
     producer.join();
   }
+
+  SUBCASE("cancel requests stop and invalidates the task") {
+    task_ns::task<> task;
+    auto token = task.get_stop_token();
+    CHECK_FALSE(token.stop_requested());
+    task.cancel();
+    CHECK(token.stop_requested());
+    CHECK(task.is_cancelled());
+    CHECK(task.is_invalid());
+    CHECK_FALSE(task.wait_done(1ms));
+  }
+
+  SUBCASE("stop token taken after cancel is already stopped") {
+    task_ns::task<> task;
+    task.cancel();
+    CHECK(task.get_stop_token().stop_requested());
+  }
 }
@@ -0,0 +1,148 @@
+/*!
+ * \file coalescing_scheduler_test.cpp
+ *
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../coalescing_scheduler.hpp"
+#include "../neural_network_task.hpp"
+#include "../queue_scheduler.hpp"
+
+namespace {
+  using task_type = cyy::naive_lib::task::neural_network_task<int, int>;
+  using scheduler_type =
+      cyy::naive_lib::task::coalescing_scheduler<task_type>;
+
+  std::atomic<size_t> processed_cnt{0};
+
+  class slow_processor : public cyy::naive_lib::task::base_processor {
+  public:
+    ~slow_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+        override {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      for (auto &task : tasks) {
+        processed_cnt++;
+        auto ptr = std::dynamic_pointer_cast<task_type>(task);
+        ptr->result_promise.set_value(ptr->get_argument() + 1);
+      }
+    }
+  };
+
+  std::shared_ptr<cyy::naive_lib::task::queue_scheduler> make_target() {
+    return std::make_shared<cyy::naive_lib::task::queue_scheduler>(
+        std::vector<cyy::naive_lib::task::queue_scheduler::processor_factory>{
+            []() { return std::make_unique<slow_processor>(); }});
+  }
+} // namespace
+
+TEST_CASE("coalescing scheduler") {
+  using namespace std::chrono_literals;
+  SUBCASE("identical tasks are computed once") {
+    processed_cnt = 0;
+    scheduler_type scheduler(make_target());
+    std::vector<std::shared_ptr<task_type>> tasks;
+    for (int i = 0; i < 10; i++) {
+      tasks.emplace_back(std::make_shared<task_type>(1));
+      scheduler.submit(tasks.back());
+    }
+    auto other = std::make_shared<task_type>(2);
+    scheduler.submit(other);
+    CHECK_EQ(scheduler.in_flight_num(), 2);
+    for (auto &task : tasks) {
+      REQUIRE(task->wait_done(1s));
+      CHECK_EQ(task->get_result().value(), 2);
+    }
+    CHECK_EQ(other->get_result(1s).value(), 3);
+    CHECK_EQ(processed_cnt.load(), 2);
+    CHECK_EQ(scheduler.get_metrics().forwarded_tasks.get(), 2);
+    CHECK_EQ(scheduler.get_metrics().coalesced_tasks.get(), 9);
+    // 提交者先於完成回調看到結果，在途表稍後才清理
+    for (int i = 0; i < 100 && scheduler.in_flight_num() != 0; i++) {
+      std::this_thread::sleep_for(10ms);
+    }
+    CHECK_EQ(scheduler.in_flight_num(), 0);
+  }
+
+  SUBCASE("cached result completes task synchronously") {
+    processed_cnt = 0;
+    auto cache = std::make_shared<scheduler_type::cache_type>();
+    scheduler_type scheduler(make_target(),
+                             {.cache = cache, .cache_ttl = 100ms});
+    CHECK(scheduler.schedule(std::make_shared<task_type>(1), 1s));
+    // 結果由完成回調寫入緩存，提交者可能先看到結果
+    for (int i = 0; i < 100 && cache->size() == 0; i++) {
+      std::this_thread::sleep_for(1ms);
+    }
+    REQUIRE_EQ(cache->size(), 1);
+    auto task = std::make_shared<task_type>(1);
+    scheduler.submit(task);
+    CHECK(task->wait_done(0ms));
+    CHECK_EQ(task->get_result().value(), 2);
+    CHECK_EQ(scheduler.get_metrics().cache_hits.get(), 1);
+    CHECK_EQ(cache->get_metrics().hits.get(), 1);
+    CHECK_EQ(processed_cnt.load(), 1);
+
+    std::this_thread::sleep_for(150ms);
+    auto expired = std::make_shared<task_type>(1);
+    CHECK(scheduler.schedule(expired, 1s));
+    CHECK_EQ(processed_cnt.load(), 2);
+  }
+
+  SUBCASE("waiter is promoted when the in-flight task is cancelled") {
+    processed_cnt = 0;
+    scheduler_type scheduler(make_target());
+    auto leader = std::make_shared<task_type>(5);
+    auto follower = std::make_shared<task_type>(5);
+    scheduler.submit(leader);
+    scheduler.submit(follower);
+    leader->cancel();
+    REQUIRE(follower->wait_done(1s));
+    CHECK_EQ(follower->get_result().value(), 6);
+    CHECK_EQ(scheduler.get_metrics().promoted_tasks.get(), 1);
+  }
+
+  SUBCASE("waiter is promoted when the in-flight task expires in the queue") {
+    processed_cnt = 0;
+    scheduler_type scheduler(make_target());
+    // 先讓處理器忙起來，在途任務在隊列中過期
+    auto blocker = std::make_shared<task_type>(1);
+    scheduler.submit(blocker);
+    std::this_thread::sleep_for(10ms);
+    auto leader = std::make_shared<task_type>(5);
+    leader->set_deadline(std::chrono::steady_clock::now() + 10ms);
+    auto follower = std::make_shared<task_type>(5);
+    scheduler.submit(leader);
+    scheduler.submit(follower);
+    REQUIRE(follower->wait_done(1s));
+    CHECK(leader->is_invalid());
+    CHECK_EQ(follower->get_result().value(), 6);
+    CHECK_EQ(scheduler.get_metrics().promoted_tasks.get(), 1);
+    // 結果先於完成回調可見，在途表稍後才清理
+    for (int i = 0; i < 100 && scheduler.in_flight_num() != 0; i++) {
+      std::this_thread::sleep_for(10ms);
+    }
+    CHECK_EQ(scheduler.in_flight_num(), 0);
+  }
+
+  SUBCASE("custom key") {
+    processed_cnt = 0;
+    // 只按奇偶合并，結果由先到的任務決定
+    scheduler_type scheduler(make_target(), {},
+                             [](const task_type &task) {
+                               return task.get_argument() % 2;
+                             });
+    auto a = std::make_shared<task_type>(1);
+    auto b = std::make_shared<task_type>(3);
+    scheduler.submit(a);
+    scheduler.submit(b);
+    CHECK_EQ(b->get_result(1s).value(), 2);
+    CHECK_EQ(processed_cnt.load(), 1);
+  }
+}
@@ -0,0 +1,97 @@
+/*!
+ * \file combined_scheduler_test.cpp
+ *
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../combined_scheduler.hpp"
+#include "../queue_scheduler.hpp"
+
+namespace {
+  using task_type = cyy::naive_lib::task::task_with_argument_and_result<int, int>;
+
+  class add_processor : public cyy::naive_lib::task::base_processor {
+  public:
+    ~add_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+        override {
+      // 空閒超時時處理器會收到空批次
+      if (tasks.empty()) {
+        return;
+      }
+      auto now_active = ++active;
+      auto old_max = max_active.load();
+      while (old_max < now_active &&
+             !max_active.compare_exchange_weak(old_max, now_active)) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      for (auto &task : tasks) {
+        auto ptr = std::dynamic_pointer_cast<task_type>(task);
+        ptr->result_promise.set_value(ptr->get_argument() + 1);
+      }
+      --active;
+    }
+    //! \brief 同時在處理的processor數，每級只有一個processor
+    static inline std::atomic<size_t> active{0};
+    static inline std::atomic<size_t> max_active{0};
+  };
+
+  std::shared_ptr<cyy::naive_lib::task::base_task>
+  convert_task(size_t, const std::shared_ptr<cyy::naive_lib::task::base_task> &task) {
+    auto ptr = std::dynamic_pointer_cast<task_type>(task);
+    return std::make_shared<task_type>(ptr->get_result().value());
+  }
+
+  std::vector<std::shared_ptr<cyy::naive_lib::task::base_scheduler>>
+  make_schedulers() {
+    std::vector<std::shared_ptr<cyy::naive_lib::task::base_scheduler>>
+        schedulers;
+    for (int i = 0; i < 2; i++) {
+      schedulers.emplace_back(
+          std::make_shared<cyy::naive_lib::task::queue_scheduler>(
+              std::vector<
+                  cyy::naive_lib::task::queue_scheduler::processor_factory>{
+                  []() { return std::make_unique<add_processor>(); }}));
+    }
+    return schedulers;
+  }
+} // namespace
+
+TEST_CASE("combined scheduler") {
+  using namespace std::chrono_literals;
+  SUBCASE("schedule through all stages") {
+    cyy::naive_lib::task::combined_scheduler scheduler(make_schedulers(),
+                                                       convert_task);
+    auto res = scheduler.schedule(std::make_shared<task_type>(1), 1s);
+    REQUIRE(res);
+    // 第二級的輸出再經過一次轉換
+    CHECK_EQ(std::dynamic_pointer_cast<task_type>(res)->get_argument(), 3);
+  }
+
+  SUBCASE("pipelined stages overlap") {
+    cyy::naive_lib::task::combined_scheduler scheduler(make_schedulers(),
+                                                       convert_task);
+    scheduler.enable_pipeline(4);
+
+    add_processor::max_active = 0;
+    std::vector<std::future<std::shared_ptr<cyy::naive_lib::task::base_task>>>
+        futures;
+    for (int i = 0; i < 10; i++) {
+      futures.emplace_back(scheduler.submit(std::make_shared<task_type>(i), 5s));
+    }
+    for (int i = 0; i < 10; i++) {
+      auto res = futures[i].get();
+      REQUIRE(res);
+      CHECK_EQ(std::dynamic_pointer_cast<task_type>(res)->get_argument(),
+               i + 2);
+    }
+    // 每級只有一個processor，兩級同時在處理說明流水綫重疊了
+    CHECK_GE(add_processor::max_active.load(), 2);
+  }
+}
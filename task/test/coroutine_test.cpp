@@ -0,0 +1,93 @@
+/*!
+ * \file coroutine_test.cpp
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../coroutine.hpp"
+#include "../queue_scheduler.hpp"
+
+using namespace std::chrono_literals;
+namespace task_ns = cyy::naive_lib::task;
+
+namespace {
+  class int_processor : public task_ns::base_processor {
+  public:
+    ~int_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<task_ns::base_task>> &tasks) override {
+      for (auto &task : tasks) {
+        std::dynamic_pointer_cast<task_ns::task_with_result<int>>(task)
+            ->result_promise.set_value(1);
+      }
+      // 子類清空tasks也不影響完成通知
+      tasks.clear();
+    }
+  };
+
+  task_ns::detached_coroutine
+  request(task_ns::base_scheduler &scheduler, std::atomic<int> &sum,
+          std::latch &finished) {
+    auto task = std::make_shared<task_ns::task_with_result<int>>();
+    if (co_await scheduler.submit(task)) {
+      sum += task->get_result().value();
+    }
+    finished.count_down();
+  }
+
+  task_ns::detached_coroutine expect_failure(task_ns::base_scheduler &scheduler,
+                                             std::atomic<bool> &failed,
+                                             std::latch &finished) {
+    auto task = std::make_shared<task_ns::task_with_result<int>>();
+    task->mark_invalid();
+    failed = !co_await scheduler.submit(task);
+    finished.count_down();
+  }
+} // namespace
+
+TEST_CASE("coroutine") {
+  SUBCASE("fan out from one thread") {
+    task_ns::queue_scheduler scheduler(
+        {[]() { return std::make_unique<int_processor>(); },
+         []() { return std::make_unique<int_processor>(); }});
+    constexpr int num = 1000;
+    std::atomic<int> sum{0};
+    std::latch finished(num);
+    for (int i = 0; i < num; i++) {
+      request(scheduler, sum, finished);
+    }
+    finished.wait();
+    CHECK_EQ(sum.load(), num);
+  }
+
+  SUBCASE("invalid task resumes immediately") {
+    task_ns::queue_scheduler scheduler;
+    std::atomic<bool> failed{false};
+    std::latch finished(1);
+    expect_failure(scheduler, failed, finished);
+    finished.wait();
+    CHECK(failed.load());
+  }
+
+  SUBCASE("done callback") {
+    task_ns::task<> task;
+    struct counting_callback : task_ns::base_task::done_callback {
+      int calls{0};
+    } callback;
+    callback.func = [](task_ns::base_task::done_callback &cb) noexcept {
+      static_cast<counting_callback &>(cb).calls++;
+    };
+    CHECK(task.add_done_callback(callback));
+    task.notify_done();
+    task.notify_done();
+    CHECK_EQ(callback.calls, 1);
+    CHECK_FALSE(task.add_done_callback(callback));
+  }
+}
@@ -0,0 +1,78 @@
+/*!
+ * \file metrics_test.cpp
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+
+#include <doctest/doctest.h>
+
+#include "../metrics.hpp"
+
+namespace task_ns = cyy::naive_lib::task;
+
+TEST_CASE("metrics") {
+  SUBCASE("histogram buckets") {
+    for (uint64_t v : {0ULL, 1ULL, 7ULL, 8ULL, 9ULL, 100ULL, 1000000ULL}) {
+      auto idx = task_ns::histogram::bucket_index(v);
+      CHECK_LT(v, task_ns::histogram::bucket_upper_bound(idx));
+      if (idx > 0) {
+        CHECK_GE(v, task_ns::histogram::bucket_upper_bound(idx - 1));
+      }
+    }
+    CHECK_LT(task_ns::histogram::bucket_index(UINT64_MAX),
+             task_ns::histogram::bucket_num);
+  }
+
+  SUBCASE("histogram percentile") {
+    task_ns::histogram h;
+    for (uint64_t i = 1; i <= 1000; i++) {
+      h.record(i);
+    }
+    auto snapshot = h.snapshot();
+    CHECK_EQ(snapshot.count, 1000);
+    CHECK_EQ(snapshot.sum, 500500);
+    auto p99 = snapshot.percentile(0.99);
+    // 相對誤差不超過12.5%
+    CHECK_GE(p99, 990);
+    CHECK_LE(p99, 990 * 9 / 8 + 1);
+  }
+
+  SUBCASE("prometheus text format") {
+    task_ns::queue_metrics metrics;
+    metrics.enqueued_tasks.add(3);
+    metrics.queue_depth.add(2);
+    metrics.queue_wait.record(std::chrono::milliseconds(1));
+
+    task_ns::prometheus_writer writer;
+    writer.add(metrics, "test", {{"name", "a\"b"}});
+    writer.add(metrics, "test", {{"name", "c"}});
+    auto text = writer.str();
+    CHECK_NE(text.find("# TYPE test_enqueued_tasks_total counter\n"
+                       "test_enqueued_tasks_total{name=\"a\\\"b\"} 3\n"
+                       "test_enqueued_tasks_total{name=\"c\"} 3\n"),
+             std::string::npos);
+    CHECK_NE(text.find("test_queue_depth{name=\"c\"} 2\n"), std::string::npos);
+    CHECK_NE(text.find("test_queue_wait_seconds_count{name=\"c\"} 1\n"),
+             std::string::npos);
+    CHECK_NE(text.find("test_queue_wait_seconds_bucket{name=\"c\",le=\"+Inf\"} 1"),
+             std::string::npos);
+  }
+
+  SUBCASE("histogram buckets do not depend on the data") {
+    auto bucket_lines = [](const task_ns::histogram &h) {
+      task_ns::prometheus_writer writer;
+      writer.add_histogram("h", "help", {}, h.snapshot());
+      auto text = writer.str();
+      return std::ranges::count(text, '\n');
+    };
+    task_ns::histogram empty;
+    task_ns::histogram small;
+    small.record(uint64_t(1));
+    task_ns::histogram large;
+    large.record(uint64_t(1) << 40);
+    CHECK_EQ(bucket_lines(empty), bucket_lines(small));
+    CHECK_EQ(bucket_lines(empty), bucket_lines(large));
+  }
+}
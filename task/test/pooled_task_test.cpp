@@ -0,0 +1,79 @@
+/*!
+ * \file pooled_task_test.cpp
+ *
+ */
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../pooled_task.hpp"
+#include "../queue_scheduler.hpp"
+
+using namespace std::chrono_literals;
+namespace task_ns = cyy::naive_lib::task;
+using string_task = task_ns::pooled_task<std::string, size_t>;
+
+namespace {
+  class length_processor : public task_ns::base_processor {
+  public:
+    ~length_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<task_ns::base_task>> &tasks) override {
+      for (auto &task : tasks) {
+        auto t = std::dynamic_pointer_cast<string_task>(task);
+        t->set_result(t->get_argument().size());
+      }
+    }
+  };
+} // namespace
+
+TEST_CASE("pooled_task") {
+  SUBCASE("blocks are reused") {
+    auto task = string_task::create("abc");
+    auto const *block = task.get();
+    auto capacity = task_ns::pool_allocator<string_task>::pool().capacity();
+    task.reset();
+    for (int i = 0; i < 1000; i++) {
+      auto other = string_task::create("abc");
+      CHECK_EQ(other.get(), block);
+    }
+    CHECK_EQ(task_ns::pool_allocator<string_task>::pool().capacity(),
+             capacity);
+  }
+
+  SUBCASE("wait and get result") {
+    auto task = string_task::create("abcd");
+    CHECK_FALSE(task->wait_done(1ms));
+    CHECK_FALSE(task->get_result(1ms).has_value());
+    std::jthread thd([task]() {
+      std::this_thread::sleep_for(10ms);
+      task->set_result(task->get_argument().size());
+    });
+    CHECK_EQ(task->get_result(1s).value(), 4);
+    CHECK(task->wait_done(0ms));
+  }
+
+  SUBCASE("invalid task") {
+    auto task = string_task::create("abcd");
+    task->mark_invalid();
+    CHECK_FALSE(task->wait_done(1ms));
+    CHECK_FALSE(task->get_result(1ms).has_value());
+  }
+
+  SUBCASE("schedule") {
+    task_ns::queue_scheduler scheduler(
+        {[]() { return std::make_unique<length_processor>(); }});
+    std::vector<std::shared_ptr<string_task>> tasks;
+    for (size_t i = 0; i < 100; i++) {
+      tasks.emplace_back(string_task::create(std::string(i, 'a')));
+      scheduler.submit(tasks.back());
+    }
+    for (size_t i = 0; i < tasks.size(); i++) {
+      CHECK_EQ(tasks[i]->get_result(1s).value(), i);
+    }
+  }
+}
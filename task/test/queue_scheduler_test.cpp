@@ -5,8 +5,14 @@
  * \date 2018-04-18
  */
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 #include <doctest/doctest.h>
 
+#include "../neural_network_processor.hpp"
 #include "../neural_network_task.hpp"
 #include "../queue_scheduler.hpp"
 
@@ -55,6 +61,115 @@ public:
   bool can_use_gpu() const override { return false; }
 };
 
+class batch_size_processor : public cyy::naive_lib::task::base_processor {
+public:
+  ~batch_size_processor() override { stop(); }
+  void process_tasks(
+      std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+      override {
+    max_batch_size = std::max(max_batch_size.load(), tasks.size());
+    for (auto &task : tasks) {
+      std::dynamic_pointer_cast<cyy::naive_lib::task::task<>>(task)
+          ->result_promise.set_value();
+    }
+  }
+  static inline std::atomic<size_t> max_batch_size{0};
+};
+
+class order_processor : public cyy::naive_lib::task::base_processor {
+public:
+  ~order_processor() override { stop(); }
+  void process_tasks(
+      std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+      override {
+    for (auto &task : tasks) {
+      {
+        std::lock_guard lk(mu);
+        processed_tasks.push_back(task.get());
+      }
+      std::dynamic_pointer_cast<cyy::naive_lib::task::task<>>(task)
+          ->result_promise.set_value();
+    }
+  }
+  static std::vector<const cyy::naive_lib::task::base_task *> processed() {
+    std::lock_guard lk(mu);
+    return processed_tasks;
+  }
+  static void reset() {
+    std::lock_guard lk(mu);
+    processed_tasks.clear();
+  }
+
+private:
+  static inline std::mutex mu;
+  static inline std::vector<const cyy::naive_lib::task::base_task *>
+      processed_tasks;
+};
+
+class slow_processor : public cyy::naive_lib::task::base_processor {
+public:
+  ~slow_processor() override { stop(); }
+  void process_tasks(
+      std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+      override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (auto &task : tasks) {
+      std::dynamic_pointer_cast<cyy::naive_lib::task::task<>>(task)
+          ->result_promise.set_value();
+    }
+  }
+};
+
+class versioned_processor
+    : public cyy::naive_lib::task::neural_network_processor {
+public:
+  explicit versioned_processor(int version) {
+    set_model_version(std::to_string(version));
+  }
+  ~versioned_processor() override { stop(); }
+  void warm_up() override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  void process_tasks(
+      std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+      override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    for (auto &task : tasks) {
+      std::dynamic_pointer_cast<
+          cyy::naive_lib::task::neural_network_task<int, int>>(task)
+          ->result_promise.set_value(std::stoi(model_version));
+    }
+  }
+};
+
+class cancellable_processor : public cyy::naive_lib::task::base_processor {
+public:
+  ~cancellable_processor() override { stop(); }
+  void process_tasks(
+      std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+      override {
+    for (auto &task : tasks) {
+      auto token = task->get_stop_token();
+      // 只統計處理過程中觀察到的取消，處理完之後才取消的不算
+      bool stopped = false;
+      for (int i = 0; i < 100; i++) {
+        if (token.stop_requested()) {
+          stopped = true;
+          break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      if (stopped) {
+        cancelled_tasks++;
+        continue;
+      }
+      std::dynamic_pointer_cast<cyy::naive_lib::task::task<>>(task)
+          ->result_promise.set_value();
+    }
+  }
+  static inline std::atomic<size_t> cancelled_tasks{0};
+};
+
 TEST_CASE("queue scheduler") {
   SUBCASE("finish task processing") {
     using namespace std::chrono_literals;
@@ -89,4 +204,401 @@ TEST_CASE("queue scheduler") {
     auto res = scheduler.schedule(task_ptr, 10ms);
     CHECK(res);
   }
+
+  SUBCASE("submit without blocking") {
+    using namespace std::chrono_literals;
+    cyy::naive_lib::task::queue_scheduler scheduler(
+        {[]() { return std::make_unique<succ_processor>(); }});
+
+    std::vector<cyy::naive_lib::task::task_handle<
+        cyy::naive_lib::task::neural_network_task<int, int>>>
+        handles;
+    for (int i = 0; i < 10; i++) {
+      handles.emplace_back(scheduler.submit(
+          std::make_shared<cyy::naive_lib::task::neural_network_task<int, int>>(
+              i)));
+    }
+    for (auto &handle : handles) {
+      CHECK(handle.wait_done(1s));
+      CHECK_EQ(handle.get_result().value(), 1);
+    }
+
+    auto handle_opt = scheduler.try_submit(
+        std::make_shared<cyy::naive_lib::task::neural_network_task<int, int>>(
+            1));
+    REQUIRE(handle_opt.has_value());
+    CHECK(handle_opt->wait_done(1s));
+  }
+
+  SUBCASE("submit batch") {
+    using namespace std::chrono_literals;
+    cyy::naive_lib::task::queue_scheduler scheduler(
+        {[]() { return std::make_unique<notify_processor>(); },
+         []() { return std::make_unique<notify_processor>(); }});
+
+    std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> tasks;
+    for (int i = 0; i < 10; i++) {
+      tasks.emplace_back(std::make_shared<cyy::naive_lib::task::task<>>());
+    }
+    scheduler.submit_batch(tasks);
+    for (auto &task : tasks) {
+      CHECK(task->wait_done(1s));
+    }
+  }
+
+  SUBCASE("adaptive batching does not delay a lone task") {
+    using namespace std::chrono_literals;
+    cyy::naive_lib::task::queue_scheduler scheduler({[]() {
+      auto processor = std::make_unique<succ_processor>();
+      processor->set_task_batch_size(64);
+      processor->set_adaptive_batching({.max_batch_size = 64,
+                                        .latency_target = 50ms});
+      return processor;
+    }});
+
+    auto task_ptr =
+        std::make_shared<cyy::naive_lib::task::neural_network_task<int, int>>(
+            1);
+    CHECK(scheduler.schedule(task_ptr, 200ms));
+  }
+
+  SUBCASE("bulk dequeue fills a batch at once") {
+    using namespace std::chrono_literals;
+    cyy::naive_lib::task::queue_scheduler scheduler;
+    std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> tasks;
+    for (int i = 0; i < 8; i++) {
+      tasks.emplace_back(std::make_shared<cyy::naive_lib::task::task<>>());
+    }
+    scheduler.submit_batch(tasks);
+    scheduler.add_processor({[]() {
+      auto processor = std::make_unique<batch_size_processor>();
+      processor->set_task_batch_size(8);
+      return processor;
+    }});
+    for (auto &task : tasks) {
+      CHECK(task->wait_done(1s));
+    }
+    CHECK_EQ(batch_size_processor::max_batch_size.load(), 8);
+  }
+
+  SUBCASE("earliest deadline first") {
+    using namespace std::chrono_literals;
+    cyy::naive_lib::task::queue_scheduler scheduler;
+    scheduler.set_queue_order(
+        cyy::naive_lib::task::task_queue::order::earliest_deadline_first);
+
+    auto now = std::chrono::steady_clock::now();
+    auto late_task = std::make_shared<cyy::naive_lib::task::task<>>();
+    late_task->set_deadline(now + 10s);
+    auto early_task = std::make_shared<cyy::naive_lib::task::task<>>();
+    early_task->set_deadline(now + 5s);
+    auto expired_task = std::make_shared<cyy::naive_lib::task::task<>>();
+    expired_task->set_deadline(now - 1s);
+    auto urgent_task = std::make_shared<cyy::naive_lib::task::task<>>();
+    urgent_task->set_deadline(now + 5s);
+    urgent_task->set_priority(1);
+    scheduler.submit_batch(std::vector<
+                           std::shared_ptr<cyy::naive_lib::task::base_task>>{
+        late_task, early_task, expired_task, urgent_task});
+
+    order_processor::reset();
+    scheduler.add_processor({[]() {
+      auto processor = std::make_unique<order_processor>();
+      processor->set_task_batch_size(1);
+      return processor;
+    }});
+    CHECK(late_task->wait_done(1s));
+    CHECK(early_task->wait_done(1s));
+    CHECK(urgent_task->wait_done(1s));
+    // 過期的任務在隊列中被丟棄，沒有被處理
+    CHECK(expired_task->is_invalid());
+    auto processed = order_processor::processed();
+    REQUIRE_EQ(processed.size(), 3);
+    CHECK_EQ(processed[0], urgent_task.get());
+    CHECK_EQ(processed[1], early_task.get());
+    CHECK_EQ(processed[2], late_task.get());
+  }
+
+  SUBCASE("bounded queue") {
+    using namespace std::chrono_literals;
+    using cyy::naive_lib::task::task;
+    using cyy::naive_lib::task::task_queue;
+    auto make_tasks = []() {
+      return std::vector<std::shared_ptr<task<>>>{std::make_shared<task<>>(),
+                                                  std::make_shared<task<>>(),
+                                                  std::make_shared<task<>>()};
+    };
+
+    {
+      cyy::naive_lib::task::queue_scheduler scheduler;
+      auto tasks = make_tasks();
+      scheduler.set_queue_capacity(2, task_queue::overflow_policy::reject);
+      scheduler.submit(tasks[0]);
+      scheduler.submit(tasks[1]);
+      CHECK(!scheduler.try_submit(tasks[2]).has_value());
+      CHECK(!tasks[2]->is_invalid());
+      scheduler.submit(tasks[2]);
+      // 被拒絕的任務立即失敗，不必等到超時
+      CHECK(tasks[2]->is_invalid());
+      CHECK(!tasks[2]->wait_done(1s));
+      CHECK_EQ(scheduler.get_queue_metrics().rejected_tasks.get(), 2);
+    }
+
+    {
+      cyy::naive_lib::task::queue_scheduler scheduler;
+      auto tasks = make_tasks();
+      scheduler.set_queue_capacity(2,
+                                   task_queue::overflow_policy::drop_oldest);
+      for (auto const &t : tasks) {
+        scheduler.submit(t);
+      }
+      CHECK(tasks[0]->is_invalid());
+      CHECK(!tasks[1]->is_invalid());
+      CHECK_EQ(scheduler.get_queue_metrics().shed_tasks.get(), 1);
+    }
+
+    {
+      // 被丟棄任務的完成回調在隊列的鎖外執行，可以再次提交任務
+      cyy::naive_lib::task::queue_scheduler scheduler;
+      auto tasks = make_tasks();
+      scheduler.set_queue_capacity(1,
+                                   task_queue::overflow_policy::drop_oldest);
+      struct resubmit_callback
+          : cyy::naive_lib::task::base_task::done_callback {
+        cyy::naive_lib::task::queue_scheduler *scheduler{nullptr};
+        std::shared_ptr<task<>> follow_up;
+      } callback;
+      callback.scheduler = &scheduler;
+      callback.follow_up = tasks[2];
+      callback.func =
+          [](cyy::naive_lib::task::base_task::done_callback &cb) noexcept {
+            auto &self = static_cast<resubmit_callback &>(cb);
+            self.scheduler->submit(self.follow_up);
+          };
+      CHECK(tasks[0]->add_done_callback(callback));
+      scheduler.submit(tasks[0]);
+      scheduler.submit(tasks[1]);
+      CHECK(tasks[0]->is_invalid());
+      CHECK(tasks[1]->is_invalid());
+      CHECK(!tasks[2]->is_invalid());
+      CHECK_EQ(scheduler.get_queue_metrics().shed_tasks.get(), 2);
+    }
+
+    {
+      cyy::naive_lib::task::queue_scheduler scheduler;
+      auto tasks = make_tasks();
+      scheduler.set_queue_capacity(
+          2, task_queue::overflow_policy::drop_lowest_priority);
+      tasks[0]->set_priority(2);
+      tasks[2]->set_priority(1);
+      for (auto const &t : tasks) {
+        scheduler.submit(t);
+      }
+      CHECK(tasks[1]->is_invalid());
+      auto low_task = std::make_shared<task<>>();
+      scheduler.submit(low_task);
+      CHECK(low_task->is_invalid());
+      CHECK_EQ(scheduler.get_queue_metrics().shed_tasks.get(), 1);
+      CHECK_EQ(scheduler.get_queue_metrics().rejected_tasks.get(), 1);
+    }
+
+    {
+      cyy::naive_lib::task::queue_scheduler scheduler;
+      auto tasks = make_tasks();
+      scheduler.set_queue_capacity(2, task_queue::overflow_policy::block);
+      scheduler.submit(tasks[0]);
+      scheduler.submit(tasks[1]);
+      // 阻塞到截止時間仍然沒有空位時拒絕
+      tasks[2]->set_deadline(std::chrono::steady_clock::now() + 50ms);
+      scheduler.submit(tasks[2]);
+      CHECK(tasks[2]->is_invalid());
+    }
+
+    {
+      cyy::naive_lib::task::queue_scheduler scheduler;
+      auto tasks = make_tasks();
+      scheduler.set_queue_capacity(2, task_queue::overflow_policy::block);
+      scheduler.submit(tasks[0]);
+      scheduler.submit(tasks[1]);
+      std::jthread consumer([&scheduler]() {
+        std::this_thread::sleep_for(50ms);
+        scheduler.add_processor(
+            {[]() { return std::make_unique<notify_processor>(); }});
+      });
+      scheduler.submit(tasks[2]);
+      CHECK(tasks[0]->wait_done(1s));
+      CHECK(tasks[2]->wait_done(1s));
+    }
+
+    {
+      // 批量放入超過容量時，阻塞前放入的任務要立即叫醒處理器
+      cyy::naive_lib::task::queue_scheduler scheduler;
+      scheduler.set_queue_capacity(4, task_queue::overflow_policy::block);
+      scheduler.add_processor({[]() {
+        auto processor = std::make_unique<notify_processor>();
+        processor->set_task_batch_timeout(5s);
+        return processor;
+      }});
+      std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> batch;
+      for (int i = 0; i < 32; i++) {
+        batch.emplace_back(std::make_shared<task<>>());
+      }
+      auto begin = std::chrono::steady_clock::now();
+      scheduler.submit_batch(batch);
+      for (auto const &t : batch) {
+        CHECK(t->wait_done(5s));
+      }
+      // 每段容量都等批次超時的話至少要40秒
+      CHECK_LT(std::chrono::steady_clock::now() - begin, 5s);
+    }
+  }
+
+  SUBCASE("processor placement") {
+    using namespace std::chrono_literals;
+    cyy::naive_lib::task::queue_scheduler scheduler;
+    scheduler.set_processor_placement(
+        cyy::naive_lib::task::processor_placement::physical_core);
+    scheduler.add_processor(
+        {[]() { return std::make_unique<notify_processor>(); },
+         []() { return std::make_unique<notify_processor>(); }});
+    scheduler.foreach_processor([](auto const *processor) {
+      CHECK_EQ(processor->get_cpu_affinity().size(), 1);
+      return false;
+    });
+    auto task = std::make_shared<cyy::naive_lib::task::task<>>();
+    CHECK(scheduler.schedule(task, 1s));
+
+    // 退役processor的位置被重用，新processor不會和仍在運行的擠在同一個核上
+    CHECK(scheduler.rolling_replace_processor(
+        {[]() { return std::make_unique<notify_processor>(); }}, 1s, 1s));
+    scheduler.add_processor(
+        {[]() { return std::make_unique<notify_processor>(); }});
+    std::vector<std::vector<size_t>> cpus;
+    scheduler.foreach_processor([&cpus](auto const *processor) {
+      cpus.push_back(processor->get_cpu_affinity());
+      return false;
+    });
+    // 替換時舊的兩個processor還佔着0和1號位置，新processor用2號；之後加入的重用0號
+    std::vector<std::vector<size_t>> expected_cpus;
+    for (size_t i : {0, 2}) {
+      expected_cpus.push_back(cyy::naive_lib::task::placement_cpus(
+          cyy::naive_lib::task::processor_placement::physical_core, i));
+    }
+    std::ranges::sort(cpus);
+    std::ranges::sort(expected_cpus);
+    CHECK_EQ(cpus, expected_cpus);
+  }
+
+  SUBCASE("autoscaling") {
+    using namespace std::chrono_literals;
+    cyy::naive_lib::task::queue_scheduler scheduler;
+    scheduler.enable_autoscaling({
+        .factory =
+            []() {
+              auto processor = std::make_unique<slow_processor>();
+              processor->set_task_batch_timeout(10ms);
+              return processor;
+            },
+        .min_processors = 1,
+        .max_processors = 4,
+        .scale_up_wait = 10ms,
+        .idle_timeout = 100ms,
+        .check_interval = 5ms,
+    });
+    CHECK_EQ(scheduler.processor_num(), 1);
+
+    std::vector<std::shared_ptr<cyy::naive_lib::task::task<>>> tasks;
+    for (int i = 0; i < 60; i++) {
+      tasks.emplace_back(std::make_shared<cyy::naive_lib::task::task<>>());
+      scheduler.submit(tasks.back());
+    }
+    size_t max_processor_num = 0;
+    for (auto const &task : tasks) {
+      while (!task->wait_done(1ms)) {
+        max_processor_num =
+            std::max(max_processor_num, scheduler.processor_num());
+      }
+    }
+    CHECK_GT(max_processor_num, 1);
+    CHECK_LE(max_processor_num, 4);
+
+    // 空閒後逐個退役，直到最小值
+    for (int i = 0; i < 200 && scheduler.processor_num() > 1; i++) {
+      std::this_thread::sleep_for(10ms);
+    }
+    CHECK_EQ(scheduler.processor_num(), 1);
+  }
+
+  SUBCASE("rolling replace processors") {
+    using namespace std::chrono_literals;
+    using task_type = cyy::naive_lib::task::neural_network_task<int, int>;
+    cyy::naive_lib::task::queue_scheduler scheduler(
+        {[]() { return std::make_unique<versioned_processor>(1); }});
+    auto make_task = [](const std::string &version) {
+      auto task = std::make_shared<task_type>(0);
+      task->model_version = version;
+      return task;
+    };
+
+    std::vector<std::shared_ptr<task_type>> old_tasks;
+    for (int i = 0; i < 20; i++) {
+      old_tasks.emplace_back(make_task("1"));
+      scheduler.submit(old_tasks.back());
+    }
+    // 沒有processor接受的版本在提交時就作廢
+    auto unroutable_task = make_task("3");
+    scheduler.submit(unroutable_task);
+    CHECK(unroutable_task->is_invalid());
+
+    std::vector<std::shared_ptr<task_type>> new_tasks;
+    std::atomic<bool> replacing{false};
+    std::jthread replacer([&scheduler, &replacing]() {
+      CHECK(scheduler.rolling_replace_processor(
+          {[&replacing]() {
+            replacing = true;
+            return std::make_unique<versioned_processor>(2);
+          }},
+          1s, 5s));
+    });
+    // 新processor創建後提交的新版本任務等它預熱完成再處理
+    while (!replacing) {
+      std::this_thread::yield();
+    }
+    for (int i = 0; i < 20; i++) {
+      new_tasks.emplace_back(make_task("2"));
+      scheduler.submit(new_tasks.back());
+    }
+    auto any_version_task = make_task("");
+    scheduler.submit(any_version_task);
+
+    for (auto const &task : old_tasks) {
+      CHECK_EQ(task->get_result(1s).value(), 1);
+    }
+    for (auto const &task : new_tasks) {
+      CHECK_EQ(task->get_result(1s).value(), 2);
+    }
+    CHECK(any_version_task->wait_done(1s));
+    replacer.join();
+    CHECK_EQ(scheduler.processor_num(), 1);
+
+    auto stale_task = make_task("1");
+    scheduler.submit(stale_task);
+    CHECK(stale_task->is_invalid());
+  }
+
+  SUBCASE("caller timeout cancels in-flight task") {
+    using namespace std::chrono_literals;
+    cancellable_processor::cancelled_tasks = 0;
+    cyy::naive_lib::task::queue_scheduler scheduler(
+        {[]() { return std::make_unique<cancellable_processor>(); }});
+    auto task = std::make_shared<cyy::naive_lib::task::task<>>();
+    CHECK(!scheduler.schedule(task, 50ms));
+    CHECK(task->is_cancelled());
+    for (int i = 0; i < 500 && cancellable_processor::cancelled_tasks == 0;
+         i++) {
+      std::this_thread::sleep_for(10ms);
+    }
+    // 處理器在處理過程中觀察到了取消，提前結束
+    CHECK_EQ(cancellable_processor::cancelled_tasks.load(), 1);
+  }
 }
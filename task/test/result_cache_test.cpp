@@ -0,0 +1,133 @@
+/*!
+ * \file result_cache_test.cpp
+ *
+ */
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../result_cache.hpp"
+
+namespace {
+  using cache_type = cyy::naive_lib::task::result_cache<int, std::string>;
+
+  //! \brief 每條緩存算10字節，方便計算預算
+  cache_type make_cache(size_t budget, bool admission) {
+    return cache_type({.byte_budget = budget,
+                       .shard_num = 1,
+                       .frequency_admission = admission},
+                      [](const int &, const std::string &) { return 10; });
+  }
+} // namespace
+
+TEST_CASE("frequency sketch") {
+  cyy::naive_lib::task::frequency_sketch sketch(16);
+  for (int i = 0; i < 5; i++) {
+    sketch.increment(42);
+  }
+  CHECK_GE(sketch.estimate(42), 5);
+  CHECK_LE(sketch.estimate(43), 5);
+  for (int i = 0; i < 20; i++) {
+    sketch.increment(42);
+  }
+  CHECK_EQ(sketch.estimate(42), 15);
+  // 增加的次數達到採樣數後全部減半，42的計數不再飽和
+  for (uint64_t i = 1000; i < 2000 && sketch.estimate(42) == 15; i++) {
+    sketch.increment(i);
+  }
+  CHECK_LT(sketch.estimate(42), 15);
+}
+
+TEST_CASE("result cache") {
+  using namespace std::chrono_literals;
+  SUBCASE("get and put") {
+    cache_type cache;
+    CHECK(!cache.get(1));
+    CHECK(cache.put(1, "a"));
+    CHECK_EQ(cache.get(1).value(), "a");
+    CHECK(cache.put(1, "b"));
+    CHECK_EQ(cache.get(1).value(), "b");
+    CHECK_EQ(cache.size(), 1);
+    CHECK_EQ(cache.get_metrics().hits.get(), 2);
+    CHECK_EQ(cache.get_metrics().misses.get(), 1);
+    CHECK(cache.erase(1));
+    CHECK(!cache.erase(1));
+    CHECK_EQ(cache.size(), 0);
+    CHECK_EQ(cache.byte_size(), 0);
+  }
+
+  SUBCASE("ttl") {
+    cache_type cache;
+    cache.put(1, "a", 20ms);
+    cache.put(2, "b");
+    std::this_thread::sleep_for(40ms);
+    CHECK(!cache.get(1));
+    CHECK(cache.get(2));
+    CHECK_EQ(cache.get_metrics().expirations.get(), 1);
+  }
+
+  SUBCASE("byte budget evicts least recently used") {
+    auto cache = make_cache(100, false);
+    for (int i = 0; i < 10; i++) {
+      CHECK(cache.put(i, "v"));
+    }
+    CHECK(cache.get(0));
+    for (int i = 10; i < 15; i++) {
+      CHECK(cache.put(i, "v"));
+    }
+    CHECK_EQ(cache.size(), 10);
+    CHECK_EQ(cache.byte_size(), 100);
+    CHECK_EQ(cache.get_metrics().evictions.get(), 5);
+    CHECK(cache.get(0));
+    CHECK(!cache.get(1));
+    CHECK(cache.get(14));
+  }
+
+  SUBCASE("oversized result is rejected") {
+    auto cache = make_cache(5, false);
+    CHECK(!cache.put(1, "v"));
+    CHECK_EQ(cache.get_metrics().rejections.get(), 1);
+  }
+
+  SUBCASE("frequency admission protects hot entries") {
+    auto cache = make_cache(30, true);
+    for (int i = 0; i < 3; i++) {
+      cache.get(i);
+      cache.get(i);
+      CHECK(cache.put(i, "hot"));
+    }
+    // 只訪問過一次的鍵不能擠掉熱點
+    CHECK(!cache.get(100));
+    CHECK(!cache.put(100, "cold"));
+    CHECK_EQ(cache.size(), 3);
+    // 訪問變多以後可以放入
+    for (int i = 0; i < 5; i++) {
+      cache.get(100);
+    }
+    CHECK(cache.put(100, "warm"));
+    CHECK(cache.get(100));
+    CHECK_EQ(cache.size(), 3);
+  }
+
+  SUBCASE("concurrent access stays within budget") {
+    cache_type cache({.byte_budget = 1600, .shard_num = 4},
+                     [](const int &, const std::string &) { return 10; });
+    std::vector<std::jthread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&cache, t] {
+        for (int i = 0; i < 5000; i++) {
+          auto key = (i * 7 + t) % 500;
+          if (!cache.get(key)) {
+            cache.put(key, std::to_string(key));
+          }
+        }
+      });
+    }
+    threads.clear();
+    CHECK_LE(cache.byte_size(), 1600);
+    CHECK_GT(cache.get_metrics().hits.get(), 0);
+  }
+}
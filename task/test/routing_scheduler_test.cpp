@@ -0,0 +1,119 @@
+/*!
+ * \file routing_scheduler_test.cpp
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../routing_scheduler.hpp"
+
+using namespace std::chrono_literals;
+namespace task_ns = cyy::naive_lib::task;
+
+namespace {
+  using task_type = task_ns::neural_network_task<int, std::string>;
+
+  //! \brief 把處理器名稱作為結果，並檢查每個批次的模型版本是否一致
+  class key_processor : public task_ns::base_processor {
+  public:
+    explicit key_processor(std::string name_) : name{std::move(name_)} {
+      set_task_batch_size(8);
+      set_task_batch_timeout(20ms);
+    }
+    ~key_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<task_ns::base_task>> &tasks) override {
+      // 空閒超時時處理器會收到空批次
+      if (tasks.empty()) {
+        return;
+      }
+      auto const &version =
+          std::dynamic_pointer_cast<task_type>(tasks.front())->model_version;
+      for (auto &task : tasks) {
+        auto ptr = std::dynamic_pointer_cast<task_type>(task);
+        if (ptr->model_version != version) {
+          mixed_batches++;
+        }
+        ptr->result_promise.set_value(name);
+      }
+    }
+    static inline std::atomic<size_t> mixed_batches{0};
+
+  private:
+    std::string name;
+  };
+
+  std::shared_ptr<task_type> make_task(const std::string &version) {
+    auto task = std::make_shared<task_type>(0);
+    task->model_version = version;
+    return task;
+  }
+} // namespace
+
+TEST_CASE("routing scheduler") {
+  SUBCASE("processors only get subscribed keys") {
+    task_ns::routing_scheduler scheduler;
+    scheduler.add_processor(
+        {[]() { return std::make_unique<key_processor>("a"); }}, {"a"});
+    scheduler.add_processor(
+        {[]() { return std::make_unique<key_processor>("b"); }}, {"b"});
+
+    std::vector<std::shared_ptr<task_type>> tasks;
+    for (int i = 0; i < 50; i++) {
+      tasks.emplace_back(make_task(i % 2 == 0 ? "a" : "b"));
+      scheduler.submit(tasks.back());
+    }
+    for (auto const &task : tasks) {
+      CHECK_EQ(task->get_result(1s).value(), task->model_version);
+    }
+
+    // 沒有processor訂閱的鍵不會進入隊列永遠等待
+    auto unrouted = make_task("c");
+    scheduler.submit(unrouted);
+    CHECK(unrouted->is_invalid());
+    CHECK_FALSE(scheduler.try_submit(make_task("c")).has_value());
+  }
+
+  SUBCASE("batches are homogeneous") {
+    key_processor::mixed_batches = 0;
+    task_ns::routing_scheduler scheduler;
+    scheduler.add_processor(
+        {[]() { return std::make_unique<key_processor>("any"); }}, {});
+    std::vector<std::shared_ptr<task_type>> tasks;
+    for (int i = 0; i < 60; i++) {
+      tasks.emplace_back(make_task(std::to_string(i % 3)));
+    }
+    scheduler.submit_batch(
+        std::vector<std::shared_ptr<task_ns::base_task>>(tasks.begin(),
+                                                         tasks.end()));
+    for (auto const &task : tasks) {
+      CHECK(task->wait_done(1s));
+    }
+    CHECK_EQ(key_processor::mixed_batches.load(), 0);
+  }
+
+  SUBCASE("custom key") {
+    task_ns::routing_scheduler scheduler([](const task_ns::base_task &task) {
+      return dynamic_cast<const task_type &>(task).get_argument() < 10
+                 ? std::string("small")
+                 : std::string("large");
+    });
+    scheduler.add_processor(
+        {[]() { return std::make_unique<key_processor>("small"); }},
+        {"small"});
+    scheduler.add_processor(
+        {[]() { return std::make_unique<key_processor>("large"); }},
+        {"large"});
+    auto small_task = std::make_shared<task_type>(1);
+    auto large_task = std::make_shared<task_type>(100);
+    scheduler.submit(small_task);
+    scheduler.submit(large_task);
+    CHECK_EQ(small_task->get_result(1s).value(), "small");
+    CHECK_EQ(large_task->get_result(1s).value(), "large");
+  }
+}
@@ -0,0 +1,205 @@
+/*!
+ * \file timer_scheduler_test.cpp
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../queue_scheduler.hpp"
+#include "../timer_scheduler.hpp"
+#include "../timer_wheel.hpp"
+
+namespace {
+  using task_type = cyy::naive_lib::task::task<>;
+
+  //! \brief 記錄被處理的時間，用來檢查定時器沒有提前觸發
+  class timed_task : public task_type {
+  public:
+    std::atomic<std::chrono::steady_clock::time_point> processed_at{};
+  };
+
+  class notify_processor : public cyy::naive_lib::task::base_processor {
+  public:
+    ~notify_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+        override {
+      for (auto &task : tasks) {
+        if (auto timed = std::dynamic_pointer_cast<timed_task>(task)) {
+          timed->processed_at = std::chrono::steady_clock::now();
+        }
+        std::dynamic_pointer_cast<task_type>(task)->result_promise.set_value();
+      }
+    }
+  };
+
+  std::shared_ptr<cyy::naive_lib::task::queue_scheduler> make_target() {
+    return std::make_shared<cyy::naive_lib::task::queue_scheduler>(
+        std::vector<cyy::naive_lib::task::queue_scheduler::processor_factory>{
+            []() { return std::make_unique<notify_processor>(); }});
+  }
+} // namespace
+
+TEST_CASE("timer wheel") {
+  using cyy::naive_lib::task::timer_wheel;
+
+  SUBCASE("timers fire at their tick across levels") {
+    timer_wheel wheel;
+    std::vector<timer_wheel::fired_timer> fired;
+    std::mt19937_64 gen(42);
+    std::map<timer_wheel::timer_id, uint64_t> expiry;
+    for (int i = 0; i < 2000; i++) {
+      // 覆蓋全部4層以及超出範圍的定時器
+      auto tick = gen() >> (gen() % 64);
+      tick %= uint64_t(1) << 34;
+      expiry[wheel.add(tick, std::make_shared<task_type>())] = tick;
+    }
+    CHECK_EQ(wheel.size(), 2000);
+    uint64_t last = 0;
+    while (!wheel.empty()) {
+      auto next = wheel.next_event_tick();
+      REQUIRE(next);
+      auto to = *next + gen() % 3;
+      wheel.advance(to, fired);
+      for (auto const &timer : fired) {
+        REQUIRE(expiry.contains(timer.id));
+        // 過去的時間在添加後的第一個tick觸發
+        auto tick = std::max<uint64_t>(expiry[timer.id], 1);
+        CHECK_GT(tick, last);
+        CHECK_LE(tick, to);
+        expiry.erase(timer.id);
+      }
+      fired.clear();
+      last = to;
+    }
+    CHECK(expiry.empty());
+  }
+
+  SUBCASE("cancel") {
+    timer_wheel wheel;
+    std::vector<timer_wheel::fired_timer> fired;
+    auto task = std::make_shared<task_type>();
+    auto id = wheel.add(100000, task);
+    wheel.add(10, std::make_shared<task_type>());
+    auto cancelled = wheel.cancel(id);
+    REQUIRE(cancelled);
+    CHECK_EQ(cancelled->get(), task.get());
+    CHECK(!wheel.cancel(id));
+    wheel.advance(200000, fired);
+    CHECK_EQ(fired.size(), 1);
+    CHECK(wheel.empty());
+    // 節點被重用後舊的id仍然無效
+    wheel.add(200010, std::make_shared<task_type>());
+    CHECK(!wheel.cancel(id));
+  }
+
+  SUBCASE("periodic timer keeps its phase") {
+    timer_wheel wheel;
+    std::vector<timer_wheel::fired_timer> fired;
+    auto factory = std::make_shared<const timer_wheel::task_factory>(
+        []() { return std::make_shared<task_type>(); });
+    auto id = wheel.add_periodic(5, 300, factory);
+    wheel.advance(5, fired);
+    CHECK_EQ(fired.size(), 1);
+    fired.clear();
+    // 錯過的周期合併成一次
+    wheel.advance(1000, fired);
+    CHECK_EQ(fired.size(), 1);
+    fired.clear();
+    CHECK_EQ(wheel.next_event_tick().value(), 1024);
+    wheel.advance(1205, fired);
+    CHECK_EQ(fired.size(), 1);
+    fired.clear();
+    CHECK(wheel.cancel(id));
+    CHECK(wheel.empty());
+  }
+}
+
+TEST_CASE("timer scheduler") {
+  using namespace std::chrono_literals;
+  SUBCASE("delayed task") {
+    cyy::naive_lib::task::timer_scheduler scheduler(make_target());
+    auto task = std::make_shared<timed_task>();
+    auto begin = std::chrono::steady_clock::now();
+    scheduler.schedule_after(task, 50ms);
+    REQUIRE(task->wait_done(5s));
+    // 只檢查下界，繁忙的機器上觸發可能晚很多
+    CHECK_GE(task->processed_at.load() - begin, 50ms);
+  }
+
+  SUBCASE("direct schedule is forwarded") {
+    cyy::naive_lib::task::timer_scheduler scheduler(make_target());
+    CHECK(scheduler.schedule(std::make_shared<task_type>(), 1s));
+  }
+
+  SUBCASE("periodic task and cancel") {
+    cyy::naive_lib::task::timer_scheduler scheduler(make_target());
+    std::mutex mu;
+    std::vector<std::chrono::steady_clock::time_point> fire_times;
+    auto begin = std::chrono::steady_clock::now();
+    auto id = scheduler.schedule_every(
+        [&]() {
+          std::lock_guard lk(mu);
+          fire_times.push_back(std::chrono::steady_clock::now());
+          return std::make_shared<task_type>();
+        },
+        10ms);
+    auto fired_num = [&]() {
+      std::lock_guard lk(mu);
+      return fire_times.size();
+    };
+    for (int i = 0; i < 500 && fired_num() < 3; i++) {
+      std::this_thread::sleep_for(10ms);
+    }
+    CHECK(scheduler.cancel(id));
+    auto fired = fired_num();
+    REQUIRE_GE(fired, 3);
+    {
+      // 錯過的周期會合併，所以第i次觸發不早於第i+1個周期
+      std::lock_guard lk(mu);
+      for (size_t i = 0; i < fire_times.size(); i++) {
+        CHECK_GE(fire_times[i] - begin, 10ms * (i + 1));
+      }
+    }
+    // 取消時正在觸發的那一次可能還會調用factory
+    std::this_thread::sleep_for(30ms);
+    CHECK_LE(fired_num(), fired + 1);
+    CHECK_EQ(scheduler.pending_timers(), 0);
+  }
+
+  SUBCASE("cancelled task is invalid") {
+    cyy::naive_lib::task::timer_scheduler scheduler(make_target());
+    auto task = std::make_shared<task_type>();
+    auto id = scheduler.schedule_after(task, 1h);
+    CHECK(scheduler.cancel(id));
+    CHECK(task->is_invalid());
+    CHECK(!scheduler.cancel(id));
+  }
+
+  SUBCASE("many timers") {
+    cyy::naive_lib::task::timer_scheduler scheduler(make_target());
+    std::vector<std::shared_ptr<task_type>> tasks;
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < 20000; i++) {
+      auto task = std::make_shared<task_type>();
+      scheduler.schedule_at(task, now + std::chrono::microseconds(i * 10));
+      tasks.emplace_back(std::move(task));
+    }
+    // 很遠的定時器留在高層，不影響近處的定時器
+    for (int i = 0; i < 20000; i++) {
+      scheduler.schedule_after(std::make_shared<task_type>(), 1h + i * 1s);
+    }
+    for (auto &task : tasks) {
+      CHECK(task->wait_done(5s));
+    }
+    CHECK_EQ(scheduler.pending_timers(), 20000);
+  }
+}
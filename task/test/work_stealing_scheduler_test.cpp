@@ -0,0 +1,296 @@
+/*!
+ * \file work_stealing_scheduler_test.cpp
+ *
+ */
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../neural_network_task.hpp"
+#include "../work_stealing_scheduler.hpp"
+
+namespace {
+  using task_type = cyy::naive_lib::task::neural_network_task<int, int>;
+
+  class succ_processor : public cyy::naive_lib::task::base_processor {
+  public:
+    explicit succ_processor(std::chrono::milliseconds delay_ = {})
+        : delay(delay_) {}
+    ~succ_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+        override {
+      std::this_thread::sleep_for(delay);
+      for (auto &task : tasks) {
+        auto ptr = std::dynamic_pointer_cast<task_type>(task);
+        ptr->result_promise.set_value(ptr->get_argument() + 1);
+      }
+    }
+
+  private:
+    std::chrono::milliseconds delay;
+  };
+
+  //! \brief 開閘前不返回，模擬一直忙碌的processor
+  class gated_processor : public cyy::naive_lib::task::base_processor {
+  public:
+    explicit gated_processor(std::atomic<bool> &gate_) : gate(gate_) {}
+    ~gated_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+        override {
+      if (tasks.empty()) {
+        return;
+      }
+      gate.wait(false);
+      for (auto &task : tasks) {
+        auto ptr = std::dynamic_pointer_cast<task_type>(task);
+        ptr->result_promise.set_value(ptr->get_argument() + 1);
+      }
+    }
+
+  private:
+    std::atomic<bool> &gate;
+  };
+
+  class counting_processor : public cyy::naive_lib::task::base_processor {
+  public:
+    explicit counting_processor(std::atomic<size_t> &cnt_) : cnt(cnt_) {}
+    ~counting_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+        override {
+      for (auto &task : tasks) {
+        auto ptr = std::dynamic_pointer_cast<task_type>(task);
+        ptr->result_promise.set_value(ptr->get_argument() + 1);
+        cnt++;
+      }
+    }
+
+  private:
+    std::atomic<size_t> &cnt;
+  };
+
+  //! \brief 處理任務時提交參數個子任務
+  class fan_out_processor : public cyy::naive_lib::task::base_processor {
+  public:
+    fan_out_processor(cyy::naive_lib::task::work_stealing_scheduler &scheduler_,
+                      std::mutex &children_mutex_,
+                      std::vector<std::shared_ptr<task_type>> &children_)
+        : scheduler(scheduler_), children_mutex(children_mutex_),
+          children(children_) {}
+    ~fan_out_processor() override { stop(); }
+    void process_tasks(
+        std::vector<std::shared_ptr<cyy::naive_lib::task::base_task>> &tasks)
+        override {
+      for (auto &task : tasks) {
+        auto ptr = std::dynamic_pointer_cast<task_type>(task);
+        for (int i = 0; i < ptr->get_argument(); i++) {
+          auto child = std::make_shared<task_type>(0);
+          {
+            std::lock_guard lk(children_mutex);
+            children.push_back(child);
+          }
+          scheduler.submit(child);
+        }
+        ptr->result_promise.set_value(ptr->get_argument() + 1);
+      }
+    }
+
+  private:
+    cyy::naive_lib::task::work_stealing_scheduler &scheduler;
+    std::mutex &children_mutex;
+    std::vector<std::shared_ptr<task_type>> &children;
+  };
+} // namespace
+
+TEST_CASE("work stealing scheduler") {
+  using namespace std::chrono_literals;
+  SUBCASE("finish task processing") {
+    cyy::naive_lib::task::work_stealing_scheduler scheduler(
+        {[]() { return std::make_unique<succ_processor>(); },
+         []() { return std::make_unique<succ_processor>(); }});
+
+    auto task_ptr = std::make_shared<task_type>(1);
+    CHECK(scheduler.schedule(task_ptr, 1s));
+    CHECK_EQ(task_ptr->get_result().value(), 2);
+  }
+
+  SUBCASE("concurrent producers") {
+    std::vector<cyy::naive_lib::task::work_stealing_scheduler::processor_factory>
+        makers(4, []() { return std::make_unique<succ_processor>(); });
+    cyy::naive_lib::task::work_stealing_scheduler scheduler(makers);
+
+    std::atomic<size_t> succ_cnt{0};
+    std::vector<std::jthread> producers;
+    for (int i = 0; i < 4; i++) {
+      producers.emplace_back([&scheduler, &succ_cnt, i] {
+        for (int j = 0; j < 50; j++) {
+          auto task_ptr = std::make_shared<task_type>(i * 100 + j);
+          if (scheduler.schedule(task_ptr, 5s) &&
+              task_ptr->get_result().value() == i * 100 + j + 1) {
+            succ_cnt++;
+          }
+        }
+      });
+    }
+    producers.clear();
+    CHECK_EQ(succ_cnt.load(), 200);
+  }
+
+  SUBCASE("idle processor steals from busy one") {
+    std::atomic<bool> gate{false};
+    std::atomic<size_t> idle_cnt{0};
+    cyy::naive_lib::task::work_stealing_scheduler scheduler(
+        {[&gate]() { return std::make_unique<gated_processor>(gate); },
+         [&idle_cnt]() {
+           return std::make_unique<counting_processor>(idle_cnt);
+         }});
+
+    std::vector<std::shared_ptr<task_type>> tasks;
+    for (int i = 0; i < 8; i++) {
+      tasks.emplace_back(std::make_shared<task_type>(i));
+      scheduler.submit(tasks.back());
+    }
+    // 任務輪流放入兩個隊列，忙碌的processor最多取走一個，
+    // 其餘任務中有一半只能被空閒的processor從忙碌者的隊列中竊取
+    for (int i = 0; i < 500 && idle_cnt.load() < 7; i++) {
+      std::this_thread::sleep_for(10ms);
+    }
+    CHECK_GE(idle_cnt.load(), 7);
+    gate = true;
+    gate.notify_all();
+    for (auto &task : tasks) {
+      CHECK(task->wait_done(5s));
+      CHECK(task->get_result().has_value());
+    }
+  }
+
+  SUBCASE("replace processors keeps queued tasks") {
+    cyy::naive_lib::task::work_stealing_scheduler scheduler(
+        {[]() { return std::make_unique<succ_processor>(100ms); }});
+
+    std::vector<std::shared_ptr<task_type>> tasks;
+    std::vector<std::jthread> producers;
+    for (int i = 0; i < 4; i++) {
+      auto task = std::make_shared<task_type>(i);
+      tasks.push_back(task);
+      producers.emplace_back(
+          [&scheduler, task] { scheduler.schedule(task, 5s); });
+    }
+    scheduler.replace_processor(
+        {[]() { return std::make_unique<succ_processor>(); }});
+    producers.clear();
+    for (auto &task : tasks) {
+      CHECK(task->get_result().has_value());
+    }
+  }
+
+  SUBCASE("full queues block producers") {
+    cyy::naive_lib::task::work_stealing_scheduler scheduler;
+    scheduler.set_worker_queue_capacity(2);
+    scheduler.add_processor(
+        {[]() { return std::make_unique<succ_processor>(5ms); }});
+
+    std::atomic<size_t> succ_cnt{0};
+    std::vector<std::jthread> producers;
+    for (int i = 0; i < 4; i++) {
+      producers.emplace_back([&scheduler, &succ_cnt, i] {
+        for (int j = 0; j < 5; j++) {
+          auto task_ptr = std::make_shared<task_type>(i * 100 + j);
+          if (scheduler.schedule(task_ptr, 5s) &&
+              task_ptr->get_result().value() == i * 100 + j + 1) {
+            succ_cnt++;
+          }
+        }
+      });
+    }
+    producers.clear();
+    CHECK_EQ(succ_cnt.load(), 20);
+  }
+
+  SUBCASE("processor threads never block on full queues") {
+    cyy::naive_lib::task::work_stealing_scheduler scheduler;
+    scheduler.set_worker_queue_capacity(2);
+    std::mutex children_mutex;
+    std::vector<std::shared_ptr<task_type>> children;
+    scheduler.add_processor({[&]() {
+      return std::make_unique<fan_out_processor>(scheduler, children_mutex,
+                                                 children);
+    }});
+    // 唯一的processor提交的子任務超過隊列容量，只能等它自己處理，等待空位就會死鎖
+    auto parent = std::make_shared<task_type>(16);
+    CHECK(scheduler.schedule(parent, 5s));
+    std::lock_guard lk(children_mutex);
+    CHECK_EQ(children.size(), 16);
+    for (auto &child : children) {
+      CHECK(child->wait_done(5s));
+      CHECK(child->get_result().has_value());
+    }
+  }
+
+  SUBCASE("full queues wait no longer than the deadline") {
+    std::atomic<bool> gate{false};
+    cyy::naive_lib::task::work_stealing_scheduler scheduler;
+    scheduler.set_worker_queue_capacity(2);
+    scheduler.add_processor(
+        {[&gate]() { return std::make_unique<gated_processor>(gate); }});
+
+    // 等processor取走第一個任務卡住，之後隊列不會再騰出空位
+    std::vector<std::shared_ptr<task_type>> tasks{
+        std::make_shared<task_type>(0)};
+    scheduler.submit(tasks.back());
+    auto busy = [&scheduler]() {
+      bool res = false;
+      scheduler.foreach_processor([&res](auto const *processor) {
+        res = processor->is_processing();
+        return true;
+      });
+      return res;
+    };
+    for (int i = 0; i < 500 && !busy(); i++) {
+      std::this_thread::sleep_for(1ms);
+    }
+    REQUIRE(busy());
+    for (int i = 0; i < 100; i++) {
+      auto task = std::make_shared<task_type>(i);
+      if (!scheduler.try_submit(task)) {
+        break;
+      }
+      tasks.push_back(task);
+    }
+    CHECK_LT(tasks.size(), 100);
+
+    auto late_task = std::make_shared<task_type>(0);
+    auto begin = std::chrono::steady_clock::now();
+    late_task->set_deadline(begin + 50ms);
+    scheduler.submit(late_task);
+    CHECK(late_task->is_invalid());
+    CHECK_LT(std::chrono::steady_clock::now() - begin, 1s);
+
+    gate = true;
+    gate.notify_all();
+    for (auto &task : tasks) {
+      CHECK(task->wait_done(5s));
+    }
+  }
+
+  SUBCASE("numa node placement") {
+    cyy::naive_lib::task::work_stealing_scheduler scheduler;
+    scheduler.set_processor_placement(
+        cyy::naive_lib::task::processor_placement::numa_node);
+    scheduler.add_processor({[]() { return std::make_unique<succ_processor>(); },
+                             []() { return std::make_unique<succ_processor>(); }});
+    scheduler.foreach_processor([](auto const *processor) {
+      CHECK(!processor->get_cpu_affinity().empty());
+      return false;
+    });
+    auto task = std::make_shared<task_type>(1);
+    CHECK(scheduler.schedule(task, 1s));
+    CHECK_EQ(task->get_result().value(), 2);
+  }
+}
@@ -0,0 +1,152 @@
+/*!
+ * \file timer_scheduler.cpp
+ *
+ * \brief 定時和周期任務的调度器
+ */
+
+#include "timer_scheduler.hpp"
+
+#include <stdexcept>
+
+#include "log/log.hpp"
+
+namespace cyy::naive_lib::task {
+
+  timer_scheduler::timer_scheduler(std::shared_ptr<base_scheduler> target_,
+                                   std::chrono::microseconds tick_)
+      : target{std::move(target_)}, tick{tick_},
+        start_time{std::chrono::steady_clock::now()} {
+    if (!target) {
+      throw std::invalid_argument("target scheduler is empty");
+    }
+    if (tick.count() <= 0) {
+      throw std::invalid_argument("tick must be positive");
+    }
+    start("timer_scheduler");
+  }
+
+  timer_scheduler::~timer_scheduler() {
+    stop([this]() {
+      {
+        std::lock_guard lk(mu);
+        stopped = true;
+      }
+      cv.notify_all();
+    });
+    // 不會再觸發的任務標記為無效，叫醒等待者
+    for (auto &task : wheel.clear()) {
+      task->mark_invalid();
+    }
+  }
+
+  timer_scheduler::timer_id
+  timer_scheduler::schedule_at(const std::shared_ptr<base_task> &task,
+                               std::chrono::steady_clock::time_point tp) {
+    auto expiry_tick = to_tick(tp);
+    std::unique_lock lk(mu);
+    auto id = wheel.add(expiry_tick, task);
+    notify_if_earlier(expiry_tick);
+    return id;
+  }
+
+  timer_scheduler::timer_id timer_scheduler::schedule_every(
+      task_factory factory, std::chrono::nanoseconds period,
+      std::optional<std::chrono::steady_clock::time_point> first) {
+    if (!factory) {
+      throw std::invalid_argument("task factory is empty");
+    }
+    if (period.count() <= 0) {
+      throw std::invalid_argument("period must be positive");
+    }
+    // 周期向上取整到tick，至少一個tick
+    auto period_ticks = static_cast<uint64_t>(
+        (period + tick - std::chrono::nanoseconds(1)) / tick);
+    auto expiry_tick =
+        to_tick(first.value_or(std::chrono::steady_clock::now() + period));
+    std::unique_lock lk(mu);
+    auto id = wheel.add_periodic(
+        expiry_tick, period_ticks,
+        std::make_shared<const task_factory>(std::move(factory)));
+    notify_if_earlier(expiry_tick);
+    return id;
+  }
+
+  bool timer_scheduler::cancel(timer_id id) {
+    std::unique_lock lk(mu);
+    auto task_opt = wheel.cancel(id);
+    lk.unlock();
+    if (!task_opt) {
+      return false;
+    }
+    if (*task_opt) {
+      (*task_opt)->mark_invalid();
+    }
+    return true;
+  }
+
+  size_t timer_scheduler::pending_timers() {
+    std::lock_guard lk(mu);
+    return wheel.size();
+  }
+
+  void timer_scheduler::run(const std::stop_token & /*st*/) {
+    std::vector<timer_wheel::fired_timer> fired;
+    std::vector<std::shared_ptr<base_task>> tasks;
+    std::unique_lock lk(mu);
+    while (!stopped) {
+      auto now_tick = static_cast<uint64_t>(
+          (std::chrono::steady_clock::now() - start_time) / tick);
+      wheel.advance(now_tick, fired);
+      if (!fired.empty()) {
+        lk.unlock();
+        for (auto &timer : fired) {
+          if (timer.task) {
+            tasks.emplace_back(std::move(timer.task));
+            continue;
+          }
+          try {
+            auto task = (*timer.factory)();
+            if (task) {
+              tasks.emplace_back(std::move(task));
+            }
+          } catch (const std::exception &e) {
+            LOG_ERROR("periodic task factory failed:{}", e.what());
+          }
+        }
+        fired.clear();
+        // 整批交給下游，下游只需加一次鎖
+        target->submit_batch(tasks);
+        tasks.clear();
+        lk.lock();
+        continue;
+      }
+      auto next_tick = wheel.next_event_tick();
+      if (!next_tick) {
+        wakeup_tick = UINT64_MAX;
+        cv.wait(lk);
+      } else {
+        wakeup_tick = *next_tick;
+        cv.wait_until(lk,
+                      start_time + tick * static_cast<int64_t>(wakeup_tick));
+      }
+      wakeup_tick = 0;
+    }
+  }
+
+  uint64_t
+  timer_scheduler::to_tick(std::chrono::steady_clock::time_point tp) const {
+    if (tp <= start_time) {
+      return 0;
+    }
+    return static_cast<uint64_t>((tp - start_time + tick -
+                                  std::chrono::nanoseconds(1)) /
+                                 tick);
+  }
+
+  void timer_scheduler::notify_if_earlier(uint64_t expiry_tick) {
+    if (expiry_tick < wakeup_tick) {
+      wakeup_tick = expiry_tick;
+      cv.notify_one();
+    }
+  }
+} // namespace cyy::naive_lib::task
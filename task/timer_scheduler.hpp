@@ -0,0 +1,95 @@
+/*!
+ * \file timer_scheduler.hpp
+ *
+ * \brief 定時和周期任務的调度器
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "base_scheduler.hpp"
+#include "timer_wheel.hpp"
+#include "util/runnable.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 用一個綫程驅動分層時間輪，到期的任務交給下游调度器處理
+  //! \note 直接調度的任務立即轉交下游，定時任務用schedule_at和schedule_every
+  class timer_scheduler final : public base_scheduler,
+                                private cyy::naive_lib::runnable {
+  public:
+    using timer_id = timer_wheel::timer_id;
+    using task_factory = timer_wheel::task_factory;
+
+    //! \param target_ 處理到期任務的调度器
+    //! \param tick_ 時間輪的精度，定時任務在不早於到期時間的第一個tick觸發
+    explicit timer_scheduler(
+        std::shared_ptr<base_scheduler> target_,
+        std::chrono::microseconds tick_ = std::chrono::milliseconds(1));
+    ~timer_scheduler() override;
+
+    //! \brief 在tp時把任務交給下游调度器
+    //! \return 用於取消的id
+    timer_id schedule_at(const std::shared_ptr<base_task> &task,
+                         std::chrono::steady_clock::time_point tp);
+
+    //! \brief 在delay之後把任務交給下游调度器
+    timer_id schedule_after(const std::shared_ptr<base_task> &task,
+                            std::chrono::nanoseconds delay) {
+      return schedule_at(task, std::chrono::steady_clock::now() + delay);
+    }
+
+    //! \brief 每隔period用factory創建一個任務交給下游调度器
+    //! \param first 第一次觸發的時間，默認是一個周期之後
+    //! \note factory在定時器綫程中調用，返回nullptr時跳過這一次
+    timer_id schedule_every(
+        task_factory factory, std::chrono::nanoseconds period,
+        std::optional<std::chrono::steady_clock::time_point> first = {});
+
+    //! \brief 取消還沒觸發的定時器，一次性定時器的任務被標記為無效
+    //! \return 定時器已觸發或不存在時返回false
+    bool cancel(timer_id id);
+
+    //! \brief 等待觸發的定時器數
+    size_t pending_timers();
+
+  protected:
+    void enqueue(const std::shared_ptr<base_task> &task) override {
+      target->submit(task);
+    }
+
+    bool try_enqueue(const std::shared_ptr<base_task> &task) override {
+      return target->try_submit(task).has_value();
+    }
+
+    void
+    enqueue_batch(std::span<const std::shared_ptr<base_task>> tasks) override {
+      target->submit_batch(tasks);
+    }
+
+  private:
+    void run(const std::stop_token &st) override;
+
+    //! \brief 向上取整到tick，保證不提前觸發
+    uint64_t to_tick(std::chrono::steady_clock::time_point tp) const;
+    //! \brief 新定時器比定時器綫程計劃醒來的時間早時叫醒它
+    void notify_if_earlier(uint64_t expiry_tick);
+
+    std::shared_ptr<base_scheduler> target;
+    std::chrono::nanoseconds tick;
+    std::chrono::steady_clock::time_point start_time;
+
+    std::mutex mu;
+    std::condition_variable cv;
+    timer_wheel wheel;
+    //! \brief 定時器綫程計劃醒來的tick，無限期等待時為UINT64_MAX
+    uint64_t wakeup_tick{UINT64_MAX};
+    bool stopped{false};
+  };
+} // namespace cyy::naive_lib::task
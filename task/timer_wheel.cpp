@@ -0,0 +1,257 @@
+/*!
+ * \file timer_wheel.cpp
+ *
+ * \brief 分層時間輪
+ */
+
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace cyy::naive_lib::task {
+
+  namespace {
+    constexpr uint64_t max_delta = (uint64_t(1) << 32) - 1;
+    constexpr uint64_t slot_mask = timer_wheel::slot_num - 1;
+  } // namespace
+
+  timer_wheel::timer_wheel() { heads.fill(npos); }
+
+  timer_wheel::timer_id
+  timer_wheel::add(uint64_t expiry_tick, std::shared_ptr<base_task> task) {
+    return insert(expiry_tick, 0, std::move(task), {});
+  }
+
+  timer_wheel::timer_id
+  timer_wheel::add_periodic(uint64_t expiry_tick, uint64_t period_ticks,
+                            std::shared_ptr<const task_factory> factory) {
+    return insert(expiry_tick, period_ticks == 0 ? 1 : period_ticks, {},
+                  std::move(factory));
+  }
+
+  timer_wheel::timer_id
+  timer_wheel::insert(uint64_t expiry_tick, uint64_t period_ticks,
+                      std::shared_ptr<base_task> task,
+                      std::shared_ptr<const task_factory> factory) {
+    uint32_t index = 0;
+    if (!free_nodes.empty()) {
+      index = free_nodes.back();
+      free_nodes.pop_back();
+    } else {
+      index = static_cast<uint32_t>(nodes.size());
+      nodes.emplace_back();
+    }
+    auto &n = nodes[index];
+    n.expiry_tick = expiry_tick;
+    n.period_ticks = period_ticks;
+    n.task = std::move(task);
+    n.factory = std::move(factory);
+    timer_num++;
+    // 已經到期的定時器放到下一個要處理的槽
+    place(index, std::max(expiry_tick, current_tick + 1));
+    return (static_cast<timer_id>(n.generation) << 32) | index;
+  }
+
+  std::optional<std::shared_ptr<base_task>>
+  timer_wheel::cancel(timer_id id) {
+    auto index = static_cast<uint32_t>(id & UINT32_MAX);
+    auto generation = static_cast<uint32_t>(id >> 32);
+    if (index >= nodes.size() || nodes[index].generation != generation ||
+        nodes[index].slot == npos) {
+      return {};
+    }
+    unlink(index);
+    auto task = std::move(nodes[index].task);
+    release(index);
+    return task;
+  }
+
+  std::vector<std::shared_ptr<base_task>> timer_wheel::clear() {
+    std::vector<std::shared_ptr<base_task>> tasks;
+    for (uint32_t index = 0; index < nodes.size(); index++) {
+      if (nodes[index].slot == npos) {
+        continue;
+      }
+      if (nodes[index].task) {
+        tasks.emplace_back(std::move(nodes[index].task));
+      }
+      nodes[index].slot = npos;
+      release(index);
+    }
+    heads.fill(npos);
+    occupied = {};
+    return tasks;
+  }
+
+  void timer_wheel::advance(uint64_t to_tick, std::vector<fired_timer> &fired) {
+    while (current_tick < to_tick) {
+      auto next_tick = next_event_tick();
+      if (!next_tick || *next_tick > to_tick) {
+        // 中間沒有要處理的槽，直接跳過
+        current_tick = to_tick;
+        return;
+      }
+      current_tick = *next_tick;
+      // 先搬動高層的槽，其中在本tick到期的定時器落到第0層的當前槽
+      size_t level = 0;
+      while (level + 1 < level_num &&
+             (current_tick & ((uint64_t(1) << (level_bits * (level + 1))) -
+                              1)) == 0) {
+        level++;
+      }
+      for (; level > 0; level--) {
+        cascade(level, (current_tick >> (level_bits * level)) & slot_mask);
+      }
+      expire(current_tick & slot_mask, to_tick, fired);
+    }
+  }
+
+  std::optional<uint64_t> timer_wheel::next_event_tick() const {
+    if (timer_num == 0) {
+      return {};
+    }
+    std::optional<uint64_t> next_tick;
+    for (size_t level = 0; level < level_num; level++) {
+      auto shift = level_bits * level;
+      auto base = current_tick >> shift;
+      auto from = static_cast<size_t>((base + 1) & slot_mask);
+      auto slot = next_occupied(level, from);
+      if (!slot) {
+        continue;
+      }
+      auto distance = ((*slot + slot_num - from) & slot_mask) + 1;
+      auto tick = (base + distance) << shift;
+      if (!next_tick || tick < *next_tick) {
+        next_tick = tick;
+      }
+    }
+    return next_tick;
+  }
+
+  void timer_wheel::place(uint32_t index, uint64_t at_tick) {
+    auto delta = at_tick - current_tick;
+    if (delta > max_delta) {
+      // 超出時間輪範圍的定時器先放在最高層，搬動時再重新計算
+      delta = max_delta;
+      at_tick = current_tick + max_delta;
+    }
+    size_t level = 0;
+    while (level + 1 < level_num &&
+           delta >= (uint64_t(1) << (level_bits * (level + 1)))) {
+      level++;
+    }
+    link(index, static_cast<uint32_t>(
+                    level * slot_num +
+                    ((at_tick >> (level_bits * level)) & slot_mask)));
+  }
+
+  void timer_wheel::link(uint32_t index, uint32_t slot) {
+    auto &n = nodes[index];
+    n.slot = slot;
+    n.prev = npos;
+    n.next = heads[slot];
+    if (n.next != npos) {
+      nodes[n.next].prev = index;
+    }
+    heads[slot] = index;
+    occupied[slot / slot_num][(slot % slot_num) / 64] |= uint64_t(1)
+                                                          << (slot % 64);
+  }
+
+  void timer_wheel::unlink(uint32_t index) {
+    auto &n = nodes[index];
+    if (n.prev != npos) {
+      nodes[n.prev].next = n.next;
+    } else {
+      heads[n.slot] = n.next;
+    }
+    if (n.next != npos) {
+      nodes[n.next].prev = n.prev;
+    }
+    if (heads[n.slot] == npos) {
+      occupied[n.slot / slot_num][(n.slot % slot_num) / 64] &=
+          ~(uint64_t(1) << (n.slot % 64));
+    }
+    n.slot = npos;
+    n.prev = npos;
+    n.next = npos;
+  }
+
+  void timer_wheel::release(uint32_t index) {
+    auto &n = nodes[index];
+    n.task.reset();
+    n.factory.reset();
+    n.slot = npos;
+    n.generation++;
+    if (n.generation == 0) {
+      n.generation = 1;
+    }
+    free_nodes.push_back(index);
+    timer_num--;
+  }
+
+  void timer_wheel::cascade(size_t level, size_t slot) {
+    auto slot_index = static_cast<uint32_t>(level * slot_num + slot);
+    auto index = heads[slot_index];
+    heads[slot_index] = npos;
+    occupied[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    while (index != npos) {
+      auto next = nodes[index].next;
+      place(index, nodes[index].expiry_tick);
+      index = next;
+    }
+  }
+
+  void timer_wheel::expire(size_t slot, uint64_t to_tick,
+                           std::vector<fired_timer> &fired) {
+    auto index = heads[slot];
+    heads[slot] = npos;
+    occupied[0][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    while (index != npos) {
+      auto &n = nodes[index];
+      auto next = n.next;
+      n.slot = npos;
+      if (n.expiry_tick > current_tick) {
+        // 超出範圍被截斷過的定時器還沒到期
+        place(index, n.expiry_tick);
+        index = next;
+        continue;
+      }
+      fired_timer timer;
+      timer.id = (static_cast<timer_id>(n.generation) << 32) | index;
+      if (n.period_ticks == 0) {
+        timer.task = std::move(n.task);
+        release(index);
+      } else {
+        timer.factory = n.factory;
+        // 本次推進中錯過的周期合併成一次，下次觸發仍落在原來的節拍上
+        n.expiry_tick +=
+            ((to_tick - n.expiry_tick) / n.period_ticks + 1) * n.period_ticks;
+        place(index, n.expiry_tick);
+      }
+      fired.emplace_back(std::move(timer));
+      index = next;
+    }
+  }
+
+  std::optional<size_t> timer_wheel::next_occupied(size_t level,
+                                                   size_t from) const {
+    auto const &bits = occupied[level];
+    constexpr size_t word_num = slot_num / 64;
+    // 從from開始環形地查找，最多看word_num + 1個字
+    for (size_t i = 0; i <= word_num; i++) {
+      auto word_index = (from / 64 + i) % word_num;
+      auto word = bits[word_index];
+      if (i == 0) {
+        word &= ~uint64_t(0) << (from % 64);
+      } else if (i == word_num) {
+        word &= (uint64_t(1) << (from % 64)) - 1;
+      }
+      if (word != 0) {
+        return word_index * 64 + static_cast<size_t>(std::countr_zero(word));
+      }
+    }
+    return {};
+  }
+} // namespace cyy::naive_lib::task
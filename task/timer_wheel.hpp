@@ -0,0 +1,110 @@
+/*!
+ * \file timer_wheel.hpp
+ *
+ * \brief 分層時間輪
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "base_task.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 分層時間輪，4層各256個槽，以tick為單位計時
+  //! \note 添加、取消都是O(1)，推進時每個定時器最多被搬動3次；
+  //! 不是綫程安全的，由timer_scheduler加鎖使用
+  class timer_wheel {
+  public:
+    //! \brief 高32位是代數，低32位是節點下標，節點重用後舊的id失效
+    using timer_id = uint64_t;
+    using task_factory = std::function<std::shared_ptr<base_task>()>;
+
+    static constexpr size_t level_bits = 8;
+    static constexpr size_t slot_num = size_t(1) << level_bits;
+    static constexpr size_t level_num = 4;
+
+    //! \brief 到期的定時器
+    struct fired_timer {
+      timer_id id{0};
+      //! \brief 一次性定時器的任務
+      std::shared_ptr<base_task> task;
+      //! \brief 周期定時器用來創建每次的任務
+      std::shared_ptr<const task_factory> factory;
+    };
+
+    timer_wheel();
+
+    //! \brief 添加一次性定時器
+    //! \param expiry_tick 到期的tick，不晚於當前tick時在下一次推進時觸發
+    timer_id add(uint64_t expiry_tick, std::shared_ptr<base_task> task);
+
+    //! \brief 添加周期定時器，每次觸發後按固定間隔重新安排，不累積誤差
+    timer_id add_periodic(uint64_t expiry_tick, uint64_t period_ticks,
+                          std::shared_ptr<const task_factory> factory);
+
+    //! \brief 取消還沒觸發的定時器
+    //! \return 定時器不存在時返回空，否則返回一次性定時器的任務（周期定時器為nullptr）
+    std::optional<std::shared_ptr<base_task>> cancel(timer_id id);
+
+    //! \brief 刪除所有定時器
+    //! \return 一次性定時器的任務
+    std::vector<std::shared_ptr<base_task>> clear();
+
+    //! \brief 推進到to_tick，收集期間到期的定時器
+    void advance(uint64_t to_tick, std::vector<fired_timer> &fired);
+
+    //! \brief 下一次推進可能觸發定時器或需要搬動上層槽的tick
+    //! \return 沒有定時器時返回空
+    std::optional<uint64_t> next_event_tick() const;
+
+    uint64_t get_current_tick() const noexcept { return current_tick; }
+    size_t size() const noexcept { return timer_num; }
+    bool empty() const noexcept { return timer_num == 0; }
+
+  private:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    struct node {
+      uint64_t expiry_tick{0};
+      uint64_t period_ticks{0};
+      uint32_t prev{npos};
+      uint32_t next{npos};
+      uint32_t generation{1};
+      //! \brief 所在的槽，level * slot_num + slot，空閒時為npos
+      uint32_t slot{npos};
+      std::shared_ptr<base_task> task;
+      std::shared_ptr<const task_factory> factory;
+    };
+
+    timer_id insert(uint64_t expiry_tick, uint64_t period_ticks,
+                    std::shared_ptr<base_task> task,
+                    std::shared_ptr<const task_factory> factory);
+    //! \brief 按at_tick與當前tick的距離選擇層和槽
+    void place(uint32_t index, uint64_t at_tick);
+    void link(uint32_t index, uint32_t slot);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    //! \brief 把上層槽中的定時器重新放到更低的層
+    void cascade(size_t level, size_t slot);
+    //! \param to_tick 本次推進的終點，周期定時器重新安排到它之後
+    void expire(size_t slot, uint64_t to_tick, std::vector<fired_timer> &fired);
+    //! \brief 從from開始找某一層下一個非空的槽
+    std::optional<size_t> next_occupied(size_t level, size_t from) const;
+
+    std::vector<node> nodes;
+    std::vector<uint32_t> free_nodes;
+    std::array<uint32_t, level_num * slot_num> heads;
+    //! \brief 每層槽是否非空的位圖
+    std::array<std::array<uint64_t, slot_num / 64>, level_num> occupied{};
+    uint64_t current_tick{0};
+    size_t timer_num{0};
+  };
+} // namespace cyy::naive_lib::task
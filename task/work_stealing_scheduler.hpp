@@ -0,0 +1,509 @@
+/*!
+ * \file work_stealing_scheduler.hpp
+ *
+ * \brief scheduler based on per-processor queues and work stealing
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base_processor.hpp"
+#include "base_scheduler.hpp"
+#include "metrics.hpp"
+#include "processor_placement.hpp"
+#include "util/atomic_wait.hpp"
+#include "util/mpmc_ring.hpp"
+
+namespace cyy::naive_lib::task {
+
+  //! \brief 每個處理器擁有自己的任務隊列，空閒的處理器從其它隊列竊取任務
+  //! \note 與queue_scheduler接口一致，可以直接替換
+  class work_stealing_scheduler : public base_scheduler {
+  public:
+    using processor_factory = std::function<std::unique_ptr<base_processor>()>;
+
+  public:
+    work_stealing_scheduler() = default;
+    work_stealing_scheduler(const work_stealing_scheduler &) = delete;
+    work_stealing_scheduler &
+    operator=(const work_stealing_scheduler &) = delete;
+    work_stealing_scheduler(work_stealing_scheduler &&) = delete;
+    work_stealing_scheduler &operator=(work_stealing_scheduler &&) = delete;
+
+    explicit work_stealing_scheduler(
+        const std::vector<processor_factory> &makers) {
+      this->replace_processor(makers);
+    }
+
+    void replace_processor(const std::vector<processor_factory> &makers) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      auto [new_processors, new_queues] = make_processors(makers, 0);
+      auto old_queues = std::move(worker_queues);
+      worker_queues = std::move(new_queues);
+      publish_queues();
+
+      auto old_processors = std::move(processors);
+      processors = std::move(new_processors);
+      // 先停掉舊的processor，再把它們隊列中剩下的任務轉交給新的隊列
+      old_processors.clear();
+      for (auto &queue : old_queues) {
+        for (auto &task : queue->close()) {
+          if (!push_task(task, true)) {
+            task->mark_invalid();
+          }
+        }
+      }
+    }
+
+    void add_processor(const std::vector<processor_factory> &makers) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      auto [new_processors, new_queues] =
+          make_processors(makers, processors.size());
+      for (auto &processor : new_processors) {
+        processors.emplace_back(std::move(processor));
+      }
+      for (auto &queue : new_queues) {
+        worker_queues.emplace_back(std::move(queue));
+      }
+      publish_queues();
+    }
+
+    //! \brief 設置之後創建的處理器的綫程放置方式，默認不綁定
+    //! \note 空閒的處理器優先從同一NUMA節點的隊列竊取任務
+    void set_processor_placement(processor_placement placement_) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      placement = placement_;
+    }
+
+    //! \brief 設置之後創建的處理器的隊列容量，默認為0，表示不限制
+    //! \note 所有隊列都滿時其它綫程上的提交者等待，最多等到任務的截止時間，超時的任務標記作廢；
+    //! processor綫程上提交的任務不等待，放入本地隊列的溢出區，避免處理器互相等待而死鎖
+    void set_worker_queue_capacity(size_t capacity) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      worker_queue_capacity = capacity;
+    }
+
+    //! \brief 輸出每個處理器的指標，處理器以processor標籤區分
+    void export_metrics(prometheus_writer &writer,
+                        const prometheus_writer::label_list &labels = {}) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      for (size_t i = 0; i < processors.size(); i++) {
+        auto processor_labels = labels;
+        processor_labels.emplace_back("processor", std::to_string(i));
+        writer.add(processors[i]->get_metrics(), "task_processor",
+                   processor_labels);
+      }
+    }
+
+    void foreach_processor(
+        const std::function<bool(const base_processor *)> &call_back) {
+      std::unique_lock<std::mutex> lk(processor_mutex);
+      for (const auto &processor : processors) {
+        if (call_back(processor.get()))
+          break;
+      }
+    }
+
+    ~work_stealing_scheduler() override {
+      // 與queue_scheduler相同，明確地先清理processors，不依賴成員的析構順序
+      processors.clear();
+    }
+
+  protected:
+    void enqueue(const std::shared_ptr<base_task> &task) override {
+      // 沒有processor或等待空位超過截止時間時任務無法被處理
+      if (!push_task(task, true)) {
+        task->mark_invalid();
+      }
+    }
+
+    bool try_enqueue(const std::shared_ptr<base_task> &task) override {
+      return push_task(task, false);
+    }
+
+    //! \brief 整批放入同一個隊列，再叫醒空閒的processor來竊取
+    void
+    enqueue_batch(std::span<const std::shared_ptr<base_task>> tasks) override {
+      if (tasks.empty()) {
+        return;
+      }
+      auto snapshot = queues.load(std::memory_order_acquire);
+      size_t cnt = 0;
+      if (snapshot && !snapshot->empty()) {
+        auto idx = next_queue.fetch_add(1, std::memory_order_relaxed) %
+                   snapshot->size();
+        bool was_empty = false;
+        cnt = (*snapshot)[idx]->push_back(tasks, was_empty);
+        if (cnt > 1 || (cnt == 1 && !was_empty)) {
+          for (size_t i = 1; i < snapshot->size(); i++) {
+            (*snapshot)[(idx + i) % snapshot->size()]->wake_to_steal();
+          }
+        }
+      }
+      // 隊列放不下或已關閉時，剩下的任務逐個分配
+      for (auto const &task : tasks.subspan(cnt)) {
+        enqueue(task);
+      }
+    }
+
+  private:
+    //! \brief 不限制容量時環形隊列的長度，放不下的任務進入溢出區
+    static constexpr size_t unbounded_ring_size = 4096;
+
+    //! \brief 單個處理器的無鎖任務隊列，主人和竊取者都從頭部取
+    //! \note 環形隊列只能從一端出隊，所以主人不再後進先出；
+    //! 任務按提交順序處理，代價是主人少了剛放入的任務仍在緩存中的好處。
+    //! 環形隊列滿時允許溢出的任務放入加鎖的溢出區，環形隊列取空後再取溢出區
+    class worker_queue {
+    public:
+      //! \param capacity 容量，0表示不限制
+      worker_queue(size_t node_, size_t capacity)
+          : node{node_}, bounded{capacity != 0},
+            tasks(capacity != 0 ? capacity : unbounded_ring_size) {}
+
+      //! \brief 主人綁定的NUMA節點
+      size_t get_node() const noexcept { return node; }
+
+      //! \param force 為true時忽略容量，放入溢出區
+      //! \return 隊列已關閉或已滿時返回false
+      bool push_back(const std::shared_ptr<base_task> &task, bool &was_empty,
+                     bool force = false) {
+        pusher_guard guard(*this);
+        if (!guard.open()) {
+          return false;
+        }
+        was_empty = empty();
+        if (!tasks.try_push(task)) {
+          if (bounded && !force) {
+            return false;
+          }
+          std::lock_guard lk(overflow_mutex);
+          overflow.push_back(task);
+          overflow_num.fetch_add(1, std::memory_order_release);
+        }
+        wake();
+        return true;
+      }
+
+      //! \brief 按順序放入任務，直到隊列滿；不限制容量時全部放入
+      //! \return 放入的任務數
+      size_t push_back(std::span<const std::shared_ptr<base_task>> new_tasks,
+                       bool &was_empty) {
+        pusher_guard guard(*this);
+        if (!guard.open()) {
+          return 0;
+        }
+        was_empty = empty();
+        size_t cnt = 0;
+        for (auto const &task : new_tasks) {
+          if (!tasks.try_push(task)) {
+            break;
+          }
+          cnt++;
+        }
+        if (!bounded && cnt < new_tasks.size()) {
+          std::lock_guard lk(overflow_mutex);
+          for (auto const &task : new_tasks.subspan(cnt)) {
+            overflow.push_back(task);
+          }
+          overflow_num.fetch_add(new_tasks.size() - cnt,
+                                 std::memory_order_release);
+          cnt = new_tasks.size();
+        }
+        if (cnt != 0) {
+          wake();
+        }
+        return cnt;
+      }
+
+      //! \brief 隊列滿時最多等待timeout
+      //! \return 隊列已關閉或超時返回false
+      bool push_back_wait(const std::shared_ptr<base_task> &task,
+                          const std::chrono::milliseconds &timeout) {
+        pusher_guard guard(*this);
+        if (!guard.open() || !tasks.push(task, timeout)) {
+          return false;
+        }
+        wake();
+        return true;
+      }
+
+      std::optional<std::shared_ptr<base_task>> try_pop_front() {
+        if (auto task = tasks.try_pop()) {
+          return task;
+        }
+        return pop_overflow();
+      }
+
+      std::optional<std::shared_ptr<base_task>> try_steal() {
+        return try_pop_front();
+      }
+
+      //! \brief 等待新任務或竊取通知
+      //! \return 超时返回false
+      bool wait_until(const std::chrono::steady_clock::time_point &deadline) {
+        sleeping.store(true, std::memory_order_relaxed);
+        // 與wake中先放入任務再讀sleeping配對，保證不會錯過喚醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto old = epoch.load(std::memory_order_acquire);
+        if (empty() && !steal_signal.load(std::memory_order_relaxed)) {
+          auto now = std::chrono::steady_clock::now();
+          if (now < deadline) {
+            cyy::naive_lib::atomic_wait_for(epoch, old, deadline - now);
+          }
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+        steal_signal.store(false, std::memory_order_relaxed);
+        return std::chrono::steady_clock::now() < deadline;
+      }
+
+      //! \brief 通知睡眠中的主人去別的隊列竊取任務
+      bool wake_to_steal() {
+        if (!sleeping.load(std::memory_order_relaxed)) {
+          return false;
+        }
+        steal_signal.store(true, std::memory_order_relaxed);
+        epoch.fetch_add(1, std::memory_order_release);
+        cyy::naive_lib::atomic_notify_one(epoch);
+        return true;
+      }
+
+      //! \brief 關閉隊列並取出剩下的任務
+      std::vector<std::shared_ptr<base_task>> close() {
+        closed.store(true, std::memory_order_seq_cst);
+        // 等正在放入的生產者結束，之後不會再有任務進入隊列
+        while (pushers.load(std::memory_order_seq_cst) != 0) {
+          std::this_thread::yield();
+        }
+        std::vector<std::shared_ptr<base_task>> left;
+        while (auto task = try_pop_front()) {
+          left.emplace_back(std::move(*task));
+        }
+        return left;
+      }
+
+    private:
+      //! \brief 登記正在放入任務的生產者，close據此等待它們結束
+      class pusher_guard {
+      public:
+        explicit pusher_guard(worker_queue &queue_) : queue{queue_} {
+          queue.pushers.fetch_add(1, std::memory_order_seq_cst);
+        }
+        pusher_guard(const pusher_guard &) = delete;
+        pusher_guard &operator=(const pusher_guard &) = delete;
+        ~pusher_guard() {
+          queue.pushers.fetch_sub(1, std::memory_order_seq_cst);
+        }
+        bool open() const {
+          return !queue.closed.load(std::memory_order_seq_cst);
+        }
+
+      private:
+        worker_queue &queue;
+      };
+
+      bool empty() const {
+        return tasks.size_approx() == 0 &&
+               overflow_num.load(std::memory_order_acquire) == 0;
+      }
+
+      std::optional<std::shared_ptr<base_task>> pop_overflow() {
+        if (overflow_num.load(std::memory_order_acquire) == 0) {
+          return {};
+        }
+        std::lock_guard lk(overflow_mutex);
+        if (overflow.empty()) {
+          return {};
+        }
+        auto task = std::move(overflow.front());
+        overflow.pop_front();
+        overflow_num.fetch_sub(1, std::memory_order_release);
+        return task;
+      }
+
+      void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed)) {
+          epoch.fetch_add(1, std::memory_order_release);
+          cyy::naive_lib::atomic_notify_one(epoch);
+        }
+      }
+
+      size_t node;
+      bool bounded;
+      cyy::naive_lib::mpmc_ring<std::shared_ptr<base_task>> tasks;
+      std::mutex overflow_mutex;
+      std::deque<std::shared_ptr<base_task>> overflow;
+      std::atomic<size_t> overflow_num{0};
+      //! \brief 主人在上面睡眠，有新任務或竊取通知時遞增
+      std::atomic<uint32_t> epoch{0};
+      std::atomic<bool> sleeping{false};
+      std::atomic<bool> steal_signal{false};
+      std::atomic<bool> closed{false};
+      std::atomic<size_t> pushers{0};
+    };
+
+    using processor_list_type = std::vector<std::unique_ptr<base_processor>>;
+    using queue_list_type = std::vector<std::shared_ptr<worker_queue>>;
+
+    //! \brief 記錄當前綫程所屬的processor隊列，用於本地提交
+    static inline thread_local const work_stealing_scheduler *local_owner{
+        nullptr};
+    static inline thread_local worker_queue *local_queue{nullptr};
+
+    //! \param first_index 第一個新processor的序號，用於決定綁定的cpu
+    std::pair<processor_list_type, queue_list_type>
+    make_processors(const std::vector<processor_factory> &makers,
+                    size_t first_index) {
+      processor_list_type new_processors;
+      queue_list_type new_queues;
+      // 先构造新的processor
+      for (auto maker : makers) {
+        auto tmp = maker();
+        if (placement != processor_placement::none) {
+          tmp->set_cpu_affinity(placement_cpus(
+              placement, first_index + new_processors.size()));
+        }
+        auto queue = std::make_shared<worker_queue>(
+            placement_node(tmp->get_cpu_affinity()), worker_queue_capacity);
+        tmp->set_get_task_func(
+            [this, queue](const std::chrono::milliseconds &timeout) {
+              local_owner = this;
+              local_queue = queue.get();
+              return pop_task(*queue, timeout);
+            });
+        new_processors.emplace_back(std::move(tmp));
+        new_queues.emplace_back(std::move(queue));
+      }
+
+      for (auto &processor : new_processors) {
+        processor->start();
+      }
+      return {std::move(new_processors), std::move(new_queues)};
+    }
+
+    void publish_queues() {
+      queues.store(std::make_shared<const queue_list_type>(worker_queues),
+                   std::memory_order_release);
+    }
+
+    //! \brief processor綫程上提交的任務進入本地隊列，其它綫程輪流分配
+    //! \param can_block 所有隊列都滿時是否等待空位
+    //! \return 沒有可用的隊列、不能等待或等到任務的截止時間仍沒有空位時返回false
+    //! \note processor綫程從不等待，它們等待的空位可能要靠自己騰出
+    bool push_task(const std::shared_ptr<base_task> &task, bool can_block) {
+      auto on_processor = local_owner == this;
+      if (on_processor) {
+        bool was_empty = false;
+        if (local_queue->push_back(task, was_empty, true)) {
+          return true;
+        }
+      }
+      auto const &deadline = task->get_deadline();
+      while (true) {
+        auto snapshot = queues.load(std::memory_order_acquire);
+        if (!snapshot || snapshot->empty()) {
+          return false;
+        }
+        auto idx = next_queue.fetch_add(1, std::memory_order_relaxed) %
+                   snapshot->size();
+        // 隊列已滿或已被replace_processor關閉時嘗試下一個
+        for (size_t i = 0; i < snapshot->size(); i++) {
+          auto pos = (idx + i) % snapshot->size();
+          bool was_empty = false;
+          if (!(*snapshot)[pos]->push_back(task, was_empty, on_processor)) {
+            continue;
+          }
+          // 目標隊列有積壓，說明它的主人正忙，叫醒一個空閒的processor來竊取
+          if (!was_empty) {
+            for (size_t j = 1; j < snapshot->size(); j++) {
+              if ((*snapshot)[(pos + j) % snapshot->size()]->wake_to_steal()) {
+                break;
+              }
+            }
+          }
+          return true;
+        }
+        if (snapshot != queues.load(std::memory_order_acquire)) {
+          continue;
+        }
+        if (!can_block) {
+          return false;
+        }
+        // 所有隊列都滿了，等待其中一個騰出空位，然後用新的快照重試
+        auto timeout = std::chrono::milliseconds(10);
+        if (deadline) {
+          auto left = *deadline - std::chrono::steady_clock::now();
+          if (left <= std::chrono::steady_clock::duration::zero()) {
+            return false;
+          }
+          timeout = std::min(
+              timeout, std::chrono::ceil<std::chrono::milliseconds>(left));
+        }
+        if ((*snapshot)[idx]->push_back_wait(task, timeout)) {
+          return true;
+        }
+      }
+    }
+
+    std::optional<std::shared_ptr<base_task>> steal(const worker_queue &own) {
+      auto snapshot = queues.load(std::memory_order_acquire);
+      if (!snapshot || snapshot->empty()) {
+        return {};
+      }
+      auto start = next_victim.fetch_add(1, std::memory_order_relaxed);
+      // 先竊取同一NUMA節點的隊列，任務數據更可能在本地內存和共享緩存中
+      for (auto same_node : {true, false}) {
+        for (size_t i = 0; i < snapshot->size(); i++) {
+          auto &victim = (*snapshot)[(start + i) % snapshot->size()];
+          if (victim.get() == &own ||
+              (victim->get_node() == own.get_node()) != same_node) {
+            continue;
+          }
+          if (auto task = victim->try_steal()) {
+            return task;
+          }
+        }
+      }
+      return {};
+    }
+
+    std::optional<std::shared_ptr<base_task>>
+    pop_task(worker_queue &own, const std::chrono::milliseconds &timeout) {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while (true) {
+        if (auto task = own.try_pop_front()) {
+          return task;
+        }
+        if (auto task = steal(own)) {
+          return task;
+        }
+        if (!own.wait_until(deadline)) {
+          return {};
+        }
+      }
+    }
+
+  private:
+    std::atomic<std::shared_ptr<const queue_list_type>> queues;
+    std::atomic<size_t> next_queue{0};
+    std::atomic<size_t> next_victim{0};
+
+    processor_list_type processors;
+    queue_list_type worker_queues;
+    processor_placement placement{processor_placement::none};
+    size_t worker_queue_capacity{0};
+    std::mutex processor_mutex;
+  }; // class work_stealing_scheduler
+} // namespace cyy::naive_lib::task
@@ -0,0 +1,89 @@
+/*!
+ * \file atomic_wait.cpp
+ *
+ * \brief 帶超時的原子變量等待
+ */
+
+#include "atomic_wait.hpp"
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <climits>
+#include <ctime>
+#else
+#include <algorithm>
+#include <thread>
+#endif
+
+namespace cyy::naive_lib {
+#if defined(__linux__)
+  namespace {
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+    long futex(const std::atomic<uint32_t> &value, int op, uint32_t val,
+               const struct timespec *timeout) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+      return syscall(SYS_futex, reinterpret_cast<const uint32_t *>(&value),
+                     op | FUTEX_PRIVATE_FLAG, val, timeout, nullptr, 0);
+    }
+  } // namespace
+
+  bool atomic_wait_for(const std::atomic<uint32_t> &value, uint32_t old,
+                       const std::chrono::nanoseconds &timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (value.load(std::memory_order_acquire) == old) {
+      auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::nanoseconds::zero()) {
+        return false;
+      }
+      auto secs = std::chrono::duration_cast<std::chrono::seconds>(left);
+      struct timespec ts{};
+      ts.tv_sec = static_cast<time_t>(secs.count());
+      ts.tv_nsec = static_cast<long>((left - secs).count());
+      futex(value, FUTEX_WAIT, old, &ts);
+    }
+    return true;
+  }
+
+  void atomic_wait(const std::atomic<uint32_t> &value, uint32_t old) {
+    while (value.load(std::memory_order_acquire) == old) {
+      futex(value, FUTEX_WAIT, old, nullptr);
+    }
+  }
+
+  void atomic_notify_one(std::atomic<uint32_t> &value) {
+    futex(value, FUTEX_WAKE, 1, nullptr);
+  }
+
+  void atomic_notify_all(std::atomic<uint32_t> &value) {
+    futex(value, FUTEX_WAKE, INT_MAX, nullptr);
+  }
+#else
+  bool atomic_wait_for(const std::atomic<uint32_t> &value, uint32_t old,
+                       const std::chrono::nanoseconds &timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto backoff = std::chrono::microseconds(1);
+    while (value.load(std::memory_order_acquire) == old) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(
+          std::min<std::chrono::nanoseconds>(backoff, deadline - now));
+      backoff = std::min<std::chrono::microseconds>(
+          backoff * 2, std::chrono::microseconds(1000));
+    }
+    return true;
+  }
+
+  void atomic_wait(const std::atomic<uint32_t> &value, uint32_t old) {
+    value.wait(old, std::memory_order_acquire);
+  }
+
+  void atomic_notify_one(std::atomic<uint32_t> &value) { value.notify_one(); }
+
+  void atomic_notify_all(std::atomic<uint32_t> &value) { value.notify_all(); }
+#endif
+} // namespace cyy::naive_lib
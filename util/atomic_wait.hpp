@@ -0,0 +1,29 @@
+/*!
+ * \file atomic_wait.hpp
+ *
+ * \brief 帶超時的原子變量等待
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace cyy::naive_lib {
+
+  //! \brief 等待value不再等於old，最多等timeout
+  //! \note Linux上直接使用futex，其他平台退化為退避輪詢；可能虛假喚醒，調用者需重新檢查
+  //! \return 返回時value是否已不等於old
+  bool atomic_wait_for(const std::atomic<uint32_t> &value, uint32_t old,
+                       const std::chrono::nanoseconds &timeout);
+
+  //! \brief 等待value不再等於old，不限時
+  void atomic_wait(const std::atomic<uint32_t> &value, uint32_t old);
+
+  //! \brief 喚醒一個等待value的綫程
+  void atomic_notify_one(std::atomic<uint32_t> &value);
+
+  //! \brief 喚醒所有等待value的綫程
+  void atomic_notify_all(std::atomic<uint32_t> &value);
+
+} // namespace cyy::naive_lib
@@ -0,0 +1,208 @@
+/*!
+ * \file mpmc_ring.hpp
+ *
+ * \brief 有界無鎖多生產者多消費者環形隊列
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include "atomic_wait.hpp"
+
+namespace cyy::naive_lib {
+
+  //! \brief Vyukov的有界MPMC環形隊列，push和pop各只有一次CAS
+  //! \tparam PadCells 每個槽各佔一個緩存行，元素很小而且相鄰槽的爭用嚴重時才值得打開
+  //! \note 頭尾索引各佔一個緩存行，避免生產者和消費者之間的僞共享；
+  //! 隊列空或滿時的阻塞等待用futex，沒有等待者時不做系統調用
+  template <typename T, bool PadCells = false> class mpmc_ring final {
+  public:
+    static constexpr size_t cache_line_size = 64;
+
+    //! \param capacity_ 容量，向上取整到2的冪
+    explicit mpmc_ring(size_t capacity_)
+        : mask{std::bit_ceil(capacity_ < 2 ? size_t(2) : capacity_) - 1},
+          cells{std::make_unique<cell[]>(mask + 1)} {
+      for (size_t i = 0; i <= mask; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+    mpmc_ring(const mpmc_ring &) = delete;
+    mpmc_ring &operator=(const mpmc_ring &) = delete;
+
+    ~mpmc_ring() {
+      while (try_pop()) {
+      }
+    }
+
+    size_t capacity() const noexcept { return mask + 1; }
+    //! \brief 每個槽佔用的字節數
+    static constexpr size_t slot_size() noexcept { return sizeof(cell); }
+
+    //! \brief 近似的元素數，并发修改時僅供參考
+    size_t size_approx() const noexcept {
+      auto tail = enqueue_pos.load(std::memory_order_relaxed);
+      auto head = dequeue_pos.load(std::memory_order_relaxed);
+      return tail >= head ? tail - head : 0;
+    }
+
+    //! \return 隊列滿時返回false，value不變
+    template <typename U> bool try_push(U &&value) {
+      auto pos = enqueue_pos.load(std::memory_order_relaxed);
+      cell *c = nullptr;
+      while (true) {
+        c = &cells[pos & mask];
+        auto seq = c->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+          if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+      }
+      ::new (c->storage) T(std::forward<U>(value));
+      c->sequence.store(pos + 1, std::memory_order_release);
+      not_empty.wake();
+      return true;
+    }
+
+    std::optional<T> try_pop() {
+      auto pos = dequeue_pos.load(std::memory_order_relaxed);
+      cell *c = nullptr;
+      while (true) {
+        c = &cells[pos & mask];
+        auto seq = c->sequence.load(std::memory_order_acquire);
+        auto diff =
+            static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+          if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (diff < 0) {
+          return {};
+        } else {
+          pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+      }
+      auto *ptr = std::launder(reinterpret_cast<T *>(c->storage));
+      std::optional<T> value(std::move(*ptr));
+      ptr->~T();
+      c->sequence.store(pos + mask + 1, std::memory_order_release);
+      not_full.wake();
+      return value;
+    }
+
+    //! \brief 隊列滿時等待，最多等timeout
+    //! \return 超時返回false，value不變
+    template <typename U>
+    bool push(U &&value, const std::chrono::nanoseconds &timeout) {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      return not_full.wait_until(
+          [&] { return try_push(std::forward<U>(value)); }, deadline);
+    }
+
+    //! \brief 隊列滿時丟棄最舊的元素
+    //! \return 被丟棄的元素數
+    template <typename U> size_t push_overwrite(U &&value) {
+      size_t dropped = 0;
+      while (!try_push(std::forward<U>(value))) {
+        if (try_pop()) {
+          dropped++;
+        }
+      }
+      return dropped;
+    }
+
+    //! \brief 隊列空時等待，最多等timeout
+    std::optional<T> pop(const std::chrono::nanoseconds &timeout) {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      std::optional<T> value;
+      not_empty.wait_until(
+          [&] {
+            value = try_pop();
+            return value.has_value();
+          },
+          deadline);
+      return value;
+    }
+
+    void clear() {
+      while (try_pop()) {
+      }
+    }
+
+  private:
+    static constexpr size_t cell_alignment =
+        std::max({PadCells ? cache_line_size : size_t(1),
+                  alignof(std::atomic<size_t>), alignof(T)});
+
+    struct alignas(cell_alignment) cell {
+      std::atomic<size_t> sequence{0};
+      alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    //! \brief 等待條件成立的綫程在epoch上睡眠，條件可能改變時遞增epoch
+    class alignas(cache_line_size) waiter_list {
+    public:
+      void wake() {
+        // 與wait_until中先登記再重試配對，保證不會錯過喚醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0) {
+          return;
+        }
+        epoch.fetch_add(1, std::memory_order_release);
+        atomic_notify_one(epoch);
+      }
+
+      template <typename TryFunc>
+      bool wait_until(TryFunc try_func,
+                      const std::chrono::steady_clock::time_point &deadline) {
+        while (true) {
+          if (try_func()) {
+            return true;
+          }
+          waiters.fetch_add(1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          auto old = epoch.load(std::memory_order_acquire);
+          if (try_func()) {
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+          }
+          auto now = std::chrono::steady_clock::now();
+          if (now >= deadline) {
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+          }
+          atomic_wait_for(epoch, old, deadline - now);
+          waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+      }
+
+    private:
+      std::atomic<uint32_t> epoch{0};
+      std::atomic<uint32_t> waiters{0};
+    };
+
+    const size_t mask;
+    std::unique_ptr<cell[]> cells;
+    alignas(cache_line_size) std::atomic<size_t> enqueue_pos{0};
+    alignas(cache_line_size) std::atomic<size_t> dequeue_pos{0};
+    waiter_list not_empty;
+    waiter_list not_full;
+  };
+} // namespace cyy::naive_lib
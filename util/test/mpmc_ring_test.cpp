@@ -0,0 +1,100 @@
+/*!
+ * \file mpmc_ring_test.cpp
+ *
+ * \brief 测试環形隊列
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "util/mpmc_ring.hpp"
+
+using namespace std::chrono_literals;
+
+TEST_CASE("mpmc_ring") {
+  SUBCASE("bounded") {
+    cyy::naive_lib::mpmc_ring<int> ring(3);
+    CHECK_EQ(ring.capacity(), 4);
+    for (int i = 0; i < 4; i++) {
+      CHECK(ring.try_push(i));
+    }
+    CHECK(!ring.try_push(4));
+    CHECK(!ring.push(4, 1ms));
+    CHECK_EQ(ring.try_pop().value(), 0);
+    CHECK_EQ(ring.push_overwrite(4), 0);
+    CHECK_EQ(ring.push_overwrite(5), 1);
+    for (int i = 2; i < 6; i++) {
+      CHECK_EQ(ring.pop(1ms).value(), i);
+    }
+    CHECK(!ring.pop(1ms).has_value());
+  }
+
+  SUBCASE("cell padding") {
+    // 默認不填充，槽只比元素多一個序號
+    CHECK_LT(cyy::naive_lib::mpmc_ring<int>::slot_size(),
+             cyy::naive_lib::mpmc_ring<int>::cache_line_size);
+    using padded_ring = cyy::naive_lib::mpmc_ring<int, true>;
+    CHECK_EQ(padded_ring::slot_size(), padded_ring::cache_line_size);
+    padded_ring ring(2);
+    CHECK(ring.try_push(1));
+    CHECK(ring.try_push(2));
+    CHECK_EQ(ring.try_pop().value(), 1);
+    CHECK_EQ(ring.try_pop().value(), 2);
+  }
+
+  SUBCASE("non-trivial elements") {
+    auto value = std::make_shared<int>(1);
+    {
+      cyy::naive_lib::mpmc_ring<std::shared_ptr<int>> ring(4);
+      ring.try_push(value);
+      ring.try_push(value);
+      CHECK_EQ(value.use_count(), 3);
+      ring.try_pop();
+      CHECK_EQ(value.use_count(), 2);
+    }
+    CHECK_EQ(value.use_count(), 1);
+  }
+
+  SUBCASE("blocking pop is woken by push") {
+    cyy::naive_lib::mpmc_ring<int> ring(4);
+    std::jthread producer([&ring]() {
+      std::this_thread::sleep_for(20ms);
+      ring.try_push(1);
+    });
+    CHECK_EQ(ring.pop(1s).value(), 1);
+  }
+
+  SUBCASE("concurrent producers and consumers") {
+    cyy::naive_lib::mpmc_ring<size_t> ring(16);
+    constexpr size_t thread_num = 4;
+    constexpr size_t item_num = 10000;
+    std::atomic<size_t> sum{0};
+    std::atomic<size_t> popped{0};
+    {
+      std::vector<std::jthread> threads;
+      for (size_t t = 0; t < thread_num; t++) {
+        threads.emplace_back([&ring]() {
+          for (size_t i = 1; i <= item_num; i++) {
+            while (!ring.push(i, 1s)) {
+            }
+          }
+        });
+        threads.emplace_back([&]() {
+          while (popped < thread_num * item_num) {
+            if (auto value = ring.pop(10ms)) {
+              sum += *value;
+              popped++;
+            }
+          }
+        });
+      }
+    }
+    CHECK_EQ(popped.load(), thread_num * item_num);
+    CHECK_EQ(sum.load(), thread_num * item_num * (item_num + 1) / 2);
+  }
+}
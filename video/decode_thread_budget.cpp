@@ -0,0 +1,62 @@
+/*!
+ * \file decode_thread_budget.cpp
+ *
+ * \brief 所有解碼器共享的綫程預算
+ */
+
+#include "decode_thread_budget.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace cyy::naive_lib::video {
+  namespace {
+    size_t default_limit(size_t limit) {
+      if (limit != 0) {
+        return limit;
+      }
+      return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+  } // namespace
+
+  decode_thread_budget::decode_thread_budget(size_t limit_)
+      : limit{default_limit(limit_)} {}
+
+  void decode_thread_budget::set_limit(size_t limit_) {
+    std::lock_guard lk(mu);
+    limit = default_limit(limit_);
+  }
+
+  size_t decode_thread_budget::get_limit() const {
+    std::lock_guard lk(mu);
+    return limit;
+  }
+
+  size_t decode_thread_budget::acquire(size_t wanted) {
+    std::lock_guard lk(mu);
+    auto available = used < limit ? limit - used : 0;
+    auto granted = std::clamp<size_t>(available, 1, std::max<size_t>(wanted, 1));
+    if (granted > 1) {
+      used += granted;
+    }
+    return granted;
+  }
+
+  void decode_thread_budget::release(size_t num) noexcept {
+    if (num <= 1) {
+      return;
+    }
+    std::lock_guard lk(mu);
+    used -= std::min(used, num);
+  }
+
+  size_t decode_thread_budget::in_use() const {
+    std::lock_guard lk(mu);
+    return used;
+  }
+
+  decode_thread_budget &decode_thread_budget::instance() {
+    static auto *budget = new decode_thread_budget();
+    return *budget;
+  }
+} // namespace cyy::naive_lib::video
@@ -0,0 +1,44 @@
+/*!
+ * \file decode_thread_budget.hpp
+ *
+ * \brief 所有解碼器共享的綫程預算
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+namespace cyy::naive_lib::video {
+  //! \brief 限制進程中所有解碼器綫程的總數，避免大量reader同時打開時超額訂閱CPU
+  //! \note 預算用完後每個解碼器仍然得到一個綫程，即在調用者的綫程上單綫程解碼，
+  //! 單綫程解碼不計入預算，所以in_use不會超過上限
+  class decode_thread_budget final {
+  public:
+    //! \param limit 綫程總數的上限，為0時使用CPU數
+    explicit decode_thread_budget(size_t limit = 0);
+
+    decode_thread_budget(const decode_thread_budget &) = delete;
+    decode_thread_budget &operator=(const decode_thread_budget &) = delete;
+
+    //! \brief 修改上限，已經分配的綫程不收回
+    void set_limit(size_t limit);
+    [[nodiscard]] size_t get_limit() const;
+
+    //! \brief 申請綫程
+    //! \return 分配的綫程數，在1和wanted之間；返回1時不佔用預算
+    [[nodiscard]] size_t acquire(size_t wanted);
+    //! \brief 歸還acquire返回的綫程數，歸還1個綫程沒有效果
+    void release(size_t num) noexcept;
+    //! \brief 已經分配的綫程數
+    [[nodiscard]] size_t in_use() const;
+
+    //! \brief 進程共享的預算，永不析構
+    static decode_thread_budget &instance();
+
+  private:
+    mutable std::mutex mu;
+    size_t limit;
+    size_t used{0};
+  };
+} // namespace cyy::naive_lib::video
@@ -7,6 +7,7 @@
 
 #include "ffmpeg_video_reader.hpp"
 
+#include "decode_thread_budget.hpp"
 #include "ffmpeg_video_reader_impl.hpp"
 
 namespace cyy::naive_lib::video {
@@ -40,6 +41,37 @@ namespace cyy::naive_lib::video {
     pimpl->set_play_frame_rate(frame_rate);
   }
 
+  void ffmpeg_reader::set_output_mode(output_mode mode) {
+    pimpl->set_output_mode(mode);
+  }
+
+  void ffmpeg_reader::set_frame_pool_depth(size_t depth) {
+    pimpl->set_frame_pool_depth(depth);
+  }
+
+  void ffmpeg_reader::set_crop_rect(std::optional<cv::Rect> rect) {
+    pimpl->set_crop_rect(rect);
+  }
+  void ffmpeg_reader::set_output_size(std::optional<cv::Size> size) {
+    pimpl->set_output_size(size);
+  }
+  void ffmpeg_reader::set_interpolation(interpolation method) {
+    pimpl->set_interpolation(method);
+  }
+
+  void ffmpeg_reader::set_convert_threads(size_t thread_count) {
+    pimpl->set_convert_threads(thread_count);
+  }
+
+  void ffmpeg_reader::set_decode_threads(size_t thread_count,
+                                         decode_thread_type type) {
+    pimpl->set_decode_threads(thread_count, type);
+  }
+
+  void ffmpeg_reader::set_decode_thread_budget(size_t thread_num) {
+    decode_thread_budget::instance().set_limit(thread_num);
+  }
+
   void ffmpeg_reader::keep_non_key_frames() { pimpl->keep_non_key_frames(); }
   void ffmpeg_reader::drop_non_key_frames() { pimpl->drop_non_key_frames(); }
   void ffmpeg_reader::add_named_filter(std::string name,
@@ -8,6 +8,7 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -20,6 +21,35 @@ namespace cyy::naive_lib::video {
   //! \brief 封装ffmpeg对视频流的讀操作
   class ffmpeg_reader final : public reader {
   public:
+    //! \brief next_frame返回的幀內容
+    enum class output_mode {
+      //! \brief 轉換成BGR24，每幀複製一次
+      bgr,
+      //! \brief 解碼器的原始像素格式，planes直接指向解碼器的緩衝區，不複製
+      native,
+      //! \brief 只有亮度平面；YUV格式直接指向解碼器的Y平面，其它格式轉換成灰度
+      luma,
+    };
+
+    //! \brief 解碼綫程的并行方式
+    enum class decode_thread_type {
+      //! \brief 文件同時使用幀并行和切片并行，直播流只用切片并行
+      automatic,
+      //! \brief 幀并行，吞吐量高，但每個綫程增加一幀延遲
+      frame,
+      //! \brief 切片并行，不增加延遲，效果取決於碼流的切片數
+      slice,
+    };
+
+    //! \brief 轉換時縮放的插值方式
+    enum class interpolation {
+      nearest,
+      bilinear,
+      bicubic,
+      area,
+      lanczos,
+    };
+
     ffmpeg_reader();
 
     ~ffmpeg_reader() override;
@@ -45,6 +75,42 @@ namespace cyy::naive_lib::video {
     [[nodiscard]] std::optional<std::array<size_t, 2>>
     get_frame_rate() override;
 
+    //! \brief 設置幀內容的格式，默認是bgr
+    //! \note 直播流已經緩衝的幀保持原來的格式
+    void set_output_mode(output_mode mode);
+
+    //! \brief 設置轉換後的幀緩衝區池保留的空閒緩衝區個數，默認是4，為0時不回收
+    //! \note 只影響需要轉換的幀，native模式的幀由解碼器的緩衝池管理
+    void set_frame_pool_depth(size_t depth);
+
+    //! \brief 設置裁剪區域，坐標相對於解碼後的幀，為空時不裁剪
+    //! \note 與縮放在同一次轉換中完成；native模式忽略這個設置，
+    //! luma模式不縮放時直接取Y平面的ROI。
+    //! 輸出大小與rect相同，但色度有子採樣時起點向下對齊到子採樣的倍數
+    void set_crop_rect(std::optional<cv::Rect> rect);
+    //! \brief 設置輸出的大小，先裁剪再縮放到這個大小，為空時不縮放
+    //! \note native模式忽略這個設置
+    void set_output_size(std::optional<cv::Size> size);
+    //! \brief 設置縮放的插值方式，默認是bicubic
+    void set_interpolation(interpolation method);
+
+    //! \brief 設置像素格式轉換的綫程數，下次open時生效
+    //! \param thread_count 每幀按水平條帶分給這些綫程轉換，默認是0，即在解碼綫程上轉換
+    //! \note 只有直播流的轉換會與下一幀的解碼重疊；
+    //! 讀文件時next_frame先解碼再同步轉換，多綫程只縮短單幀的轉換時間
+    void set_convert_threads(size_t thread_count);
+
+    //! \brief 設置解碼綫程，下次open時生效
+    //! \param thread_count 期望的綫程數，默認是1，為0時按CPU數選擇；
+    //! 多綫程解碼從全局預算申請綫程，預算不足時得到的綫程更少
+    void set_decode_threads(
+        size_t thread_count,
+        decode_thread_type type = decode_thread_type::automatic);
+
+    //! \brief 設置所有reader的解碼綫程總數上限，默認是CPU數，為0時恢復默認值
+    //! \note 單綫程解碼不佔用預算
+    static void set_decode_thread_budget(size_t thread_num);
+
     void add_named_filter(std::string name, std::function<bool(size_t)> filter);
 
     void remove_named_filter(std::string name);
@@ -8,20 +8,30 @@
 #pragma once
 #include <stdlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <thread>
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/pixfmt.h>
 #include <libswscale/swscale.h>
 }
 
-#include <cyy/algorithm/thread_safe_container.hpp>
-
+#include "decode_thread_budget.hpp"
 #include "ffmpeg_base.hpp"
 #include "ffmpeg_video_reader.hpp"
+#include "frame_pool.hpp"
+#include "shared_mat.hpp"
+#include "slice_converter.hpp"
 #include "log/log.hpp"
+#include "util/mpmc_ring.hpp"
 #include "util/runnable.hpp"
 
 namespace cyy::naive_lib::video {
@@ -128,6 +138,7 @@ namespace cyy::naive_lib::video {
         return false;
       }
 
+      configure_decode_threads();
       ret = avcodec_open2(decode_ctx, nullptr, nullptr);
       if (ret < 0) {
         LOG_ERROR("avcodec_open2 failed:{}", errno_to_str(ret));
@@ -147,18 +158,16 @@ namespace cyy::naive_lib::video {
         return false;
       }
 
+      converter = std::make_unique<slice_converter>(convert_thread_count);
       opened = true;
 
       if (is_live_stream()) {
         if constexpr (decode_frame) {
           frame_buffer =
-              std::make_unique<cyy::algorithm::thread_safe_linear_container<
-                  std::vector<std::pair<int, frame>>>>();
-
+              std::make_unique<frame_buffer_type>(frame_buffer_size);
         } else {
           packet_buffer =
-              std::make_unique<cyy::algorithm::thread_safe_linear_container<
-                  std::vector<std::pair<int, std::shared_ptr<AVPacket>>>>>();
+              std::make_unique<packet_buffer_type>(packet_buffer_size);
         }
         start("ffmpeg_reader_impl");
       }
@@ -203,7 +212,7 @@ namespace cyy::naive_lib::video {
       }
 
       if (url_scheme == "rtsp") {
-        auto packet_opt = packet_buffer->pop_front(std::chrono::seconds(5));
+        auto packet_opt = packet_buffer->pop(std::chrono::seconds(5));
         if (!packet_opt) {
           LOG_ERROR("pop packet timeout");
           return {-1, {}};
@@ -242,12 +251,17 @@ namespace cyy::naive_lib::video {
 
       std::pair<int, frame> p;
       if (is_live_stream()) {
-        auto frame_opt = frame_buffer->pop_front(std::chrono::seconds(5));
+        auto frame_opt = frame_buffer->pop(std::chrono::seconds(5));
         if (!frame_opt) {
           LOG_ERROR("pop frame timeout");
           return {-1, {}};
         }
-        p = frame_opt.value();
+        auto &pending = frame_opt.value();
+        if (pending.conversion && !converter->wait(*pending.conversion)) {
+          LOG_ERROR("convert frame failed");
+          return {-1, {}};
+        }
+        p = std::move(pending.result);
       } else {
         p = get_frame();
       }
@@ -312,10 +326,7 @@ namespace cyy::naive_lib::video {
       frame_buffer.reset();
       packet_buffer.reset();
 
-      if (sws_ctx) {
-        sws_freeContext(sws_ctx);
-        sws_ctx = nullptr;
-      }
+      converter.reset();
 
       if (avframe) {
         av_frame_free(&avframe);
@@ -326,6 +337,10 @@ namespace cyy::naive_lib::video {
         avcodec_free_context(&decode_ctx);
         decode_ctx = nullptr;
       }
+      if (granted_decode_threads != 0) {
+        decode_thread_budget::instance().release(granted_decode_threads);
+        granted_decode_threads = 0;
+      }
 
       if (input_ctx) {
         avformat_close_input(&input_ctx);
@@ -360,6 +375,52 @@ namespace cyy::naive_lib::video {
 
     void keep_non_key_frames() { remove_named_filter("key_frame"); }
 
+    void set_output_mode(ffmpeg_reader::output_mode mode) {
+      output_mode = mode;
+    }
+
+    void set_frame_pool_depth(size_t depth) { pool.set_depth(depth); }
+
+    void set_crop_rect(std::optional<cv::Rect> rect) {
+      std::lock_guard lk(geometry_mutex);
+      geometry.crop = rect;
+    }
+    void set_output_size(std::optional<cv::Size> size) {
+      std::lock_guard lk(geometry_mutex);
+      geometry.size = size;
+    }
+    void set_interpolation(ffmpeg_reader::interpolation method) {
+      int flags = SWS_BICUBIC;
+      switch (method) {
+        case ffmpeg_reader::interpolation::nearest:
+          flags = SWS_POINT;
+          break;
+        case ffmpeg_reader::interpolation::bilinear:
+          flags = SWS_BILINEAR;
+          break;
+        case ffmpeg_reader::interpolation::area:
+          flags = SWS_AREA;
+          break;
+        case ffmpeg_reader::interpolation::lanczos:
+          flags = SWS_LANCZOS;
+          break;
+        default:
+          break;
+      }
+      std::lock_guard lk(geometry_mutex);
+      geometry.sws_flags = flags;
+    }
+
+    void set_convert_threads(size_t thread_count) {
+      convert_thread_count = thread_count;
+    }
+
+    void set_decode_threads(size_t thread_count,
+                            ffmpeg_reader::decode_thread_type type) {
+      decode_thread_count = thread_count;
+      decode_thread_type = type;
+    }
+
   private:
     static int interrupt_cb(void *ctx) {
       if (reinterpret_cast<ffmpeg_reader_impl<decode_frame> *>(ctx)
@@ -373,20 +434,33 @@ namespace cyy::naive_lib::video {
       return ((frame.key_frame == 1) || (frame.pict_type == AV_PICTURE_TYPE_I));
     }
 
-    void run() override {
+    void run(const std::stop_token & /*st*/) override {
       avformat_flush(input_ctx);
       while (!needs_stop()) {
         if constexpr (decode_frame) {
-          auto res = get_frame();
-          frame_buffer->push_back(res);
-          if (res.first <= 0) {
+          // 轉換在converter的綫程上進行，與解碼下一幀重疊，消費者取出時等待它完成
+          pending_frame pending;
+          pending.result = get_frame(&pending.conversion);
+          auto failed = pending.result.first <= 0;
+          // 直播流只關心最新的畫面，消費者跟不上時丟掉最舊的幀
+          auto dropped = frame_buffer->push_overwrite(std::move(pending));
+          if (dropped != 0) {
+            LOG_DEBUG("drop {} old frames", dropped);
+          }
+          if (failed) {
             LOG_ERROR("get frame failed,thread exit");
             break;
           }
         } else {
           auto res = get_packet();
-          packet_buffer->push_back(res);
-          if (res.first <= 0) {
+          auto failed = res.first <= 0;
+          // 丟包會破壞解碼，所以packet隊列滿時等待消費者
+          while (!packet_buffer->push(res, std::chrono::milliseconds(100))) {
+            if (needs_stop()) {
+              return;
+            }
+          }
+          if (failed) {
             LOG_ERROR("get packet failed,thread exit");
             break;
           }
@@ -460,14 +534,14 @@ namespace cyy::naive_lib::video {
     }
 
     //! \brief 获取下一帧
+    //! \param conversion 不為空且converter有工作綫程時異步轉換，轉換任務放在這裡
     //! \return first>0 成功
     //	      first=0 EOF
     //	      first<0 失敗
     //	如果first<=0，返回空内容
-    std::pair<int, frame> get_frame() {
+    std::pair<int, frame>
+    get_frame(std::shared_ptr<slice_converter::job> *conversion = nullptr) {
       // 我们在循环中不断解码直到成功获取一帧或者失败
-      const enum AVPixelFormat pix_fmt { AV_PIX_FMT_BGR24 };
-
       if (!has_open()) {
         LOG_ERROR("reader is not opened");
         return {-1, {}};
@@ -524,53 +598,242 @@ namespace cyy::naive_lib::video {
       next_frame_seq++;
       new_frame.is_key = is_key_frame(*avframe);
 
-      uint8_t *dst_data[4]{};
-      int dst_linesize[4]{};
+      bool succ = false;
+      switch (output_mode.load(std::memory_order_relaxed)) {
+        case ffmpeg_reader::output_mode::native:
+          succ = wrap_native_frame(new_frame);
+          break;
+        case ffmpeg_reader::output_mode::luma:
+          succ = wrap_luma_frame(new_frame);
+          break;
+        default:
+          succ = convert_frame(new_frame, AV_PIX_FMT_BGR24, CV_8UC3,
+                               conversion);
+          break;
+      }
+      if (!succ) {
+        return {-1, {}};
+      }
+      return {1, new_frame};
+    }
 
-      new_frame.content = cv::Mat(video_height, video_width, CV_8UC3);
-      dst_linesize[0] = static_cast<int>(new_frame.content.step[0]);
+    //! \brief 把解碼器的幀轉換到從池中分配的cv::Mat，同時裁剪和縮放
+    bool convert_frame(
+        frame &new_frame, const enum AVPixelFormat pix_fmt, int mat_type,
+        std::shared_ptr<slice_converter::job> *conversion = nullptr) {
+      auto geo = get_output_geometry();
+      auto src = ref_frame();
+      if (!src) {
+        return false;
+      }
+      if (geo.crop && !crop_frame(*src, *geo.crop)) {
+        return false;
+      }
+      // 不縮放時保持裁剪後的大小，不裁剪時保持視頻的大小
+      auto size = geo.size.value_or(
+          geo.crop ? cv::Size(src->width, src->height)
+                   : cv::Size(video_width, video_height));
+      if (size.empty()) {
+        LOG_ERROR("invalid output size [{} * {}]", size.width, size.height);
+        return false;
+      }
+      new_frame.content = pool.allocate(size.height, size.width, mat_type);
+      new_frame.pixel_format = pix_fmt;
 
-      auto ret = av_image_fill_pointers(dst_data, pix_fmt, video_height,
-                                        new_frame.content.data, dst_linesize);
+      auto dst = slice_converter::wrap_mat(new_frame.content, pix_fmt);
+      if (!dst) {
+        return false;
+      }
+      if (conversion && converter->worker_num() != 0) {
+        *conversion =
+            converter->submit(std::move(src), std::move(dst), geo.sws_flags);
+        return true;
+      }
+      if (!converter->convert(std::move(src), std::move(dst), geo.sws_flags)) {
+        LOG_ERROR("convert frame failed");
+        return false;
+      }
+      return true;
+    }
 
-      if (ret <= 0) {
-        LOG_ERROR("av_image_fill_pointers failed:{}", errno_to_str(ret));
-        return {-1, {}};
+    //! \brief 調整幀的數據指針和大小，只保留rect內的部分，不複製數據
+    //! \note rect的起點向下對齊到色度採樣的倍數，否則色度平面會錯位；
+    //! 寬高保持不變，所以區域最多向左上移動一個色度採樣
+    bool crop_frame(AVFrame &f, cv::Rect rect) {
+      auto desc =
+          av_pix_fmt_desc_get(static_cast<enum AVPixelFormat>(f.format));
+      if (!can_wrap(desc)) {
+        LOG_ERROR("can't crop pixel format {}", desc ? desc->name : "unknown");
+        return false;
+      }
+      rect &= cv::Rect(0, 0, f.width, f.height);
+      rect.x &= ~((1 << desc->log2_chroma_w) - 1);
+      rect.y &= ~((1 << desc->log2_chroma_h) - 1);
+      if (rect.empty()) {
+        LOG_ERROR("crop rect is outside the frame");
+        return false;
+      }
+      f.crop_left = static_cast<size_t>(rect.x);
+      f.crop_top = static_cast<size_t>(rect.y);
+      f.crop_right = static_cast<size_t>(f.width - rect.x - rect.width);
+      f.crop_bottom = static_cast<size_t>(f.height - rect.y - rect.height);
+      auto ret = av_frame_apply_cropping(&f, AV_FRAME_CROP_UNALIGNED);
+      if (ret < 0) {
+        LOG_ERROR("av_frame_apply_cropping failed:{}", errno_to_str(ret));
+        return false;
       }
+      return true;
+    }
 
-      get_sws_ctx(pix_fmt);
-      if (!sws_ctx) {
-        LOG_ERROR("get_sws_ctx failed");
-        return {-1, {}};
+    //! \brief 增加解碼器幀的引用計數，返回的幀在下次解碼後仍然有效
+    std::shared_ptr<AVFrame> ref_frame() {
+      auto ref = av_frame_alloc();
+      if (!ref) {
+        LOG_ERROR("av_frame_alloc failed");
+        return {};
       }
+      auto ret = av_frame_ref(ref, avframe);
+      if (ret < 0) {
+        LOG_ERROR("av_frame_ref failed:{}", errno_to_str(ret));
+        av_frame_free(&ref);
+        return {};
+      }
+      return {ref, [](AVFrame *f) { av_frame_free(&f); }};
+    }
 
-      ret = sws_scale(sws_ctx, avframe->data, avframe->linesize, 0,
-                      avframe->height, dst_data, dst_linesize);
+    static bool can_wrap(const AVPixFmtDescriptor *desc) {
+      return desc && (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL |
+                                     AV_PIX_FMT_FLAG_BITSTREAM |
+                                     AV_PIX_FMT_FLAG_PAL)) == 0;
+    }
 
-      if (ret <= 0) {
-        if (ret < 0) {
-          LOG_ERROR("sws_scale failed:{}", errno_to_str(ret));
-        } else {
-          LOG_ERROR("sws_scale failed");
+    //! \brief 不複製數據，用cv::Mat頭指向解碼器幀的每個平面
+    //! \note 交錯的平面（例如NV12的UV）是多通道的Mat，位深大於8時是16位的Mat
+    bool wrap_native_frame(frame &new_frame) {
+      auto format = static_cast<enum AVPixelFormat>(avframe->format);
+      auto desc = av_pix_fmt_desc_get(format);
+      if (!can_wrap(desc)) {
+        LOG_ERROR("can't wrap pixel format {}",
+                  desc ? desc->name : "unknown");
+        return false;
+      }
+      auto ref = ref_frame();
+      if (!ref) {
+        return false;
+      }
+      auto depth = desc->comp[0].depth > 8 ? CV_16U : CV_8U;
+      auto sample_size = depth == CV_16U ? 2 : 1;
+      auto plane_num = av_pix_fmt_count_planes(format);
+      for (int i = 0; i < plane_num; i++) {
+        auto is_chroma = (i == 1 || i == 2) &&
+                         (desc->flags & AV_PIX_FMT_FLAG_RGB) == 0;
+        auto plane_width =
+            is_chroma ? AV_CEIL_RSHIFT(ref->width, desc->log2_chroma_w)
+                      : ref->width;
+        auto plane_height =
+            is_chroma ? AV_CEIL_RSHIFT(ref->height, desc->log2_chroma_h)
+                      : ref->height;
+        auto row_size = av_image_get_linesize(format, ref->width, i);
+        if (row_size <= 0 || ref->linesize[i] < row_size ||
+            row_size % (plane_width * sample_size) != 0) {
+          LOG_ERROR("unexpected layout of plane {} in pixel format {}", i,
+                    desc->name);
+          new_frame.planes.clear();
+          return false;
         }
-        return {-1, {}};
+        auto channels = row_size / (plane_width * sample_size);
+        // 每個平面都持有解碼器幀的引用，可以脫離frame單獨保存
+        new_frame.planes.emplace_back(make_shared_mat(
+            ref, plane_height, plane_width, CV_MAKETYPE(depth, channels),
+            ref->data[i], static_cast<size_t>(ref->linesize[i])));
+      }
+      new_frame.content = new_frame.planes[0];
+      new_frame.pixel_format = format;
+      return true;
+    }
+
+    //! \brief 8位的平面YUV格式直接指向Y平面，其它格式轉換成灰度
+    //! \note 直接指向時保留Y的原始取值範圍，不做limited到full range的轉換
+    bool wrap_luma_frame(frame &new_frame) {
+      auto format = static_cast<enum AVPixelFormat>(avframe->format);
+      auto desc = av_pix_fmt_desc_get(format);
+      if (!can_wrap(desc) || (desc->flags & AV_PIX_FMT_FLAG_RGB) != 0 ||
+          desc->comp[0].plane != 0 || desc->comp[0].step != 1 ||
+          desc->comp[0].offset != 0 || desc->comp[0].depth != 8) {
+        return convert_frame(new_frame, AV_PIX_FMT_GRAY8, CV_8UC1);
+      }
+      auto geo = get_output_geometry();
+      if (geo.size) {
+        // 縮放無法避免複製，和其它格式一樣轉換
+        return convert_frame(new_frame, AV_PIX_FMT_GRAY8, CV_8UC1);
+      }
+      auto ref = ref_frame();
+      if (!ref) {
+        return false;
       }
-      return {1, new_frame};
+      new_frame.content = make_shared_mat(
+          ref, ref->height, ref->width, CV_8UC1, ref->data[0],
+          static_cast<size_t>(ref->linesize[0]));
+      if (geo.crop) {
+        // 只有亮度平面，直接取ROI
+        auto rect = *geo.crop & cv::Rect(0, 0, ref->width, ref->height);
+        if (rect.empty()) {
+          LOG_ERROR("crop rect is outside the frame");
+          return false;
+        }
+        new_frame.content = new_frame.content(rect);
+      }
+      new_frame.pixel_format = AV_PIX_FMT_GRAY8;
+      return true;
     }
 
     bool can_seek() const { return !is_live_stream(); }
 
-    void get_sws_ctx(const enum AVPixelFormat pix_fmt) {
-      auto new_sws_ctx = sws_getCachedContext(
-          sws_ctx, avframe->width, avframe->height,
-          static_cast<enum AVPixelFormat>(avframe->format), video_width,
-          video_height, pix_fmt, SWS_BICUBIC, nullptr, nullptr, nullptr);
+    //! \brief 轉換時的裁剪、縮放和插值方式
+    struct output_geometry {
+      std::optional<cv::Rect> crop;
+      std::optional<cv::Size> size;
+      int sws_flags{SWS_BICUBIC};
+    };
 
-      if (!new_sws_ctx) {
-        LOG_ERROR("sws_getContext failed");
-        return;
+    output_geometry get_output_geometry() {
+      std::lock_guard lk(geometry_mutex);
+      return geometry;
+    }
+
+    //! \brief 在avcodec_open2之前設置解碼綫程，多綫程時從全局預算申請
+    void configure_decode_threads() {
+      auto wanted = decode_thread_count;
+      if (wanted == 0) {
+        // ffmpeg自動選擇時最多也只用16個綫程
+        wanted = std::clamp<size_t>(std::thread::hardware_concurrency(), 1,
+                                    max_auto_decode_threads);
+      }
+      size_t thread_count = 1;
+      if (wanted > 1) {
+        granted_decode_threads =
+            decode_thread_budget::instance().acquire(wanted);
+        thread_count = granted_decode_threads;
+      }
+      decode_ctx->thread_count = static_cast<int>(thread_count);
+      switch (decode_thread_type) {
+        case ffmpeg_reader::decode_thread_type::frame:
+          decode_ctx->thread_type = FF_THREAD_FRAME;
+          break;
+        case ffmpeg_reader::decode_thread_type::slice:
+          decode_ctx->thread_type = FF_THREAD_SLICE;
+          break;
+        default:
+          // 幀并行每個綫程增加一幀延遲，直播流只用切片并行
+          decode_ctx->thread_type = is_live_stream()
+                                        ? FF_THREAD_SLICE
+                                        : FF_THREAD_FRAME | FF_THREAD_SLICE;
+          break;
+      }
+      if (thread_count < wanted) {
+        LOG_WARN("decode thread budget exhausted, use {} threads instead of {}",
+                 thread_count, wanted);
       }
-      sws_ctx = new_sws_ctx;
     }
 
   private:
@@ -586,18 +849,37 @@ namespace cyy::naive_lib::video {
     AVCodecContext *decode_ctx{nullptr};
     AVDictionary *opts{nullptr};
     AVFrame *avframe{nullptr};
-    SwsContext *sws_ctx{nullptr};
+    size_t convert_thread_count{0};
+    std::mutex geometry_mutex;
+    output_geometry geometry;
+    std::unique_ptr<slice_converter> converter;
+    std::atomic<ffmpeg_reader::output_mode> output_mode{
+        ffmpeg_reader::output_mode::bgr};
+    size_t decode_thread_count{1};
+    ffmpeg_reader::decode_thread_type decode_thread_type{
+        ffmpeg_reader::decode_thread_type::automatic};
+    //! \brief 從全局預算申請到的綫程數，close時歸還
+    size_t granted_decode_threads{0};
+    static constexpr size_t max_auto_decode_threads = 16;
+    //! \brief 直播流的幀在緩衝隊列中排隊，所以默認多保留幾個空閒緩衝區
+    frame_pool pool{4};
 
     std::unordered_map<size_t, int64_t> key_frame_timestamps;
 
     std::unordered_map<std::string,
                        std::function<bool(uint64_t, const AVFrame &)>>
         frame_filters;
-    std::unique_ptr<cyy::algorithm::thread_safe_linear_container<
-        std::vector<std::pair<int, frame>>>>
-        frame_buffer;
-    std::unique_ptr<cyy::algorithm::thread_safe_linear_container<
-        std::vector<std::pair<int, std::shared_ptr<AVPacket>>>>>
-        packet_buffer;
+    //! \brief 直播流解碼綫程產生的幀，轉換可能還沒完成
+    struct pending_frame {
+      std::pair<int, frame> result;
+      std::shared_ptr<slice_converter::job> conversion;
+    };
+    using frame_buffer_type = cyy::naive_lib::mpmc_ring<pending_frame>;
+    using packet_buffer_type =
+        cyy::naive_lib::mpmc_ring<std::pair<int, std::shared_ptr<AVPacket>>>;
+    static constexpr size_t frame_buffer_size = 32;
+    static constexpr size_t packet_buffer_size = 256;
+    std::unique_ptr<frame_buffer_type> frame_buffer;
+    std::unique_ptr<packet_buffer_type> packet_buffer;
   };
 } // namespace cyy::naive_lib::video
@@ -29,4 +29,7 @@ namespace cyy::naive_lib::video {
 
   void ffmpeg_writer::close() noexcept { pimpl->close(); }
   const std::string &ffmpeg_writer::get_url() const { return pimpl->get_url(); }
+  void ffmpeg_writer::set_convert_threads(size_t thread_count) {
+    pimpl->set_convert_threads(thread_count);
+  }
 } // namespace cyy::naive_lib::video
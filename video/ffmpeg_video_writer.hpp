@@ -38,6 +38,10 @@ namespace cyy::naive_lib::video {
 
     [[nodiscard]] const std::string &get_url() const override;
 
+    //! \brief 設置像素格式轉換的綫程數，下次open時生效
+    //! \param thread_count 每幀按水平條帶分給這些綫程轉換，默認是0，即在調用者的綫程上轉換
+    void set_convert_threads(size_t thread_count);
+
   private:
     std::unique_ptr<ffmpeg_writer_impl> pimpl;
   };
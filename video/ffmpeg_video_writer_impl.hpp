@@ -20,6 +20,7 @@ extern "C" {
 #include "cv/mat.hpp"
 #include "ffmpeg_base.hpp"
 #include "log/log.hpp"
+#include "slice_converter.hpp"
 
 namespace cyy::naive_lib::video {
 
@@ -182,10 +183,15 @@ namespace cyy::naive_lib::video {
         LOG_ERROR("av_packet_alloc failed");
         return false;
       }
+      converter = std::make_unique<slice_converter>(convert_thread_count);
       opened = true;
       return true;
     }
 
+    void set_convert_threads(size_t thread_count) {
+      convert_thread_count = thread_count;
+    }
+
     //! \brief 寫入一幀
     bool write_frame(const cv::Mat &frame_mat) {
       if (!has_open()) {
@@ -194,43 +200,26 @@ namespace cyy::naive_lib::video {
       }
 
       const enum AVPixelFormat pix_fmt { AV_PIX_FMT_BGR24 };
-      uint8_t *src_data[4]{};
-      int src_linesize[4]{};
-      int ret = 0;
-      cv::Mat resized_mat;
-      if (frame_mat.type() == CV_8UC3) {
-        src_linesize[0] = static_cast<int>(frame_mat.step[0]);
-        ret = av_image_fill_pointers(src_data, pix_fmt, frame_mat.rows,
-                                     frame_mat.data, src_linesize);
-      } else {
-        resized_mat = ::cyy::naive_lib::opencv::mat(frame_mat)
-                          .convert_to(CV_8UC3)
-                          .get_cv_mat();
-        src_linesize[0] = static_cast<int>(resized_mat.step[0]);
-        ret = av_image_fill_pointers(src_data, pix_fmt, resized_mat.rows,
-                                     resized_mat.data, src_linesize);
-      }
-      if (ret <= 0) {
-        LOG_ERROR("av_image_fill_pointers failed:{}", errno_to_str(ret));
+      auto src = frame_mat.type() == CV_8UC3
+                     ? slice_converter::wrap_mat(frame_mat, pix_fmt)
+                     : slice_converter::wrap_mat(
+                           ::cyy::naive_lib::opencv::mat(frame_mat)
+                               .convert_to(CV_8UC3)
+                               .get_cv_mat(),
+                           pix_fmt);
+      if (!src) {
         return false;
       }
-
-      sws_ctx = sws_getCachedContext(sws_ctx, frame_mat.cols, frame_mat.rows,
-                                     pix_fmt, encode_ctx->width,
-                                     encode_ctx->height, encode_ctx->pix_fmt,
-                                     SWS_BICUBIC, nullptr, nullptr, nullptr);
-      if (!sws_ctx) {
-        LOG_ERROR("sws_getCachedContext failed");
+      // 編碼器可能還持有上一幀的緩衝區
+      auto ret = av_frame_make_writable(avframe);
+      if (ret < 0) {
+        LOG_ERROR("av_frame_make_writable failed:{}", errno_to_str(ret));
         return false;
       }
-      ret = sws_scale(sws_ctx, src_data, src_linesize, 0, frame_mat.rows,
-                      avframe->data, avframe->linesize);
-      if (ret <= 0) {
-        if (ret < 0) {
-          LOG_ERROR("sws_scale failed:{}", errno_to_str(ret));
-        } else {
-          LOG_ERROR("sws_scale failed");
-        }
+      // avframe由writer管理，這裡只借用
+      std::shared_ptr<AVFrame> dst(avframe, [](AVFrame *) {});
+      if (!converter->convert(std::move(src), std::move(dst), SWS_BICUBIC)) {
+        LOG_ERROR("convert frame failed");
         return false;
       }
 
@@ -280,10 +269,7 @@ namespace cyy::naive_lib::video {
         packet = nullptr;
       }
 
-      if (sws_ctx) {
-        sws_freeContext(sws_ctx);
-        sws_ctx = nullptr;
-      }
+      converter.reset();
 
       if (avframe) {
         av_frame_free(&avframe);
@@ -333,7 +319,8 @@ namespace cyy::naive_lib::video {
     AVStream *output_stream{nullptr};
     AVCodecContext *encode_ctx{nullptr};
     AVDictionary *opts{nullptr};
-    SwsContext *sws_ctx{nullptr};
+    size_t convert_thread_count{0};
+    std::unique_ptr<slice_converter> converter;
     AVFrame *avframe{nullptr};
     AVPacket *packet{nullptr};
     int64_t next_pts{};
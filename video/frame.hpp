@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include <opencv2/opencv.hpp>
 
 namespace cyy::naive_lib::video {
@@ -17,6 +20,12 @@ namespace cyy::naive_lib::video {
     uint64_t seq{};     //!< 帧序号
     cv::Mat content;    //!< 帧内容
     bool is_key{false}; //!< 标志是否关键帧
+    //! \brief 原始像素格式下的各個平面，只在native輸出模式下非空
+    //! \note native和luma模式下content和planes直接指向解碼器幀的數據，
+    //! 它們自己持有解碼器幀的引用，可以單獨保存
+    std::vector<cv::Mat> planes;
+    //! \brief content的像素格式，取值為AVPixelFormat
+    int pixel_format{-1};
     bool operator==(const frame &rhs) const;
   };
 } // namespace cyy::naive_lib::video
@@ -0,0 +1,189 @@
+/*!
+ * \file frame_pool.cpp
+ *
+ * \brief 回收幀緩衝區的分配器
+ */
+
+#include "frame_pool.hpp"
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace cyy::naive_lib::video {
+
+  //! \brief cv::Mat的分配器，緩衝區釋放時放回空閒列表
+  //! \note Mat只記錄分配器的指針，所以分配器在所有緩衝區歸還後才銷毀自己
+  class frame_pool::allocator final : public cv::MatAllocator {
+  public:
+    explicit allocator(size_t depth_) : depth{depth_} {}
+    ~allocator() override {
+      for (auto const &[size, data] : idle_buffers) {
+        cv::fastFree(data);
+      }
+    }
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data0,
+                           size_t *step, cv::AccessFlag /*flags*/,
+                           cv::UMatUsageFlags /*usageFlags*/) const override {
+      size_t total = CV_ELEM_SIZE(type);
+      for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+          if (data0 && step[i] != CV_AUTOSTEP) {
+            CV_Assert(total <= step[i]);
+            total = step[i];
+          } else {
+            step[i] = total;
+          }
+        }
+        total *= static_cast<size_t>(sizes[i]);
+      }
+      auto *u = new cv::UMatData(this);
+      u->size = total;
+      if (data0) {
+        u->data = u->origdata = static_cast<uchar *>(data0);
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+      }
+      uchar *data = nullptr;
+      {
+        std::lock_guard lk(mu);
+        outstanding++;
+        for (auto it = idle_buffers.begin(); it != idle_buffers.end(); it++) {
+          if (it->first == total) {
+            data = it->second;
+            idle_buffers.erase(it);
+            reused++;
+            break;
+          }
+        }
+        if (!data) {
+          allocated++;
+        }
+      }
+      if (!data) {
+        data = static_cast<uchar *>(cv::fastMalloc(total));
+      }
+      u->data = u->origdata = data;
+      return u;
+    }
+
+    bool allocate(cv::UMatData *u, cv::AccessFlag /*accessFlags*/,
+                  cv::UMatUsageFlags /*usageFlags*/) const override {
+      return u != nullptr;
+    }
+
+    void deallocate(cv::UMatData *u) const override {
+      if (!u) {
+        return;
+      }
+      CV_Assert(u->urefcount == 0);
+      CV_Assert(u->refcount == 0);
+      if (u->flags & cv::UMatData::USER_ALLOCATED) {
+        delete u;
+        return;
+      }
+      uchar *to_free = nullptr;
+      bool destroy = false;
+      {
+        std::lock_guard lk(mu);
+        outstanding--;
+        if (!detached && depth > 0) {
+          // 池滿時丟掉最早放入的緩衝區，它們多半是分辨率改變前的
+          if (idle_buffers.size() >= depth) {
+            to_free = idle_buffers.front().second;
+            idle_buffers.erase(idle_buffers.begin());
+          }
+          idle_buffers.emplace_back(u->size, u->origdata);
+        } else {
+          to_free = u->origdata;
+        }
+        destroy = detached && outstanding == 0;
+      }
+      u->origdata = nullptr;
+      delete u;
+      cv::fastFree(to_free);
+      if (destroy) {
+        delete this;
+      }
+    }
+
+    //! \brief 池析構時調用，之後歸還的緩衝區直接釋放
+    //! \note 釋放鎖後最後一個緩衝區可能在其它綫程歸還並銷毀分配器，
+    //! 所以空閒緩衝區在同一個臨界區內取出，之後只有負責銷毀時才訪問this
+    void detach() {
+      bool destroy = false;
+      std::vector<std::pair<size_t, uchar *>> to_free;
+      {
+        std::lock_guard lk(mu);
+        detached = true;
+        depth = 0;
+        to_free.swap(idle_buffers);
+        destroy = outstanding == 0;
+      }
+      for (auto const &[size, data] : to_free) {
+        cv::fastFree(data);
+      }
+      if (destroy) {
+        delete this;
+      }
+    }
+
+    void set_depth(size_t depth_) {
+      std::vector<std::pair<size_t, uchar *>> to_free;
+      {
+        std::lock_guard lk(mu);
+        depth = depth_;
+        while (idle_buffers.size() > depth) {
+          to_free.emplace_back(idle_buffers.front());
+          idle_buffers.erase(idle_buffers.begin());
+        }
+      }
+      for (auto const &[size, data] : to_free) {
+        cv::fastFree(data);
+      }
+    }
+
+    size_t idle_num() const {
+      std::lock_guard lk(mu);
+      return idle_buffers.size();
+    }
+    size_t reused_num() const {
+      std::lock_guard lk(mu);
+      return reused;
+    }
+    size_t allocated_num() const {
+      std::lock_guard lk(mu);
+      return allocated;
+    }
+
+  private:
+    mutable std::mutex mu;
+    size_t depth;
+    mutable std::vector<std::pair<size_t, uchar *>> idle_buffers;
+    mutable size_t outstanding{0};
+    mutable size_t reused{0};
+    mutable size_t allocated{0};
+    bool detached{false};
+  };
+
+  frame_pool::frame_pool(size_t depth) : impl{new allocator(depth)} {}
+
+  frame_pool::~frame_pool() { impl->detach(); }
+
+  cv::Mat frame_pool::allocate(int rows, int cols, int type) {
+    cv::Mat mat;
+    mat.allocator = impl;
+    mat.create(rows, cols, type);
+    // 緩衝區通過UMatData記住分配器，Mat本身不再引用它，
+    // 這樣Mat在池析構後重新分配時使用默認的分配器
+    mat.allocator = nullptr;
+    return mat;
+  }
+
+  void frame_pool::set_depth(size_t depth) { impl->set_depth(depth); }
+
+  size_t frame_pool::idle_num() const { return impl->idle_num(); }
+  size_t frame_pool::reused_num() const { return impl->reused_num(); }
+  size_t frame_pool::allocated_num() const { return impl->allocated_num(); }
+} // namespace cyy::naive_lib::video
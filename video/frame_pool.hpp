@@ -0,0 +1,45 @@
+/*!
+ * \file frame_pool.hpp
+ *
+ * \brief 回收幀緩衝區的分配器
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include <opencv2/opencv.hpp>
+
+namespace cyy::naive_lib::video {
+  //! \brief 回收frame::content的緩衝區，最後一個引用釋放時緩衝區回到池中
+  //! \note 视频幀的大小基本不變，所以按字節數精確匹配；綫程安全。
+  //! 池析構後仍在使用的緩衝區在釋放時直接歸還給系統
+  class frame_pool final {
+  public:
+    //! \param depth 池中保留的空閒緩衝區個數，為0時不回收
+    explicit frame_pool(size_t depth);
+    ~frame_pool();
+
+    frame_pool(const frame_pool &) = delete;
+    frame_pool &operator=(const frame_pool &) = delete;
+    frame_pool(frame_pool &&) = delete;
+    frame_pool &operator=(frame_pool &&) = delete;
+
+    //! \brief 分配一個連續的Mat，優先使用池中大小相同的緩衝區
+    [[nodiscard]] cv::Mat allocate(int rows, int cols, int type);
+
+    //! \brief 修改保留的空閒緩衝區個數，多出的緩衝區立即釋放
+    void set_depth(size_t depth);
+
+    //! \brief 空閒緩衝區的個數
+    [[nodiscard]] size_t idle_num() const;
+    //! \brief 重用緩衝區的次數
+    [[nodiscard]] size_t reused_num() const;
+    //! \brief 向系統申請緩衝區的次數
+    [[nodiscard]] size_t allocated_num() const;
+
+  private:
+    class allocator;
+    allocator *impl;
+  };
+} // namespace cyy::naive_lib::video
@@ -0,0 +1,61 @@
+/*!
+ * \file shared_mat.cpp
+ *
+ * \brief 持有外部緩衝區引用的cv::Mat
+ */
+
+#include "shared_mat.hpp"
+
+#include <utility>
+
+namespace cyy::naive_lib::video {
+
+  namespace {
+    //! \brief 只用於釋放make_shared_mat創建的UMatData，不分配新的緩衝區
+    //! \note Mat重新分配時使用自己的分配器，不會調用這裡的allocate
+    class owner_allocator final : public cv::MatAllocator {
+    public:
+      cv::UMatData *allocate(int /*dims*/, const int * /*sizes*/,
+                             int /*type*/, void * /*data0*/,
+                             size_t * /*step*/, cv::AccessFlag /*flags*/,
+                             cv::UMatUsageFlags /*usageFlags*/) const override {
+        return nullptr;
+      }
+
+      bool allocate(cv::UMatData * /*u*/, cv::AccessFlag /*accessFlags*/,
+                    cv::UMatUsageFlags /*usageFlags*/) const override {
+        return false;
+      }
+
+      void deallocate(cv::UMatData *u) const override {
+        if (!u) {
+          return;
+        }
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        delete static_cast<std::shared_ptr<const void> *>(u->userdata);
+        delete u;
+      }
+
+      //! \brief 進程共享，永不析構，Mat可能在靜態對象析構時才釋放
+      static const owner_allocator &instance() {
+        static auto *allocator = new owner_allocator();
+        return *allocator;
+      }
+    };
+  } // namespace
+
+  cv::Mat make_shared_mat(std::shared_ptr<const void> owner, int rows,
+                          int cols, int type, void *data, size_t step) {
+    cv::Mat mat(rows, cols, type, data, step);
+    auto holder =
+        std::make_unique<std::shared_ptr<const void>>(std::move(owner));
+    auto *u = new cv::UMatData(&owner_allocator::instance());
+    u->data = u->origdata = static_cast<uchar *>(data);
+    u->size = mat.step[0] * static_cast<size_t>(rows);
+    u->userdata = holder.release();
+    u->refcount = 1;
+    mat.u = u;
+    return mat;
+  }
+} // namespace cyy::naive_lib::video
@@ -0,0 +1,21 @@
+/*!
+ * \file shared_mat.hpp
+ *
+ * \brief 持有外部緩衝區引用的cv::Mat
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <opencv2/opencv.hpp>
+
+namespace cyy::naive_lib::video {
+  //! \brief 用外部緩衝區構造Mat，不複製數據
+  //! \param owner 緩衝區的所有者，Mat及其所有副本和ROI都釋放後才釋放它
+  //! \note 與frame_pool一樣通過UMatData記住分配器，Mat可以脫離frame單獨保存
+  [[nodiscard]] cv::Mat make_shared_mat(std::shared_ptr<const void> owner,
+                                        int rows, int cols, int type,
+                                        void *data, size_t step);
+} // namespace cyy::naive_lib::video
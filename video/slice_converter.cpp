@@ -0,0 +1,338 @@
+/*!
+ * \file slice_converter.cpp
+ *
+ * \brief 多綫程分條帶的像素格式轉換
+ */
+
+#include "slice_converter.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stop_token>
+#include <string>
+#include <utility>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+}
+
+#include "log/log.hpp"
+#include "util/runnable.hpp"
+
+namespace cyy::naive_lib::video {
+
+  class slice_converter::job {
+  public:
+    job(std::shared_ptr<AVFrame> src_, std::shared_ptr<AVFrame> dst_,
+        int flags_)
+        : src{std::move(src_)}, dst{std::move(dst_)}, flags{flags_} {}
+
+    std::shared_ptr<AVFrame> src;
+    std::shared_ptr<AVFrame> dst;
+    int flags;
+    //! 以下成員受slice_converter::mu保護
+    //! \brief 第一個取到轉換的綫程按SwsContext的對齊要求劃分條帶
+    bool sliced{false};
+    //! \brief 每個條帶的起始行和行數
+    std::vector<std::pair<int, int>> slices;
+    size_t next_slice{0};
+    size_t done_slices{0};
+    bool failed{false};
+    bool finished{false};
+  };
+
+  class slice_converter::cached_context {
+  public:
+    cached_context() = default;
+    ~cached_context() {
+      if (ctx) {
+        sws_freeContext(ctx);
+      }
+    }
+    cached_context(const cached_context &) = delete;
+    cached_context &operator=(const cached_context &) = delete;
+
+    //! \brief 返回與兩幀參數匹配的SwsContext
+    SwsContext *get(const AVFrame &src, const AVFrame &dst, int flags) {
+      std::array<int, 7> new_params{src.width, src.height, src.format,
+                                    dst.width, dst.height, dst.format,
+                                    flags};
+      if (ctx && new_params == params) {
+        return ctx;
+      }
+      if (ctx) {
+        sws_freeContext(ctx);
+      }
+      ctx = sws_alloc_context();
+      if (!ctx) {
+        LOG_ERROR("sws_alloc_context failed");
+        return nullptr;
+      }
+      // 綫程由我們自己劃分，sws內部不再開綫程
+      if (av_opt_set_int(ctx, "srcw", src.width, 0) < 0 ||
+          av_opt_set_int(ctx, "srch", src.height, 0) < 0 ||
+          av_opt_set_int(ctx, "src_format", src.format, 0) < 0 ||
+          av_opt_set_int(ctx, "dstw", dst.width, 0) < 0 ||
+          av_opt_set_int(ctx, "dsth", dst.height, 0) < 0 ||
+          av_opt_set_int(ctx, "dst_format", dst.format, 0) < 0 ||
+          av_opt_set_int(ctx, "sws_flags", flags, 0) < 0 ||
+          av_opt_set_int(ctx, "threads", 1, 0) < 0) {
+        LOG_ERROR("set sws options failed");
+        sws_freeContext(ctx);
+        ctx = nullptr;
+        return nullptr;
+      }
+      auto ret = sws_init_context(ctx, nullptr, nullptr);
+      if (ret < 0) {
+        LOG_ERROR("sws_init_context failed:{}", ret);
+        sws_freeContext(ctx);
+        ctx = nullptr;
+        return nullptr;
+      }
+      params = new_params;
+      return ctx;
+    }
+
+  private:
+    SwsContext *ctx{nullptr};
+    std::array<int, 7> params{};
+  };
+
+  class slice_converter::worker final : public cyy::naive_lib::runnable {
+  public:
+    explicit worker(slice_converter &owner_) : owner{owner_} {}
+    ~worker() override { stop(); }
+
+  private:
+    void run(const std::stop_token &st) override {
+      while (true) {
+        auto j = owner.next_job(st);
+        if (!j) {
+          return;
+        }
+        owner.run_slice(ctx, j);
+      }
+    }
+
+    slice_converter &owner;
+    cached_context ctx;
+  };
+
+  namespace {
+    //! \brief 把目標幀的行分成最多slice_num個條帶，起始行都按align對齊，
+    //! 不能整除的行併入最後一個條帶
+    std::vector<std::pair<int, int>> split(int height, size_t slice_num,
+                                           int align) {
+      std::vector<std::pair<int, int>> slices;
+      auto units = align > 0 ? height / align : 0;
+      if (slice_num <= 1 || units <= 1) {
+        slices.emplace_back(0, height);
+        return slices;
+      }
+      auto num = std::min<int>(static_cast<int>(slice_num), units);
+      int start = 0;
+      for (int i = 0; i < num; i++) {
+        auto rows = (units / num + (i < units % num ? 1 : 0)) * align;
+        if (i + 1 == num) {
+          rows = height - start;
+        }
+        slices.emplace_back(start, rows);
+        start += rows;
+      }
+      return slices;
+    }
+
+    bool scale_slice(SwsContext *ctx, const AVFrame &src, AVFrame &dst,
+                     int slice_start, int slice_height) {
+      auto ret = sws_frame_start(ctx, &dst, &src);
+      if (ret < 0) {
+        LOG_ERROR("sws_frame_start failed:{}", ret);
+        return false;
+      }
+      ret = sws_send_slice(ctx, 0, static_cast<unsigned int>(src.height));
+      if (ret >= 0) {
+        ret = sws_receive_slice(ctx, static_cast<unsigned int>(slice_start),
+                                static_cast<unsigned int>(slice_height));
+      }
+      sws_frame_end(ctx);
+      if (ret < 0) {
+        LOG_ERROR("sws slice [{}, {}) failed:{}", slice_start,
+                  slice_start + slice_height, ret);
+        return false;
+      }
+      return true;
+    }
+  } // namespace
+
+  slice_converter::slice_converter(size_t worker_num,
+                                   size_t max_pending_jobs_)
+      : max_pending_jobs{std::max<size_t>(max_pending_jobs_, 1)} {
+    if (worker_num == 0) {
+      inline_ctx = std::make_unique<cached_context>();
+      return;
+    }
+    for (size_t i = 0; i < worker_num; i++) {
+      workers.emplace_back(std::make_unique<worker>(*this));
+      workers.back()->start("slice_converter");
+    }
+  }
+
+  slice_converter::~slice_converter() {
+    // worker通過stop_token從job_cv上喚醒
+    workers.clear();
+  }
+
+  std::shared_ptr<slice_converter::job>
+  slice_converter::submit(std::shared_ptr<AVFrame> src,
+                          std::shared_ptr<AVFrame> dst, int flags) {
+    auto j = std::make_shared<job>(std::move(src), std::move(dst), flags);
+    if (!j->src || !j->dst || j->dst->width <= 0 || j->dst->height <= 0) {
+      // 沒有行可以分給工作綫程，wait不會等到完成
+      LOG_ERROR("source or destination frame is empty");
+      j->failed = true;
+      j->sliced = true;
+      j->finished = true;
+      return j;
+    }
+    if (inline_ctx) {
+      auto *ctx = inline_ctx->get(*j->src, *j->dst, flags);
+      j->failed = !ctx || !scale_slice(ctx, *j->src, *j->dst, 0,
+                                       j->dst->height);
+      j->sliced = true;
+      j->finished = true;
+      return j;
+    }
+    {
+      std::unique_lock lk(mu);
+      space_cv.wait(lk, [this] { return jobs.size() < max_pending_jobs; });
+      jobs.emplace_back(j);
+    }
+    job_cv.notify_all();
+    return j;
+  }
+
+  bool slice_converter::wait(job &j) {
+    std::unique_lock lk(mu);
+    done_cv.wait(lk, [&j] { return j.finished; });
+    return !j.failed;
+  }
+
+  bool slice_converter::convert(std::shared_ptr<AVFrame> src,
+                                std::shared_ptr<AVFrame> dst, int flags) {
+    auto j = submit(std::move(src), std::move(dst), flags);
+    return wait(*j);
+  }
+
+  std::shared_ptr<slice_converter::job>
+  slice_converter::next_job(const std::stop_token &st) {
+    std::unique_lock lk(mu);
+    if (!job_cv.wait(lk, st, [this] { return !jobs.empty(); })) {
+      return {};
+    }
+    return jobs.front();
+  }
+
+  void slice_converter::run_slice(cached_context &ctx,
+                                  const std::shared_ptr<job> &j) {
+    // 建立SwsContext可能較慢，不持有鎖
+    auto *sws_ctx = ctx.get(*j->src, *j->dst, j->flags);
+    std::pair<int, int> slice;
+    {
+      std::lock_guard lk(mu);
+      if (!j->sliced) {
+        j->sliced = true;
+        if (sws_ctx) {
+          j->slices = split(j->dst->height, workers.size(),
+                            static_cast<int>(
+                                sws_receive_slice_alignment(sws_ctx)));
+        } else {
+          j->failed = true;
+          j->finished = true;
+          std::erase(jobs, j);
+        }
+      }
+      if (j->finished) {
+        space_cv.notify_one();
+        done_cv.notify_all();
+        return;
+      }
+      if (j->next_slice == j->slices.size()) {
+        // 其它綫程已經取走所有條帶
+        return;
+      }
+      if (!sws_ctx) {
+        // 剩下的條帶都不做了
+        j->failed = true;
+        j->done_slices += j->slices.size() - j->next_slice;
+        j->next_slice = j->slices.size();
+      } else {
+        slice = j->slices[j->next_slice];
+        j->next_slice++;
+      }
+      if (j->next_slice == j->slices.size()) {
+        std::erase(jobs, j);
+        space_cv.notify_one();
+      }
+    }
+    bool succ = sws_ctx && scale_slice(sws_ctx, *j->src, *j->dst,
+                                       slice.first, slice.second);
+    {
+      std::lock_guard lk(mu);
+      if (sws_ctx) {
+        j->done_slices++;
+        if (!succ) {
+          j->failed = true;
+        }
+      }
+      if (j->done_slices < j->slices.size()) {
+        return;
+      }
+      j->finished = true;
+    }
+    done_cv.notify_all();
+  }
+
+  std::shared_ptr<AVFrame> slice_converter::wrap_mat(const cv::Mat &mat,
+                                                     int pixel_format) {
+    if (mat.empty()) {
+      LOG_ERROR("mat is empty");
+      return {};
+    }
+    auto *frame = av_frame_alloc();
+    if (!frame) {
+      LOG_ERROR("av_frame_alloc failed");
+      return {};
+    }
+    std::shared_ptr<AVFrame> frame_ptr(frame,
+                                       [](AVFrame *f) { av_frame_free(&f); });
+    frame->width = mat.cols;
+    frame->height = mat.rows;
+    frame->format = pixel_format;
+    frame->linesize[0] = static_cast<int>(mat.step[0]);
+    auto ret =
+        av_image_fill_pointers(frame->data,
+                               static_cast<enum AVPixelFormat>(pixel_format),
+                               mat.rows, mat.data, frame->linesize);
+    if (ret <= 0) {
+      LOG_ERROR("av_image_fill_pointers failed:{}", ret);
+      return {};
+    }
+    // 緩衝區釋放時才釋放Mat的引用
+    auto *holder = new cv::Mat(mat);
+    frame->buf[0] = av_buffer_create(
+        mat.data, mat.step[0] * static_cast<size_t>(mat.rows),
+        [](void *opaque, uint8_t * /*data*/) {
+          delete static_cast<cv::Mat *>(opaque);
+        },
+        holder, 0);
+    if (!frame->buf[0]) {
+      delete holder;
+      LOG_ERROR("av_buffer_create failed");
+      return {};
+    }
+    return frame_ptr;
+  }
+} // namespace cyy::naive_lib::video
@@ -0,0 +1,84 @@
+/*!
+ * \file slice_converter.hpp
+ *
+ * \brief 多綫程分條帶的像素格式轉換
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+struct AVFrame;
+struct SwsContext;
+
+namespace cyy::naive_lib::video {
+  //! \brief 把一幀的輸出按水平條帶分給多個綫程做sws轉換，每個綫程緩存自己的SwsContext
+  //! \note 沒有工作綫程時在調用者的綫程上轉換。
+  //! 源幀和目標幀都必須是引用計數的，否則sws會複製它們
+  class slice_converter final {
+  public:
+    //! \brief 一幀的轉換
+    class job;
+
+    //! \param worker_num 工作綫程數，為0時同步轉換
+    //! \param max_pending_jobs 排隊的轉換個數上限，達到上限時submit等待
+    explicit slice_converter(size_t worker_num, size_t max_pending_jobs = 4);
+    ~slice_converter();
+
+    slice_converter(const slice_converter &) = delete;
+    slice_converter &operator=(const slice_converter &) = delete;
+    slice_converter(slice_converter &&) = delete;
+    slice_converter &operator=(slice_converter &&) = delete;
+
+    [[nodiscard]] size_t worker_num() const { return workers.size(); }
+
+    //! \brief 提交轉換，立即返回，用wait等待完成
+    //! \param flags sws的插值標志，例如SWS_BICUBIC
+    //! \note 沒有工作綫程時在返回前完成轉換；幀為空或目標幀大小為0時直接失敗
+    [[nodiscard]] std::shared_ptr<job>
+    submit(std::shared_ptr<AVFrame> src, std::shared_ptr<AVFrame> dst,
+           int flags);
+
+    //! \brief 等待轉換完成
+    //! \return 轉換是否成功
+    bool wait(job &j);
+
+    //! \brief 同步轉換
+    bool convert(std::shared_ptr<AVFrame> src, std::shared_ptr<AVFrame> dst,
+                 int flags);
+
+    //! \brief 用引用計數的AVFrame包裝連續的單平面Mat，不複製數據
+    //! \param pixel_format 取值為AVPixelFormat，必須是單平面的格式
+    //! \note 返回的AVFrame持有Mat的引用
+    [[nodiscard]] static std::shared_ptr<AVFrame>
+    wrap_mat(const cv::Mat &mat, int pixel_format);
+
+  private:
+    class worker;
+    //! \brief 工作綫程自己的SwsContext，參數變化時重建
+    class cached_context;
+
+    //! \brief 工作綫程取下一個條帶，沒有轉換時阻塞
+    //! \return 停止時返回空
+    std::shared_ptr<job> next_job(const std::stop_token &st);
+    void run_slice(cached_context &ctx, const std::shared_ptr<job> &j);
+
+    std::mutex mu;
+    std::condition_variable_any job_cv;
+    std::condition_variable_any space_cv;
+    std::condition_variable done_cv;
+    //! \brief 還有條帶沒被取走的轉換
+    std::deque<std::shared_ptr<job>> jobs;
+    size_t max_pending_jobs;
+    std::unique_ptr<cached_context> inline_ctx;
+    std::vector<std::unique_ptr<worker>> workers;
+  };
+} // namespace cyy::naive_lib::video
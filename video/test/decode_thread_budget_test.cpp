@@ -0,0 +1,28 @@
+/*!
+ * \file decode_thread_budget_test.cpp
+ *
+ * \brief
+ */
+
+#include <doctest/doctest.h>
+
+#include "../decode_thread_budget.hpp"
+
+TEST_CASE("decode_thread_budget") {
+  cyy::naive_lib::video::decode_thread_budget budget(8);
+  CHECK_EQ(budget.acquire(6), 6);
+  CHECK_EQ(budget.acquire(6), 2);
+  // 預算用完後仍然得到一個綫程，不計入預算
+  CHECK_EQ(budget.acquire(4), 1);
+  CHECK_EQ(budget.in_use(), 8);
+  budget.release(1);
+  CHECK_EQ(budget.in_use(), 8);
+  budget.release(6);
+  CHECK_EQ(budget.acquire(4), 4);
+  CHECK_EQ(budget.in_use(), 6);
+  budget.release(100);
+  CHECK_EQ(budget.in_use(), 0);
+
+  budget.set_limit(0);
+  CHECK_GE(budget.get_limit(), 1);
+}
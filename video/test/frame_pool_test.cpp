@@ -0,0 +1,59 @@
+/*!
+ * \file frame_pool_test.cpp
+ *
+ * \brief
+ */
+
+#include <optional>
+#include <vector>
+
+#include <doctest/doctest.h>
+
+#include "../frame_pool.hpp"
+
+TEST_CASE("frame_pool") {
+  SUBCASE("buffers are reused") {
+    cyy::naive_lib::video::frame_pool pool(2);
+    auto mat = pool.allocate(1080, 1920, CV_8UC3);
+    CHECK(mat.isContinuous());
+    auto *data = mat.data;
+    auto copy = mat;
+    mat.release();
+    CHECK_EQ(pool.idle_num(), 0);
+    copy.release();
+    CHECK_EQ(pool.idle_num(), 1);
+
+    auto mat2 = pool.allocate(1080, 1920, CV_8UC3);
+    CHECK_EQ(mat2.data, data);
+    CHECK_EQ(pool.reused_num(), 1);
+    CHECK_EQ(pool.allocated_num(), 1);
+
+    auto other_size = pool.allocate(720, 1280, CV_8UC3);
+    CHECK_EQ(pool.allocated_num(), 2);
+  }
+
+  SUBCASE("depth limits idle buffers") {
+    cyy::naive_lib::video::frame_pool pool(2);
+    {
+      std::vector<cv::Mat> mats;
+      for (int i = 0; i < 5; i++) {
+        mats.emplace_back(pool.allocate(10, 10, CV_8UC1));
+      }
+    }
+    CHECK_EQ(pool.idle_num(), 2);
+    pool.set_depth(0);
+    CHECK_EQ(pool.idle_num(), 0);
+    auto mat = pool.allocate(10, 10, CV_8UC1);
+    mat.release();
+    CHECK_EQ(pool.idle_num(), 0);
+  }
+
+  SUBCASE("buffers outlive pool") {
+    std::optional<cyy::naive_lib::video::frame_pool> pool(std::in_place, 2);
+    auto mat = pool->allocate(10, 10, CV_8UC1);
+    pool.reset();
+    mat.setTo(1);
+    CHECK_EQ(mat.at<uint8_t>(9, 9), 1);
+    mat.release();
+  }
+}
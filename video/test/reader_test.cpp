@@ -42,3 +42,102 @@ TEST_CASE("ffmpeg_reader") {
   }
   CHECK(frames == reread_frames);
 }
+
+TEST_CASE("ffmpeg_reader output modes") {
+  cyy::naive_lib::video::ffmpeg_reader reader;
+  REQUIRE(reader.open(STR_HELPER(IN_URL)));
+  auto width = reader.get_video_width().value();
+  auto height = reader.get_video_height().value();
+
+  SUBCASE("native") {
+    reader.set_output_mode(
+        cyy::naive_lib::video::ffmpeg_reader::output_mode::native);
+    auto [res, frame] = reader.next_frame();
+    REQUIRE(res > 0);
+    CHECK(!frame.planes.empty());
+    CHECK_EQ(frame.content.data, frame.planes[0].data);
+    CHECK_EQ(frame.content.cols, width);
+    CHECK_EQ(frame.content.rows, height);
+    // 平面自己持有解碼器幀的引用，frame釋放並繼續解碼後數據仍然有效
+    auto plane = frame.planes.back();
+    auto expected = plane.clone();
+    frame = {};
+    for (int i = 0; i < 3; i++) {
+      auto [res2, frame2] = reader.next_frame();
+      REQUIRE(res2 > 0);
+    }
+    CHECK_EQ(cv::norm(plane, expected, cv::NORM_INF), 0);
+  }
+  SUBCASE("luma") {
+    reader.set_output_mode(
+        cyy::naive_lib::video::ffmpeg_reader::output_mode::luma);
+    auto [res, frame] = reader.next_frame();
+    REQUIRE(res > 0);
+    CHECK_EQ(frame.content.type(), CV_8UC1);
+    CHECK_EQ(frame.content.cols, width);
+    CHECK_EQ(frame.content.rows, height);
+  }
+}
+
+TEST_CASE("ffmpeg_reader decode threads") {
+  cyy::naive_lib::video::ffmpeg_reader reader;
+  reader.set_decode_threads(
+      2, cyy::naive_lib::video::ffmpeg_reader::decode_thread_type::frame);
+  REQUIRE(reader.open(STR_HELPER(IN_URL)));
+  for (size_t i = 0; i < 3; i++) {
+    auto [res, frame] = reader.next_frame();
+    REQUIRE(res > 0);
+    CHECK_EQ(frame.seq, i + 1);
+  }
+}
+
+TEST_CASE("ffmpeg_reader crop and resize") {
+  cyy::naive_lib::video::ffmpeg_reader reader;
+  REQUIRE(reader.open(STR_HELPER(IN_URL)));
+
+  SUBCASE("resize") {
+    reader.set_output_size(cv::Size(64, 48));
+    reader.set_interpolation(
+        cyy::naive_lib::video::ffmpeg_reader::interpolation::area);
+    auto [res, frame] = reader.next_frame();
+    REQUIRE(res > 0);
+    CHECK_EQ(frame.content.cols, 64);
+    CHECK_EQ(frame.content.rows, 48);
+    CHECK_EQ(frame.content.type(), CV_8UC3);
+  }
+  SUBCASE("crop") {
+    reader.set_crop_rect(cv::Rect(16, 16, 32, 32));
+    auto [res, frame] = reader.next_frame();
+    REQUIRE(res > 0);
+    CHECK_EQ(frame.content.cols, 32);
+    CHECK_EQ(frame.content.rows, 32);
+  }
+  SUBCASE("crop at odd origin") {
+    // 轉換和luma模式的輸出大小一致
+    reader.set_crop_rect(cv::Rect(15, 15, 32, 32));
+    auto [res, frame] = reader.next_frame();
+    REQUIRE(res > 0);
+    CHECK_EQ(frame.content.cols, 32);
+    CHECK_EQ(frame.content.rows, 32);
+    reader.set_output_mode(
+        cyy::naive_lib::video::ffmpeg_reader::output_mode::luma);
+    auto [res2, frame2] = reader.next_frame();
+    REQUIRE(res2 > 0);
+    CHECK_EQ(frame2.content.cols, 32);
+    CHECK_EQ(frame2.content.rows, 32);
+  }
+  SUBCASE("crop and resize luma") {
+    reader.set_output_mode(
+        cyy::naive_lib::video::ffmpeg_reader::output_mode::luma);
+    reader.set_crop_rect(cv::Rect(16, 16, 32, 32));
+    auto [res, frame] = reader.next_frame();
+    REQUIRE(res > 0);
+    CHECK_EQ(frame.content.cols, 32);
+    CHECK_EQ(frame.content.rows, 32);
+    reader.set_output_size(cv::Size(16, 16));
+    auto [res2, frame2] = reader.next_frame();
+    REQUIRE(res2 > 0);
+    CHECK_EQ(frame2.content.cols, 16);
+    CHECK_EQ(frame2.content.type(), CV_8UC1);
+  }
+}
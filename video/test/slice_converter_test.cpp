@@ -0,0 +1,81 @@
+/*!
+ * \file slice_converter_test.cpp
+ *
+ * \brief
+ */
+
+#include <memory>
+#include <vector>
+
+#include <doctest/doctest.h>
+extern "C" {
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+}
+
+#include "../slice_converter.hpp"
+
+namespace {
+  cv::Mat convert(cyy::naive_lib::video::slice_converter &converter,
+                  const cv::Mat &src, cv::Size dst_size) {
+    cv::Mat dst(dst_size, CV_8UC1);
+    auto src_frame = cyy::naive_lib::video::slice_converter::wrap_mat(
+        src, AV_PIX_FMT_BGR24);
+    auto dst_frame = cyy::naive_lib::video::slice_converter::wrap_mat(
+        dst, AV_PIX_FMT_GRAY8);
+    REQUIRE(src_frame);
+    REQUIRE(dst_frame);
+    REQUIRE(converter.convert(src_frame, dst_frame, SWS_BICUBIC));
+    return dst;
+  }
+} // namespace
+
+TEST_CASE("slice_converter") {
+  cv::Mat src(480, 640, CV_8UC3);
+  cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(255));
+  cyy::naive_lib::video::slice_converter single(0);
+  cyy::naive_lib::video::slice_converter parallel(4);
+  CHECK_EQ(parallel.worker_num(), 4);
+
+  SUBCASE("same size") {
+    auto expected = convert(single, src, src.size());
+    auto res = convert(parallel, src, src.size());
+    CHECK_EQ(cv::norm(expected, res, cv::NORM_INF), 0);
+  }
+  SUBCASE("scaled") {
+    auto expected = convert(single, src, cv::Size(320, 240));
+    auto res = convert(parallel, src, cv::Size(320, 240));
+    CHECK_EQ(cv::norm(expected, res, cv::NORM_INF), 0);
+  }
+  SUBCASE("height not aligned") {
+    // 最後一個條帶包含不能整除的行
+    auto expected = convert(single, src, cv::Size(321, 241));
+    auto res = convert(parallel, src, cv::Size(321, 241));
+    CHECK_EQ(cv::norm(expected, res, cv::NORM_INF), 0);
+  }
+  SUBCASE("empty destination") {
+    auto src_frame = cyy::naive_lib::video::slice_converter::wrap_mat(
+        src, AV_PIX_FMT_BGR24);
+    CHECK(!parallel.convert(src_frame, nullptr, SWS_BICUBIC));
+    CHECK(!single.convert(src_frame, nullptr, SWS_BICUBIC));
+  }
+  SUBCASE("pipelined") {
+    std::vector<cv::Mat> dsts;
+    std::vector<std::shared_ptr<cyy::naive_lib::video::slice_converter::job>>
+        jobs;
+    for (int i = 0; i < 8; i++) {
+      dsts.emplace_back(src.size(), CV_8UC1);
+      jobs.emplace_back(parallel.submit(
+          cyy::naive_lib::video::slice_converter::wrap_mat(src,
+                                                           AV_PIX_FMT_BGR24),
+          cyy::naive_lib::video::slice_converter::wrap_mat(dsts.back(),
+                                                           AV_PIX_FMT_GRAY8),
+          SWS_BICUBIC));
+    }
+    auto expected = convert(single, src, src.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+      REQUIRE(parallel.wait(*jobs[i]));
+      CHECK_EQ(cv::norm(expected, dsts[i], cv::NORM_INF), 0);
+    }
+  }
+}